@@ -0,0 +1,104 @@
+#include "./adapt.hpp"
+#include "./chain.hpp"
+#include "./profile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+/// True if the fine grid point lands on a point of the coarse grid
+bool is_coarse(const mush::Shifter& fine_shifter, int ix, int factor)
+{
+    return fine_shifter.shift_records[ix].a % factor == 0 && fine_shifter.shift_records[ix].b % factor == 0;
+}
+} // namespace
+
+namespace mush
+{
+std::vector<RefinementPoint> score_refinement(const SurfaceEvaluator& surface, const Shifter& fine_shifter, int factor)
+{
+    ScopedTimer timer("score_refinement");
+    if (factor < 1 || fine_shifter.grid_dims[0] % factor != 0 || fine_shifter.grid_dims[1] % factor != 0)
+    {
+        throw std::runtime_error("A " + std::to_string(fine_shifter.grid_dims[0]) + "x" + std::to_string(fine_shifter.grid_dims[1]) +
+                                 " grid is not a refinement of a coarser grid by a factor of " + std::to_string(factor) + ".");
+    }
+
+    Eigen::Matrix2Xd points(2, fine_shifter.size());
+    for (int i = 0; i < fine_shifter.size(); ++i)
+    {
+        auto shift = make_aligned_shift_vector(fine_shifter, i);
+        points.col(i) << shift[0], shift[1];
+    }
+    auto batch = surface.evaluate(points, SurfaceEvaluator::Order::HESSIAN);
+
+    auto units = make_shift_units(fine_shifter);
+    Eigen::Vector2d a_unit(units[0][0], units[0][1]);
+    Eigen::Vector2d b_unit(units[1][0], units[1][1]);
+
+    std::vector<RefinementPoint> scores;
+    scores.reserve(fine_shifter.size());
+    for (int i = 0; i < fine_shifter.size(); ++i)
+    {
+        // The closest coarse point is one of the corners of the coarse cell the point falls in
+        int a_offset = fine_shifter.shift_records[i].a % factor;
+        int b_offset = fine_shifter.shift_records[i].b % factor;
+        double distance = std::numeric_limits<double>::max();
+        for (int da : {a_offset, a_offset - factor})
+        {
+            for (int db : {b_offset, b_offset - factor})
+            {
+                distance = std::min(distance, (da * a_unit + db * b_unit).norm());
+            }
+        }
+
+        RefinementPoint score;
+        score.index = i;
+        score.predicted = batch.values(i);
+        score.curvature = spectral_radius(batch.hessians.col(i));
+        score.distance = distance;
+        score.estimated_error = 0.5 * distance * distance * score.curvature;
+        scores.push_back(score);
+    }
+    return scores;
+}
+
+std::vector<int> select_refinement(const std::vector<RefinementPoint>& scores, const Shifter& fine_shifter, int factor, int budget)
+{
+    std::vector<std::pair<double, int>> candidates;
+    for (int i = 0; i < fine_shifter.size(); ++i)
+    {
+        const auto& orbit = fine_shifter.equivalence_map[i];
+        if (orbit.front() != i)
+        {
+            continue;
+        }
+
+        bool known = false;
+        double worst = 0.0;
+        for (int e : orbit)
+        {
+            known = known || ::is_coarse(fine_shifter, e, factor);
+            worst = std::max(worst, scores[e].estimated_error);
+        }
+        if (!known)
+        {
+            candidates.emplace_back(worst, i);
+        }
+    }
+
+    // Ties go to the lower index, so the selection doesn't depend on the sort
+    std::sort(candidates.begin(), candidates.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+    });
+
+    std::vector<int> selected;
+    for (int c = 0; c < candidates.size() && c < budget; ++c)
+    {
+        selected.push_back(candidates[c].second);
+    }
+    return selected;
+}
+} // namespace mush
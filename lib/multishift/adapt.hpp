@@ -0,0 +1,47 @@
+#ifndef ADAPT_HH
+#define ADAPT_HH
+
+#include "./definitions.hpp"
+#include "./evaluator.hpp"
+#include "./shifter.hpp"
+#include <vector>
+
+namespace mush
+{
+/**
+ * Estimate of how much a point on a finer shift grid would improve a surface
+ * that was fitted on a coarser one. The fine grid is nested in the coarse one:
+ * every factor-th point along a and b already has a value.
+ *
+ * Near a computed point, the fitted surface is only reliable up to its quadratic
+ * term, so the error at a distance d from the closest computed point is estimated
+ * as d^2/2 times the largest curvature (largest eigenvalue magnitude of the Hessian).
+ * Flat regions and points next to computed ones score low, regions with sharp
+ * features between coarse points (e.g. around the unstable stacking fault) score high.
+ */
+
+struct RefinementPoint
+{
+    /// Index of the point on the fine grid of the shifter
+    int index;
+    /// Value of the fitted surface at the point
+    double predicted;
+    /// Largest eigenvalue magnitude of the Hessian of the fitted surface at the point
+    double curvature;
+    /// Cartesian distance to the closest point of the coarse grid
+    double distance;
+    /// Estimated error of the fitted surface at the point
+    double estimated_error;
+};
+
+/// Score every point of the fine grid. The shifter holds the fine grid, whose dimensions must be factor
+/// times the coarse ones. The surface is evaluated at the aligned shift vectors of the shifter.
+std::vector<RefinementPoint> score_refinement(const SurfaceEvaluator& surface, const Shifter& fine_shifter, int factor);
+
+/// Pick up to budget orbits of the fine grid to compute next, in order of decreasing estimated error.
+/// Orbits with a point on the coarse grid are already known, so they never get picked. Each orbit is
+/// scored by its worst point, and returned as the index of its representative.
+std::vector<int> select_refinement(const std::vector<RefinementPoint>& scores, const Shifter& fine_shifter, int factor, int budget);
+} // namespace mush
+
+#endif
@@ -0,0 +1,276 @@
+#include "./archive.hpp"
+#include <iterator>
+#include <stdexcept>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+namespace
+{
+/// Marks the start and end of every archive, changes if the layout ever changes
+const std::string ARCHIVE_MAGIC = "MUSHAR01";
+
+/// Size of the trailer: index offset, index size, magic
+const std::size_t TRAILER_SIZE = 8 + 8 + 8;
+
+void write_uint64(std::ostream& stream, std::uint64_t value)
+{
+    for (int byte = 0; byte < 8; ++byte)
+    {
+        stream.put(static_cast<char>((value >> (8 * byte)) & 0xFF));
+    }
+    return;
+}
+
+std::uint64_t read_uint64(const char* bytes)
+{
+    std::uint64_t value = 0;
+    for (int byte = 0; byte < 8; ++byte)
+    {
+        value |= static_cast<std::uint64_t>(static_cast<unsigned char>(bytes[byte])) << (8 * byte);
+    }
+    return value;
+}
+
+std::string compress_contents(const std::string& contents)
+{
+#ifdef HAVE_ZLIB_H
+    uLongf compressed_size = compressBound(contents.size());
+    std::string compressed(compressed_size, '\0');
+    int status = compress2(reinterpret_cast<Bytef*>(&compressed[0]),
+                           &compressed_size,
+                           reinterpret_cast<const Bytef*>(contents.data()),
+                           contents.size(),
+                           Z_DEFAULT_COMPRESSION);
+    if (status != Z_OK)
+    {
+        throw std::runtime_error("Failed to compress archive entry.");
+    }
+    compressed.resize(compressed_size);
+    return compressed;
+#else
+    throw std::runtime_error("Archive compression is not available, multishift was built without zlib.");
+#endif
+}
+
+std::string decompress_contents(const std::string& compressed, std::uint64_t size)
+{
+#ifdef HAVE_ZLIB_H
+    uLongf decompressed_size = size;
+    std::string contents(size, '\0');
+    int status = uncompress(reinterpret_cast<Bytef*>(&contents[0]),
+                            &decompressed_size,
+                            reinterpret_cast<const Bytef*>(compressed.data()),
+                            compressed.size());
+    if (status != Z_OK || decompressed_size != size)
+    {
+        throw std::runtime_error("Failed to decompress archive entry.");
+    }
+    return contents;
+#else
+    throw std::runtime_error("Archive entry is compressed, but multishift was built without zlib.");
+#endif
+}
+} // namespace
+
+namespace mush
+{
+ArchiveWriter::ArchiveWriter(const fs::path& target, bool compress)
+    : m_target(target), m_compress(compress), m_stream(target, std::ios::binary | std::ios::trunc), m_closed(false), m_offset(0)
+{
+    if (m_compress && !ArchiveWriter::compression_available())
+    {
+        throw std::runtime_error("Archive compression is not available, multishift was built without zlib.");
+    }
+
+    if (!m_stream)
+    {
+        throw std::runtime_error("Could not open " + target.string() + " to write the archive.");
+    }
+
+    m_stream << ::ARCHIVE_MAGIC;
+    m_offset = ::ARCHIVE_MAGIC.size();
+    m_index = json::object();
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    try
+    {
+        this->close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void ArchiveWriter::add_entry(const std::string& name, const std::string& contents)
+{
+    const std::string& stored = m_compress ? ::compress_contents(contents) : contents;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed)
+    {
+        throw std::runtime_error("Cannot add " + name + " to " + m_target.string() + " after it was closed.");
+    }
+    if (m_index.contains(name))
+    {
+        throw std::runtime_error("The archive " + m_target.string() + " already has an entry named " + name + ".");
+    }
+
+    m_stream.write(stored.data(), stored.size());
+    if (!m_stream)
+    {
+        throw std::runtime_error("Failed to write " + name + " to the archive " + m_target.string() + ".");
+    }
+
+    json entry;
+    entry["offset"] = m_offset;
+    entry["size"] = contents.size();
+    entry["stored_size"] = stored.size();
+    entry["compression"] = m_compress ? "zlib" : "none";
+    m_index[name] = entry;
+
+    m_offset += stored.size();
+    return;
+}
+
+void ArchiveWriter::add_file(const std::string& name, const fs::path& source)
+{
+    std::ifstream source_stream(source, std::ios::binary);
+    if (!source_stream)
+    {
+        throw std::runtime_error("Could not open " + source.string() + " to add it to the archive.");
+    }
+    std::string contents((std::istreambuf_iterator<char>(source_stream)), std::istreambuf_iterator<char>());
+    this->add_entry(name, contents);
+    return;
+}
+
+void ArchiveWriter::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed)
+    {
+        return;
+    }
+
+    std::string index = m_index.dump();
+    m_stream.write(index.data(), index.size());
+    ::write_uint64(m_stream, m_offset);
+    ::write_uint64(m_stream, index.size());
+    m_stream << ::ARCHIVE_MAGIC;
+    m_stream.close();
+    m_closed = true;
+
+    if (!m_stream)
+    {
+        throw std::runtime_error("Failed to write the index of the archive " + m_target.string() + ".");
+    }
+    return;
+}
+
+bool ArchiveWriter::compression_available()
+{
+#ifdef HAVE_ZLIB_H
+    return true;
+#else
+    return false;
+#endif
+}
+
+//*********************************************************************************//
+
+ArchiveReader::ArchiveReader(const fs::path& source) : m_source(source), m_stream(source, std::ios::binary)
+{
+    auto fail = [&](const std::string& reason) { return std::runtime_error("Could not read the archive " + source.string() + ": " + reason); };
+
+    if (!m_stream)
+    {
+        throw fail("file can't be opened.");
+    }
+
+    std::string magic(::ARCHIVE_MAGIC.size(), '\0');
+    m_stream.read(&magic[0], magic.size());
+    m_stream.seekg(0, std::ios::end);
+    std::uint64_t file_size = m_stream.tellg();
+    if (magic != ::ARCHIVE_MAGIC || file_size < magic.size() + ::TRAILER_SIZE)
+    {
+        throw fail("not a multishift archive.");
+    }
+
+    std::string trailer(::TRAILER_SIZE, '\0');
+    m_stream.seekg(file_size - ::TRAILER_SIZE);
+    m_stream.read(&trailer[0], trailer.size());
+    if (trailer.substr(16) != ::ARCHIVE_MAGIC)
+    {
+        throw fail("the archive is incomplete, it was never closed.");
+    }
+
+    std::uint64_t index_offset = ::read_uint64(trailer.data());
+    std::uint64_t index_size = ::read_uint64(trailer.data() + 8);
+    if (index_offset + index_size + ::TRAILER_SIZE != file_size)
+    {
+        throw fail("the index is corrupted.");
+    }
+
+    std::string index(index_size, '\0');
+    m_stream.seekg(index_offset);
+    m_stream.read(&index[0], index.size());
+
+    json parsed_index = json::parse(index);
+    for (const auto& [name, entry] : parsed_index.items())
+    {
+        m_index[name] = Entry{entry["offset"].get<std::uint64_t>(),
+                              entry["size"].get<std::uint64_t>(),
+                              entry["stored_size"].get<std::uint64_t>(),
+                              entry["compression"].get<std::string>() == "zlib"};
+    }
+}
+
+std::vector<std::string> ArchiveReader::entries() const
+{
+    std::vector<std::string> names;
+    for (const auto& name_entry : m_index)
+    {
+        names.push_back(name_entry.first);
+    }
+    return names;
+}
+
+bool ArchiveReader::contains(const std::string& name) const { return m_index.count(name) != 0; }
+
+std::string ArchiveReader::read(const std::string& name) const
+{
+    auto entry = m_index.find(name);
+    if (entry == m_index.end())
+    {
+        throw std::runtime_error("The archive " + m_source.string() + " has no entry named " + name + ".");
+    }
+
+    const auto& [offset, size, stored_size, compressed] = entry->second;
+    std::string stored(stored_size, '\0');
+    m_stream.clear();
+    m_stream.seekg(offset);
+    m_stream.read(&stored[0], stored.size());
+    if (!m_stream)
+    {
+        throw std::runtime_error("Failed to read " + name + " from the archive " + m_source.string() + ".");
+    }
+
+    return compressed ? ::decompress_contents(stored, size) : stored;
+}
+
+void ArchiveReader::extract(const std::string& name, const fs::path& target) const
+{
+    auto contents = this->read(name);
+    std::ofstream target_stream(target, std::ios::binary);
+    target_stream.write(contents.data(), contents.size());
+    if (!target_stream)
+    {
+        throw std::runtime_error("Failed to extract " + name + " to " + target.string() + ".");
+    }
+    return;
+}
+} // namespace mush
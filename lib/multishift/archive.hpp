@@ -0,0 +1,103 @@
+#ifndef ARCHIVE_HH
+#define ARCHIVE_HH
+
+#include "./definitions.hpp"
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Packs many small files (structures, records) into a single container file,
+ * to avoid creating thousands of directories and files on file systems where
+ * metadata operations are expensive.
+ *
+ * The layout is:
+ *     magic | entry | entry | ... | index | index offset | index size | magic
+ *
+ * Entries are stored back to back, in the order they were added, optionally
+ * compressed with zlib. The index is a json object that maps every entry name
+ * to its offset and size, and is written at the end, so entries can be streamed
+ * into the file without knowing how many there will be. Readers find the index
+ * through the fixed size trailer, and can then read any single entry directly.
+ */
+
+class ArchiveWriter
+{
+public:
+    /// Starts a new archive at target. Compression is only possible if zlib was available at build time.
+    ArchiveWriter(const fs::path& target, bool compress);
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    /// Writes the index if that hasn't been done already
+    ~ArchiveWriter();
+
+    /// Add an entry with the given contents. Names must be unique. Safe to call from several threads at once,
+    /// compression happens before the archive gets locked.
+    void add_entry(const std::string& name, const std::string& contents);
+
+    /// Add the contents of a file on disk as an entry
+    void add_file(const std::string& name, const fs::path& source);
+
+    /// Write the index and trailer. Nothing can be added afterwards.
+    void close();
+
+    /// True if the archive entries can be compressed
+    static bool compression_available();
+
+private:
+    fs::path m_target;
+    bool m_compress;
+    std::ofstream m_stream;
+    bool m_closed;
+
+    /// Guards the stream, the offset and the index
+    std::mutex m_mutex;
+    std::uint64_t m_offset;
+    json m_index;
+};
+
+/**
+ * Random access to the entries of an archive made with ArchiveWriter. Only the
+ * index is read when the archive is opened, entries are read when asked for.
+ */
+
+class ArchiveReader
+{
+public:
+    ArchiveReader(const fs::path& source);
+
+    /// Names of every entry in the archive, sorted
+    std::vector<std::string> entries() const;
+
+    /// True if there's an entry with the given name
+    bool contains(const std::string& name) const;
+
+    /// Contents of the entry, decompressed if needed
+    std::string read(const std::string& name) const;
+
+    /// Write the contents of the entry to a file
+    void extract(const std::string& name, const fs::path& target) const;
+
+private:
+    /// Where to find each entry, and how it's stored
+    struct Entry
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t stored_size;
+        bool compressed;
+    };
+
+    fs::path m_source;
+    mutable std::ifstream m_stream;
+    std::map<std::string, Entry> m_index;
+};
+} // namespace mush
+
+#endif
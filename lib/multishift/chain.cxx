@@ -0,0 +1,496 @@
+#include "./chain.hpp"
+#include "./parallel.hpp"
+#include "./profile.hpp"
+#include <casmutils/mush/shift.hpp>
+#include <casmutils/mush/slab.hpp>
+#include <casmutils/xtal/structure_tools.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+/// Directory of the record in the layout of the subcommand
+mush::fs::path make_target_directory(mush::SUBCOMMAND layout, const mush::MultiRecord& record)
+{
+    switch (layout)
+    {
+    case mush::SUBCOMMAND::CLEAVE:
+        return mush::make_target_directory<mush::SUBCOMMAND::CLEAVE>(record);
+    case mush::SUBCOMMAND::SHIFT:
+        return mush::make_target_directory<mush::SUBCOMMAND::SHIFT>(record);
+    default:
+        return mush::make_target_directory<mush::SUBCOMMAND::CHAIN>(record);
+    }
+}
+} // namespace
+
+namespace mush
+{
+std::string MultiRecord::id() const
+{
+    std::string id = std::to_string(a_index) + ":" + std::to_string(b_index) + ":";
+
+    std::stringstream cleavestream;
+    cleavestream << std::fixed << std::setprecision(6) << cleavage;
+
+    id += cleavestream.str();
+    return id;
+}
+
+std::string make_cleave_dirname(double cleavage)
+{
+    std::stringstream cleavestream;
+    cleavestream << std::fixed << std::setprecision(6) << cleavage;
+    return "cleave__" + cleavestream.str();
+}
+
+std::string make_shift_dirname(int a, int b) { return "shift__" + std::to_string(a) + "." + std::to_string(b); }
+
+template <>
+fs::path make_target_directory<SUBCOMMAND::CLEAVE>(const MultiRecord& record)
+{
+    return make_cleave_dirname(record.cleavage);
+}
+
+template <>
+fs::path make_target_directory<SUBCOMMAND::SHIFT>(const MultiRecord& record)
+{
+    return make_shift_dirname(record.a_index, record.b_index);
+}
+
+template <>
+fs::path make_target_directory<SUBCOMMAND::CHAIN>(const MultiRecord& record)
+{
+    return fs::path(make_shift_dirname(record.a_index, record.b_index)) / make_cleave_dirname(record.cleavage);
+}
+
+MultiRecord make_multirecord(double cleave, const Shifter& shifter, int ix)
+{
+    auto make_partial = [](double _cleave, const Shifter& _shifter, int _ix) {
+        MultiRecord record;
+        record.cleavage = _cleave;
+        record.a_index = _shifter.shift_records[_ix].a;
+        record.b_index = _shifter.shift_records[_ix].b;
+        return record;
+    };
+
+    auto record = make_partial(cleave, shifter, ix);
+    for (int eqx : shifter.equivalence_map[ix])
+    {
+        record.equivalent_structures.emplace_back(make_partial(cleave, shifter, eqx).id());
+    }
+
+    return record;
+}
+
+json serialize(const MultiRecord& record)
+{
+    json j;
+
+    j["grid_point"] = std::vector<int>{record.a_index, record.b_index};
+    j["cleavage"] = record.cleavage;
+    j["equivalent_structures"] = record.equivalent_structures;
+
+    return j;
+}
+
+std::array<double, 2> make_aligned_shift_vector(const Shifter& shifter, int ix)
+{
+    auto aligned_lat = make_aligned(shifter.slab.lattice());
+    Eigen::Vector3d a_shift = static_cast<double>(shifter.shift_records[ix].a) / shifter.grid_dims[0] * aligned_lat.a();
+    Eigen::Vector3d b_shift = static_cast<double>(shifter.shift_records[ix].b) / shifter.grid_dims[1] * aligned_lat.b();
+    Eigen::Vector3d aligned_shift = a_shift + b_shift;
+
+    assert(cu::almost_equal(aligned_shift(2), 0.0));
+
+    return {aligned_shift(0), aligned_shift(1)};
+}
+
+std::array<std::array<double, 2>, 2> make_shift_units(const Shifter& shifter)
+{
+    auto aligned_lat = make_aligned(shifter.slab.lattice());
+    Eigen::Vector3d a_shift = 1.0 / shifter.grid_dims[0] * aligned_lat.a();
+    Eigen::Vector3d b_shift = 1.0 / shifter.grid_dims[1] * aligned_lat.b();
+
+    std::array<double, 2> a{a_shift(0), a_shift(1)};
+    std::array<double, 2> b{b_shift(0), b_shift(1)};
+
+    return {a, b};
+}
+
+std::string make_poscar_contents(const cu::xtal::Structure& structure)
+{
+    ScopedTimer timer("format_poscar");
+    std::stringstream poscar_stream;
+    cu::xtal::print_poscar(structure, poscar_stream);
+    return poscar_stream.str();
+}
+
+bool matches_hash(const fs::path& file, const std::string& hash)
+{
+    ScopedTimer timer("verify_hash");
+    std::ifstream file_stream(file, std::ios::binary);
+    if (!file_stream)
+    {
+        return false;
+    }
+    std::string contents((std::istreambuf_iterator<char>(file_stream)), std::istreambuf_iterator<char>());
+    return content_hash(contents) == hash;
+}
+
+//*********************************************************************************//
+
+void enumerate_chain(const Shifter& shifter,
+                     const std::vector<double>& cleavages,
+                     SUBCOMMAND layout,
+                     const ChainSettings& settings,
+                     const std::vector<ChainSink*>& sinks)
+{
+    json header;
+    header["grid"] = shifter.grid_dims;
+    header["cleavages"] = cleavages;
+    header["shift_units"] = make_shift_units(shifter);
+    for (auto* sink : sinks)
+    {
+        sink->begin(shifter.slab, header);
+    }
+
+    // Grid points that get enumerated, always entire orbits
+    std::vector<int> enumerated_ixs;
+    if (settings.selection.empty())
+    {
+        for (int i = 0; i < shifter.size(); ++i)
+        {
+            enumerated_ixs.push_back(i);
+        }
+    }
+    else
+    {
+        std::set<int> selected_ixs;
+        for (int s : settings.selection)
+        {
+            selected_ixs.insert(shifter.equivalence_map.at(s).begin(), shifter.equivalence_map.at(s).end());
+        }
+        enumerated_ixs.assign(selected_ixs.begin(), selected_ixs.end());
+    }
+
+    std::vector<std::vector<std::string>> unique_equivalent_groups;
+    std::unordered_map<int, int> equivalence_map_ix_to_group_label;
+    for (double cleave : cleavages)
+    {
+        for (auto* sink : sinks)
+        {
+            sink->begin_cleavage(cleave);
+        }
+
+        // Everything that ends up in the record is done serially, in order, so that the
+        // ids and orbit labels don't depend on how many threads are used
+        std::unordered_set<int> recorded_equivalents;
+        std::vector<fs::path> target_dirs(shifter.size());
+        std::vector<std::string> ids(shifter.size());
+        std::vector<json> chunks(shifter.size());
+        for (int i : enumerated_ixs)
+        {
+            auto report = make_multirecord(cleave, shifter, i);
+
+            if (recorded_equivalents.count(i) == 0)
+            {
+                for (int e : shifter.equivalence_map[i])
+                {
+                    equivalence_map_ix_to_group_label[e] = unique_equivalent_groups.size();
+                }
+                unique_equivalent_groups.push_back(report.equivalent_structures);
+                recorded_equivalents.insert(shifter.equivalence_map[i].begin(), shifter.equivalence_map[i].end());
+            }
+
+            auto dir = ::make_target_directory(layout, report);
+            target_dirs[i] = dir;
+
+            auto chunk = serialize(report);
+            chunk["directory"] = dir;
+            chunk["shift"] = make_aligned_shift_vector(shifter, i);
+            chunk["orbit"] = equivalence_map_ix_to_group_label[i];
+            if (settings.irreducible)
+            {
+                // Orbits are sorted, so the representative always comes before (or is) i
+                int representative = shifter.equivalence_map[i].front();
+                chunk["directory"] = target_dirs[representative];
+                chunk["representative"] = make_multirecord(cleave, shifter, representative).id();
+            }
+
+            ids[i] = report.id();
+            chunks[i] = chunk;
+        }
+
+        // Structures that exist somewhere else are pointed to instead of made again
+        std::vector<bool> existing(shifter.size(), false);
+        for (int i : enumerated_ixs)
+        {
+            auto existing_entry = settings.existing.find(ids[i]);
+            if (existing_entry != settings.existing.end())
+            {
+                chunks[i].update(*existing_entry);
+                existing[i] = true;
+            }
+        }
+
+        // If only some of the equivalent ids of an orbit exist, their structure can stand in for the representative
+        for (int i : enumerated_ixs)
+        {
+            const auto& orbit = shifter.equivalence_map[i];
+            if (!settings.irreducible || orbit.front() != i || existing[i])
+            {
+                continue;
+            }
+            auto stand_in = std::find_if(orbit.begin(), orbit.end(), [&](int e) { return existing[e]; });
+            if (stand_in != orbit.end())
+            {
+                chunks[i].update(settings.existing.at(ids[*stand_in]));
+                existing[i] = true;
+            }
+        }
+
+        // Which sinks want which structures. Structures nobody wants are never made.
+        std::vector<int> made_ixs;
+        std::vector<std::vector<ChainSink*>> receivers(shifter.size());
+        for (int i : enumerated_ixs)
+        {
+            if (existing[i])
+            {
+                profile_count("structures_reused");
+                continue;
+            }
+            if (settings.irreducible && shifter.equivalence_map[i].front() != i)
+            {
+                continue;
+            }
+            for (auto* sink : sinks)
+            {
+                if (sink->wants_structure(ids[i], &chunks[i]))
+                {
+                    receivers[i].push_back(sink);
+                }
+            }
+            if (!receivers[i].empty())
+            {
+                made_ixs.push_back(i);
+            }
+        }
+
+        // Each structure is independent of the others, so they can be made in any order
+        parallel_for(made_ixs.size(), settings.threads, [&](int m) {
+            int i = made_ixs[m];
+
+            ScopedTimer cleave_timer("cleave");
+            auto cleaved_shifted_structure = make_cleaved_structure(shifter.shifted_structure(i), cleave);
+            cleave_timer.stop();
+
+            for (auto* sink : receivers[i])
+            {
+                sink->accept(ids[i], &chunks[i], cleaved_shifted_structure);
+            }
+        });
+
+        ScopedTimer record_timer("record");
+        for (int i : enumerated_ixs)
+        {
+            // Without a structure of its own, an id shares whatever was added for its representative
+            int representative = shifter.equivalence_map[i].front();
+            if (settings.irreducible && representative != i && !existing[i])
+            {
+                chunks[i]["directory"] = chunks[representative]["directory"];
+                for (const auto& [key, value] : chunks[representative].items())
+                {
+                    if (!chunks[i].contains(key))
+                    {
+                        chunks[i][key] = value;
+                    }
+                }
+            }
+
+            for (auto* sink : sinks)
+            {
+                sink->record_id(ids[i], chunks[i]);
+            }
+        }
+        profile_count("ids", enumerated_ixs.size());
+    }
+    profile_count("orbits", unique_equivalent_groups.size());
+
+    json footer;
+    footer["equivalents"] = unique_equivalent_groups;
+    if (settings.irreducible)
+    {
+        footer["irreducible"] = true;
+    }
+    for (auto* sink : sinks)
+    {
+        sink->end(footer);
+    }
+    return;
+}
+
+//*********************************************************************************//
+
+DirectorySink::DirectorySink(const fs::path& output_dir, const json& previous_ids, std::ostream* log)
+    : m_output_dir(output_dir), m_previous_ids(previous_ids), m_log(log), m_reused(0)
+{
+}
+
+void DirectorySink::begin(const Structure& slab, const json& /*header*/)
+{
+    m_slab_contents = make_poscar_contents(slab);
+    return;
+}
+
+bool DirectorySink::wants_structure(const std::string& id, json* chunk)
+{
+    auto previous_id = m_previous_ids.find(id);
+    if (previous_id == m_previous_ids.end() || !previous_id->contains("hash"))
+    {
+        return true;
+    }
+
+    const auto& hash = (*previous_id)["hash"].get<std::string>();
+    if (!matches_hash(m_output_dir / (*chunk)["directory"].get<std::string>() / "POSCAR", hash))
+    {
+        return true;
+    }
+
+    (*chunk)["hash"] = hash;
+    profile_count("structures_reused");
+    ++m_reused;
+    return false;
+}
+
+void DirectorySink::accept(const std::string& /*id*/, json* chunk, const Structure& structure)
+{
+    auto contents = make_poscar_contents(structure);
+    (*chunk)["hash"] = content_hash(contents);
+
+    auto target_dir = m_output_dir / (*chunk)["directory"].get<std::string>();
+    if (m_log != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        *m_log << "Write structure to " << target_dir / "POSCAR" << "...\n";
+    }
+
+    {
+        ScopedTimer timer("create_directories");
+        fs::create_directories(target_dir);
+    }
+
+    ScopedTimer timer("write_file");
+    std::ofstream poscar_stream(target_dir / "POSCAR");
+    poscar_stream << contents;
+    profile_count("structures_written");
+    profile_count("bytes_written", contents.size());
+    return;
+}
+
+void DirectorySink::end(const json& /*footer*/)
+{
+    if (m_log != nullptr)
+    {
+        *m_log << "Back up slab structure to " << m_output_dir / "slab.vasp" << "...\n";
+    }
+    std::ofstream slab_stream(m_output_dir / "slab.vasp");
+    slab_stream << m_slab_contents;
+    return;
+}
+
+//*********************************************************************************//
+
+ArchiveSink::ArchiveSink(ArchiveWriter* archive, std::ostream* log) : m_archive(archive), m_log(log) {}
+
+void ArchiveSink::begin(const Structure& slab, const json& /*header*/)
+{
+    m_slab_contents = make_poscar_contents(slab);
+    return;
+}
+
+void ArchiveSink::accept(const std::string& /*id*/, json* chunk, const Structure& structure)
+{
+    auto contents = make_poscar_contents(structure);
+    (*chunk)["hash"] = content_hash(contents);
+
+    auto target_file = fs::path((*chunk)["directory"].get<std::string>()) / "POSCAR";
+    if (m_log != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        *m_log << "Pack structure as " << target_file << "...\n";
+    }
+
+    ScopedTimer timer("archive_entry");
+    m_archive->add_entry(target_file.generic_string(), contents);
+    profile_count("structures_written");
+    profile_count("bytes_written", contents.size());
+    return;
+}
+
+void ArchiveSink::end(const json& /*footer*/)
+{
+    if (m_log != nullptr)
+    {
+        *m_log << "Pack slab structure as " << fs::path("slab.vasp") << "...\n";
+    }
+    m_archive->add_entry("slab.vasp", m_slab_contents);
+    return;
+}
+
+//*********************************************************************************//
+
+RecordSink::RecordSink(const fs::path& target, RecordWriter::FORMAT format, const json& previous_ids)
+    : m_writer(target, format), m_previous_ids(previous_ids)
+{
+}
+
+void RecordSink::begin(const Structure& /*slab*/, const json& header)
+{
+    for (const auto& key : {"grid", "cleavages", "shift_units"})
+    {
+        m_writer.write_entry(key, header[key]);
+    }
+    m_writer.begin_ids();
+    return;
+}
+
+void RecordSink::record_id(const std::string& id, const json& chunk)
+{
+    auto previous_id = m_previous_ids.find(id);
+    if (previous_id == m_previous_ids.end())
+    {
+        m_writer.write_id(id, chunk);
+        return;
+    }
+
+    auto merged = chunk;
+    for (const auto& [key, value] : previous_id->items())
+    {
+        if (!merged.contains(key))
+        {
+            merged[key] = value;
+        }
+    }
+    m_writer.write_id(id, merged);
+    return;
+}
+
+void RecordSink::end(const json& footer)
+{
+    m_writer.end_ids();
+    for (const auto& [key, value] : footer.items())
+    {
+        m_writer.write_entry(key, value);
+    }
+    m_writer.close();
+    return;
+}
+} // namespace mush
@@ -0,0 +1,209 @@
+#ifndef CHAIN_HH
+#define CHAIN_HH
+
+#include "./archive.hpp"
+#include "./definitions.hpp"
+#include "./record.hpp"
+#include "./shifter.hpp"
+#include <array>
+#include <atomic>
+#include <casmutils/xtal/structure.hpp>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Keeps all the info for a particular structure, cleavage
+ */
+
+struct MultiRecord
+{
+    double cleavage = 0.0;
+    int a_index = 0;
+    int b_index = 0;
+    std::string id() const;
+    std::vector<std::string> equivalent_structures;
+};
+
+/// Directory layout of the structures: a single layer for cleave and shift, two layers for chain
+enum class SUBCOMMAND
+{
+    CLEAVE,
+    SHIFT,
+    CHAIN
+};
+
+std::string make_cleave_dirname(double cleavage);
+std::string make_shift_dirname(int a, int b);
+
+/// Path of the directory the structure of the record goes to, relative to the output directory
+template <SUBCOMMAND>
+fs::path make_target_directory(const MultiRecord& record);
+template <>
+fs::path make_target_directory<SUBCOMMAND::CLEAVE>(const MultiRecord& record);
+template <>
+fs::path make_target_directory<SUBCOMMAND::SHIFT>(const MultiRecord& record);
+template <>
+fs::path make_target_directory<SUBCOMMAND::CHAIN>(const MultiRecord& record);
+
+/// Record of the structure at grid point ix of the shifter, separated by cleave, along with the ids of every equivalent structure
+MultiRecord make_multirecord(double cleave, const Shifter& shifter, int ix);
+json serialize(const MultiRecord& record);
+
+/// Shift of the grid point ix, in cartesian coordinates of the aligned slab
+std::array<double, 2> make_aligned_shift_vector(const Shifter& shifter, int ix);
+
+/// Distance between neighboring grid points along a and b, in cartesian coordinates of the aligned slab
+std::array<std::array<double, 2>, 2> make_shift_units(const Shifter& shifter);
+
+/// Contents of the structure as a POSCAR file
+std::string make_poscar_contents(const cu::xtal::Structure& structure);
+
+/// True if the file exists and its contents have the given hash
+bool matches_hash(const fs::path& file, const std::string& hash);
+
+/**
+ * Receives everything that gets made while enumerating a chain (see enumerate_chain),
+ * as it's being made. Writing the structures to disk, packing them into an archive,
+ * and streaming the record are all sinks, and programs that link against the library
+ * can provide their own to get the structures without them ever touching the disk.
+ *
+ * For each cleavage, every sink is first asked which structures it wants. Structures
+ * that no sink wants are never made. The ones that are get handed over to the sinks
+ * that asked for them, possibly from several threads at once. Once every structure of
+ * the cleavage is done, the complete entry of every id is handed to record_id, in order.
+ *
+ * The chunk passed around is what the record holds for the id. Sinks can add to it
+ * (e.g. the hash of the file they wrote) until it gets recorded.
+ */
+
+class ChainSink
+{
+public:
+    using Structure = cu::xtal::Structure;
+
+    virtual ~ChainSink() = default;
+
+    /// Called before anything else, with the unshifted slab and the top level entries of the record
+    /// ("grid", "cleavages" and "shift_units")
+    virtual void begin(const Structure& /*slab*/, const json& /*header*/) {}
+
+    /// Called before the structures of each cleavage value are made
+    virtual void begin_cleavage(double /*cleavage*/) {}
+
+    /// True if the sink should be given the structure of the id. Called serially, in order.
+    virtual bool wants_structure(const std::string& /*id*/, json* /*chunk*/) { return false; }
+
+    /// Receive a structure that was asked for. Calls for different ids can happen at the same time
+    /// from different threads, unless the chain is enumerated with a single thread.
+    virtual void accept(const std::string& /*id*/, json* /*chunk*/, const Structure& /*structure*/) {}
+
+    /// Called for every id, in order, with its complete entry
+    virtual void record_id(const std::string& /*id*/, const json& /*chunk*/) {}
+
+    /// Called after everything else, with the remaining top level entries of the record ("equivalents" and "irreducible")
+    virtual void end(const json& /*footer*/) {}
+};
+
+/// Settings that change how the structures of a chain are generated, regardless of where they end up
+struct ChainSettings
+{
+    /// Number of threads the structures are made with, less than 1 means all cores
+    int threads = 1;
+    /// Only make one structure per orbit, every equivalent id points to the directory of its representative
+    bool irreducible = false;
+    /// If not empty, only the orbits of these grid points are made and recorded, the rest of the grid is skipped
+    std::vector<int> selection;
+    /// Entries for ids whose structure already exists somewhere else (e.g. from an earlier run on a coarser grid),
+    /// keyed by id. They get merged into the entry of the id, which is recorded, but the structure is never made.
+    json existing = json::object();
+};
+
+/**
+ * Creates the structure for every shift of the shifter at each cleavage, and hands
+ * them to the sinks, in the layout of the given subcommand. The record entries
+ * passed to the sinks never depend on the number of threads.
+ *
+ * With irreducible set, only the representative of each orbit gets a structure.
+ * The other ids of the orbit share it, so they also get anything the sinks added
+ * to the entry of the representative. A representative that doesn't exist yet, but
+ * has an equivalent id that does, takes the existing entry of that id instead.
+ */
+
+void enumerate_chain(const Shifter& shifter,
+                     const std::vector<double>& cleavages,
+                     SUBCOMMAND layout,
+                     const ChainSettings& settings,
+                     const std::vector<ChainSink*>& sinks);
+
+/**
+ * Writes every structure it's given as a POSCAR in its own directory, and the slab
+ * as slab.vasp at the end. The hash of each file goes into the record.
+ *
+ * Ids of a previous run are not made again if the file in their directory still
+ * matches the hash it was recorded with.
+ */
+
+class DirectorySink : public ChainSink
+{
+public:
+    /// The output directory must already exist. If log is given, every file that gets written is reported there.
+    DirectorySink(const fs::path& output_dir, const json& previous_ids = json::object(), std::ostream* log = nullptr);
+
+    void begin(const Structure& slab, const json& header) override;
+    bool wants_structure(const std::string& id, json* chunk) override;
+    void accept(const std::string& id, json* chunk, const Structure& structure) override;
+    void end(const json& footer) override;
+
+    /// Number of structures left by a previous run that didn't have to be written again
+    int reused() const { return m_reused; }
+
+private:
+    fs::path m_output_dir;
+    json m_previous_ids;
+    std::ostream* m_log;
+    std::mutex m_log_mutex;
+    std::atomic<int> m_reused;
+    std::string m_slab_contents;
+};
+
+/// Adds every structure it's given to the archive as a POSCAR, and the slab as slab.vasp at the end.
+/// The archive stays open, so the caller can add the record once it's complete.
+class ArchiveSink : public ChainSink
+{
+public:
+    ArchiveSink(ArchiveWriter* archive, std::ostream* log = nullptr);
+
+    void begin(const Structure& slab, const json& header) override;
+    bool wants_structure(const std::string& /*id*/, json* /*chunk*/) override { return true; }
+    void accept(const std::string& id, json* chunk, const Structure& structure) override;
+    void end(const json& footer) override;
+
+private:
+    ArchiveWriter* m_archive;
+    std::ostream* m_log;
+    std::mutex m_log_mutex;
+    std::string m_slab_contents;
+};
+
+/// Streams the record to disk as the ids come in. Values of a previous record (e.g. energies)
+/// carry over to ids that don't have them.
+class RecordSink : public ChainSink
+{
+public:
+    RecordSink(const fs::path& target, RecordWriter::FORMAT format, const json& previous_ids = json::object());
+
+    void begin(const Structure& slab, const json& header) override;
+    void record_id(const std::string& id, const json& chunk) override;
+    void end(const json& footer) override;
+
+private:
+    RecordWriter m_writer;
+    json m_previous_ids;
+};
+} // namespace mush
+
+#endif
@@ -28,6 +28,9 @@ namespace mush
 
     using namespace cu::mush;
 
+    /// Wraps the index back into [0,dim)
+    inline long wrap_index(long ix, int dim) { return ((ix % dim) + dim) % dim; }
+
     //TODO
     /* double degrees_to_radians(double degrees); */
     /* double radians_to_degrees(double rad); */
@@ -0,0 +1,206 @@
+#include "./evaluator.hpp"
+#include <cmath>
+#include <map>
+#include <utility>
+
+namespace mush
+{
+SurfaceEvaluator::SurfaceEvaluator(const Analytiker& analyzer, double crush_value) : m_max_a_ix(0), m_max_b_ix(0)
+{
+    const auto& recip_lat = analyzer.reciprocal_lattice();
+    m_a_recip << recip_lat.a()(0), recip_lat.a()(1);
+    m_b_recip << recip_lat.b()(0), recip_lat.b()(1);
+
+    // The formula bits are sorted by magnitude, so the cos and sin terms of the same
+    // k-point aren't next to each other. Collect them by k-point first.
+    std::map<std::pair<int, int>, std::pair<double, double>> real_coeffs;
+    for (const auto& bit : analyzer.formula_bits())
+    {
+        auto value = std::get<0>(bit);
+        if (almost_equal(value, 0.0, crush_value))
+        {
+            continue;
+        }
+
+        // Bits of a star share their coefficient with every k-point in it
+        const auto& k_points = analyzer.k_points();
+        for (int k_grid_ix : analyzer.star(std::get<2>(bit)))
+        {
+            std::pair<int, int> k_ix(std::lround(k_points.a_fracs[k_grid_ix]), std::lround(k_points.b_fracs[k_grid_ix]));
+
+            switch (std::get<1>(bit))
+            {
+            case Analytiker::FormulaBitBasis::RECOS:
+                real_coeffs[k_ix].first += value;
+                break;
+            case Analytiker::FormulaBitBasis::RESIN:
+                real_coeffs[k_ix].second += value;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    for (const auto& [k_ix, coeffs] : real_coeffs)
+    {
+        m_max_a_ix = std::max(m_max_a_ix, std::abs(k_ix.first));
+        m_max_b_ix = std::max(m_max_b_ix, std::abs(k_ix.second));
+    }
+
+    for (const auto& [k_ix, coeffs] : real_coeffs)
+    {
+        Eigen::Vector2d k_cart = k_ix.first * m_a_recip + k_ix.second * m_b_recip;
+
+        m_a_ix.push_back(k_ix.first + m_max_a_ix);
+        m_b_ix.push_back(k_ix.second + m_max_b_ix);
+        m_kx.push_back(k_cart(0));
+        m_ky.push_back(k_cart(1));
+        m_cos_coeffs.push_back(coeffs.first);
+        m_sin_coeffs.push_back(coeffs.second);
+    }
+}
+
+SurfaceEvaluator::SurfaceEvaluator(const Interpolator& ipolator, double crush_value)
+    : SurfaceEvaluator(Analytiker(ipolator), crush_value)
+{
+}
+
+void SurfaceEvaluator::_phase_powers(std::complex<double> phase, int max_power, std::vector<std::complex<double>>* powers_ptr)
+{
+    auto& powers = *powers_ptr;
+    powers.resize(2 * max_power + 1);
+
+    powers[max_power] = 1.0;
+    for (int n = 1; n <= max_power; ++n)
+    {
+        powers[max_power + n] = powers[max_power + n - 1] * phase;
+        powers[max_power - n] = std::conj(powers[max_power + n]);
+    }
+    return;
+}
+
+template <SurfaceEvaluator::Order order>
+void SurfaceEvaluator::_accumulate(const std::complex<double>* a_powers,
+                                   const std::complex<double>* b_powers,
+                                   double* value,
+                                   Eigen::Vector2d* gradient,
+                                   Eigen::Vector3d* hessian) const
+{
+    double v = 0.0;
+    double gx = 0.0, gy = 0.0;
+    double hxx = 0.0, hxy = 0.0, hyy = 0.0;
+
+    const int num_waves = this->size();
+    for (int t = 0; t < num_waves; ++t)
+    {
+        // exp(ik.r)=cos(k.r)+i*sin(k.r)
+        std::complex<double> wave = a_powers[m_a_ix[t]] * b_powers[m_b_ix[t]];
+
+        // C*cos(k.r)+S*sin(k.r)
+        double u = m_cos_coeffs[t] * wave.real() + m_sin_coeffs[t] * wave.imag();
+        v += u;
+
+        if constexpr (order != Order::VALUE)
+        {
+            // Gradient is (S*cos(k.r)-C*sin(k.r))*k
+            double w = m_sin_coeffs[t] * wave.real() - m_cos_coeffs[t] * wave.imag();
+            gx += w * m_kx[t];
+            gy += w * m_ky[t];
+        }
+
+        if constexpr (order == Order::HESSIAN)
+        {
+            // Hessian is -(C*cos(k.r)+S*sin(k.r))*k*k^T
+            hxx -= u * m_kx[t] * m_kx[t];
+            hxy -= u * m_kx[t] * m_ky[t];
+            hyy -= u * m_ky[t] * m_ky[t];
+        }
+    }
+
+    *value = v;
+    *gradient << gx, gy;
+    *hessian << hxx, hxy, hyy;
+    return;
+}
+
+void SurfaceEvaluator::_evaluate_point(const Eigen::Vector2d& point,
+                                       Order order,
+                                       std::vector<std::complex<double>>* a_powers,
+                                       std::vector<std::complex<double>>* b_powers,
+                                       double* value,
+                                       Eigen::Vector2d* gradient,
+                                       Eigen::Vector3d* hessian) const
+{
+    _phase_powers(std::polar(1.0, m_a_recip.dot(point)), m_max_a_ix, a_powers);
+    _phase_powers(std::polar(1.0, m_b_recip.dot(point)), m_max_b_ix, b_powers);
+
+    switch (order)
+    {
+    case Order::VALUE:
+        this->_accumulate<Order::VALUE>(a_powers->data(), b_powers->data(), value, gradient, hessian);
+        break;
+    case Order::GRADIENT:
+        this->_accumulate<Order::GRADIENT>(a_powers->data(), b_powers->data(), value, gradient, hessian);
+        break;
+    case Order::HESSIAN:
+        this->_accumulate<Order::HESSIAN>(a_powers->data(), b_powers->data(), value, gradient, hessian);
+        break;
+    }
+    return;
+}
+
+SurfaceEvaluator::Batch SurfaceEvaluator::evaluate(const Eigen::Matrix2Xd& points, Order order) const
+{
+    int num_points = points.cols();
+
+    Batch batch;
+    batch.values.resize(num_points);
+    if (order != Order::VALUE)
+    {
+        batch.gradients.resize(2, num_points);
+    }
+    if (order == Order::HESSIAN)
+    {
+        batch.hessians.resize(3, num_points);
+    }
+
+    std::vector<std::complex<double>> a_powers, b_powers;
+    double value;
+    Eigen::Vector2d gradient;
+    Eigen::Vector3d hessian;
+    for (int i = 0; i < num_points; ++i)
+    {
+        this->_evaluate_point(points.col(i), order, &a_powers, &b_powers, &value, &gradient, &hessian);
+
+        batch.values(i) = value;
+        if (order != Order::VALUE)
+        {
+            batch.gradients.col(i) = gradient;
+        }
+        if (order == Order::HESSIAN)
+        {
+            batch.hessians.col(i) = hessian;
+        }
+    }
+
+    return batch;
+}
+
+double SurfaceEvaluator::value(const Eigen::Vector2d& point) const
+{
+    std::vector<std::complex<double>> a_powers, b_powers;
+    double value;
+    Eigen::Vector2d gradient;
+    Eigen::Vector3d hessian;
+    this->_evaluate_point(point, Order::VALUE, &a_powers, &b_powers, &value, &gradient, &hessian);
+    return value;
+}
+
+double spectral_radius(const Eigen::Vector3d& hessian)
+{
+    double mean = 0.5 * (hessian(0) + hessian(2));
+    double spread = std::sqrt(0.25 * (hessian(0) - hessian(2)) * (hessian(0) - hessian(2)) + hessian(1) * hessian(1));
+    return std::abs(mean) + spread;
+}
+} // namespace mush
@@ -0,0 +1,113 @@
+#ifndef EVALUATOR_HH
+#define EVALUATOR_HH
+
+#include "./definitions.hpp"
+#include "./fourier.hpp"
+#include <complex>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Evaluates the real part of a surface that was fitted with the Interpolator,
+ * along with its gradient and Hessian, without going through the formula string
+ * of the Analytiker.
+ *
+ * The surviving basis functions are stored as contiguous arrays of coefficients
+ * and k-vectors. Every k-vector is an integer combination (p,q) of the in-plane
+ * reciprocal vectors, so exp(ik.r) is a product of powers of exp(iA.r) and exp(iB.r).
+ * For each point, only those two phases get evaluated with trigonometric functions,
+ * and every other phase is built up by repeatedly rotating them.
+ *
+ * Points are Cartesian coordinates on the same aligned ab-plane that the
+ * Analytiker prints its formulas for.
+ */
+
+class SurfaceEvaluator
+{
+public:
+    /// How many derivatives to calculate when evaluating a batch of points
+    enum class Order
+    {
+        VALUE,
+        GRADIENT,
+        HESSIAN
+    };
+
+    /// Results of evaluating a batch of points. Column i corresponds to point i.
+    /// The Hessian columns hold the xx, xy and yy components.
+    /// Entries beyond the requested order are left empty.
+    struct Batch
+    {
+        Eigen::VectorXd values;
+        Eigen::Matrix2Xd gradients;
+        Eigen::Matrix3Xd hessians;
+    };
+
+    /// Keeps the real basis functions of the formula whose coefficients are larger than the crush value
+    SurfaceEvaluator(const Analytiker& analyzer, double crush_value = 0.0);
+
+    /// Creates the Analytiker formula of the interpolator and keeps the real basis functions
+    SurfaceEvaluator(const Interpolator& ipolator, double crush_value = 0.0);
+
+    /// Evaluate every point (one per column) in a single call
+    Batch evaluate(const Eigen::Matrix2Xd& points, Order order = Order::HESSIAN) const;
+
+    /// Value of the surface at a single point
+    double value(const Eigen::Vector2d& point) const;
+
+    /// Number of plane waves (k-points) that make up the surface
+    int size() const { return m_cos_coeffs.size(); }
+
+private:
+    /// In-plane components of the reciprocal vectors that the k-points are integer multiples of
+    Eigen::Vector2d m_a_recip;
+    Eigen::Vector2d m_b_recip;
+
+    /// Largest magnitude of the integer k-point coordinates, sets how many phase rotations are needed
+    int m_max_a_ix;
+    int m_max_b_ix;
+
+    /// Integer coordinates of each k-point, shifted to be non-negative, so they can
+    /// be used directly to index the tables of phase powers
+    std::vector<int> m_a_ix;
+    std::vector<int> m_b_ix;
+
+    /// Cartesian components of each k-point
+    std::vector<double> m_kx;
+    std::vector<double> m_ky;
+
+    /// Coefficients of cos(k.r) and sin(k.r) for each k-point
+    std::vector<double> m_cos_coeffs;
+    std::vector<double> m_sin_coeffs;
+
+    /// Fill the powers of the phase, from -max_power up to max_power, by repeated rotation.
+    /// The phase has unit magnitude, so negative powers are just complex conjugates.
+    static void _phase_powers(std::complex<double> phase, int max_power, std::vector<std::complex<double>>* powers);
+
+    /// Sum up every basis function (and derivatives up to the requested order) at a single point.
+    /// The tables of phase powers are scratch space, passed in to avoid reallocating them at every point.
+    void _evaluate_point(const Eigen::Vector2d& point,
+                         Order order,
+                         std::vector<std::complex<double>>* a_powers,
+                         std::vector<std::complex<double>>* b_powers,
+                         double* value,
+                         Eigen::Vector2d* gradient,
+                         Eigen::Vector3d* hessian) const;
+
+    /// The loop over every plane wave, once the phase powers for a point are known.
+    /// Templated on the order so that the innermost loop has no branches.
+    template <Order order>
+    void _accumulate(const std::complex<double>* a_powers,
+                     const std::complex<double>* b_powers,
+                     double* value,
+                     Eigen::Vector2d* gradient,
+                     Eigen::Vector3d* hessian) const;
+};
+
+/// Largest magnitude of the eigenvalues of a Hessian, given as the xx, xy and yy components
+/// like the columns of SurfaceEvaluator::Batch
+double spectral_radius(const Eigen::Vector3d& hessian);
+} // namespace mush
+
+#endif
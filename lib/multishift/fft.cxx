@@ -0,0 +1,175 @@
+#include "./fft.hpp"
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+/// Prime factors of n, smallest first
+std::vector<int> prime_factors(int n)
+{
+    std::vector<int> factors;
+    for (int p = 2; p * p <= n; ++p)
+    {
+        while (n % p == 0)
+        {
+            factors.push_back(p);
+            n /= p;
+        }
+    }
+
+    if (n > 1)
+    {
+        factors.push_back(n);
+    }
+
+    return factors;
+}
+} // namespace
+
+namespace mush
+{
+FFTPlan::FFTPlan(int length) : m_length(length), m_factors(::prime_factors(length))
+{
+    if (length < 1)
+    {
+        throw std::runtime_error("Cannot make a Fourier transform plan for a sequence of length " + std::to_string(length) + ".");
+    }
+
+    m_twiddles.reserve(m_length);
+    for (int n = 0; n < m_length; ++n)
+    {
+        double phase = -2.0 * M_PI * static_cast<double>(n) / m_length;
+        m_twiddles.emplace_back(std::cos(phase), std::sin(phase));
+    }
+}
+
+FFTPlan::complex FFTPlan::_twiddle(int n, bool inverse) const
+{
+    const auto& tw = m_twiddles[n % m_length];
+    return inverse ? std::conj(tw) : tw;
+}
+
+void FFTPlan::forward(complex* data, int stride) const
+{
+    this->_transform(data, stride, false);
+    return;
+}
+
+void FFTPlan::inverse(complex* data, int stride) const
+{
+    this->_transform(data, stride, true);
+    return;
+}
+
+void FFTPlan::_transform(complex* data, int stride, bool inverse) const
+{
+    if (m_length == 1)
+    {
+        return;
+    }
+
+    std::vector<complex> out(m_length);
+    this->_work(out.data(), data, 1, stride, 0, inverse);
+
+    for (int i = 0; i < m_length; ++i)
+    {
+        data[i * stride] = out[i];
+    }
+    return;
+}
+
+void FFTPlan::_work(complex* out, const complex* in, int fstride, int in_stride, int factor_ix, bool inverse) const
+{
+    int p = m_factors[factor_ix];
+    int m = m_length / (fstride * p);
+
+    if (m == 1)
+    {
+        for (int j = 0; j < p; ++j)
+        {
+            out[j] = in[j * fstride * in_stride];
+        }
+    }
+
+    else
+    {
+        // Each of the p interleaved sub-sequences gets transformed first, and
+        // their results are stored next to each other in out
+        for (int j = 0; j < p; ++j)
+        {
+            this->_work(out + j * m, in + j * fstride * in_stride, fstride * p, in_stride, factor_ix + 1, inverse);
+        }
+    }
+
+    this->_butterfly(out, fstride, p, m, inverse);
+    return;
+}
+
+void FFTPlan::_butterfly(complex* out, int fstride, int p, int m, bool inverse) const
+{
+    if (p == 2)
+    {
+        for (int u = 0; u < m; ++u)
+        {
+            complex t = out[u + m] * this->_twiddle(u * fstride, inverse);
+            out[u + m] = out[u] - t;
+            out[u] += t;
+        }
+        return;
+    }
+
+    // Generic radix, each output needs all p inputs of its group
+    std::vector<complex> scratch(p);
+    for (int u = 0; u < m; ++u)
+    {
+        for (int q = 0; q < p; ++q)
+        {
+            scratch[q] = out[u + q * m];
+        }
+
+        for (int q = 0; q < p; ++q)
+        {
+            int k = u + q * m;
+            complex sum = scratch[0];
+            for (int r = 1; r < p; ++r)
+            {
+                // Reduce the exponent early so it doesn't overflow for long sequences
+                long exponent = (static_cast<long>(r) * k * fstride) % m_length;
+                sum += scratch[r] * this->_twiddle(exponent, inverse);
+            }
+            out[k] = sum;
+        }
+    }
+    return;
+}
+
+//*********************************************************************************//
+
+void fft_2d(std::complex<double>* grid, const FFTPlan& row_plan, const FFTPlan& col_plan, bool inverse)
+{
+    int rows = col_plan.size();
+    int cols = row_plan.size();
+
+    for (int r = 0; r < rows; ++r)
+    {
+        inverse ? row_plan.inverse(grid + r * cols) : row_plan.forward(grid + r * cols);
+    }
+
+    for (int c = 0; c < cols; ++c)
+    {
+        inverse ? col_plan.inverse(grid + c, cols) : col_plan.forward(grid + c, cols);
+    }
+    return;
+}
+
+void fft_2d(std::vector<std::complex<double>>* grid, int rows, int cols, bool inverse)
+{
+    assert(grid->size() == static_cast<std::size_t>(rows) * cols);
+    FFTPlan row_plan(cols);
+    FFTPlan col_plan(rows);
+    fft_2d(grid->data(), row_plan, col_plan, inverse);
+    return;
+}
+} // namespace mush
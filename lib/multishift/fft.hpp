@@ -0,0 +1,78 @@
+#ifndef FFT_HH
+#define FFT_HH
+
+#include <complex>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Precomputed factorization and twiddle factors to take the discrete
+ * Fourier transform of a sequence with a fixed length.
+ *
+ * Any length is allowed. The length gets factored into primes, and the
+ * transform is broken down into one mixed radix stage per factor, so
+ * the cost is O(N*sum(factors)) instead of O(N^2). Lengths with large
+ * prime factors still work, they're just not as fast.
+ *
+ * The forward transform is X_k = sum_n x_n exp(-2*pi*i*k*n/N).
+ * The inverse transform flips the sign of the exponent, and is
+ * NOT normalized by 1/N.
+ */
+
+class FFTPlan
+{
+public:
+    typedef std::complex<double> complex;
+
+    FFTPlan(int length);
+
+    /// Length of the sequences that can be transformed with *this
+    int size() const { return m_length; }
+
+    /// Transform the values in place. The values don't have to be contiguous, the
+    /// i-th entry of the sequence is expected at data[i*stride]
+    void forward(complex* data, int stride = 1) const;
+
+    /// Same as forward, but with the opposite sign in the exponent. No normalization is applied.
+    void inverse(complex* data, int stride = 1) const;
+
+private:
+    int m_length;
+
+    /// Radix of each stage, in the order in which they get applied
+    std::vector<int> m_factors;
+
+    /// exp(-2*pi*i*n/N) for every n<N
+    std::vector<complex> m_twiddles;
+
+    /// Take the transform of data into the scratch space, then copy the result back.
+    /// Inverse transforms are taken by conjugating the twiddle factors.
+    void _transform(complex* data, int stride, bool inverse) const;
+
+    /// Recursive decimation in time. Writes the transform of the sequence starting at
+    /// in (separated by in_stride) into out.
+    void _work(complex* out, const complex* in, int fstride, int in_stride, int factor_ix, bool inverse) const;
+
+    /// Combine the p sub-transforms of length m sitting in out into a single transform of length p*m
+    void _butterfly(complex* out, int fstride, int p, int m, bool inverse) const;
+
+    /// Twiddle factor exp(-/+2*pi*i*n/N), conjugated for the inverse transform
+    complex _twiddle(int n, bool inverse) const;
+};
+
+/**
+ * Take the discrete Fourier transform of a 2d grid of values stored in row-major
+ * order, i.e. the value at (r,c) lives at grid[r*cols+c]. The transform is separable,
+ * so every row gets transformed, followed by every column.
+ * Inverse transforms are not normalized.
+ */
+
+void fft_2d(std::vector<std::complex<double>>* grid, int rows, int cols, bool inverse = false);
+
+/// Same as fft_2d, but with plans that were already constructed for each direction. Use this if you're
+/// going to transform many grids of the same dimensions.
+void fft_2d(std::complex<double>* grid, const FFTPlan& row_plan, const FFTPlan& col_plan, bool inverse = false);
+} // namespace mush
+
+#endif
@@ -1,8 +1,13 @@
 #include "./fourier.hpp"
+#include "./fft.hpp"
 #include <casmutils/mush/twist.hpp>
 #include <casmutils/mush/slab.hpp>
 #include "casmutils/xtal/site.hpp"
 #include <casmutils/xtal/coordinate.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
 #include <stdexcept>
 #include <unordered_set>
 #include <utility>
@@ -27,6 +32,36 @@ std::pair<int, int> num_unique(const std::vector<mush::InterPoint>& unrolled_dat
     }
     return std::make_pair(unique_a.size(), unique_b.size());
 }
+
+/// Index of the fraction along a periodic grid with the given number of divisions.
+/// Fractions at the periodic boundary (1.0) map back to the origin.
+int periodic_grid_index(double frac, int divisions)
+{
+    double scaled = frac * divisions;
+    long ix = std::lround(scaled);
+    if (!almost_equal(scaled, static_cast<double>(ix), 1e-6))
+    {
+        throw std::runtime_error("Data does not fall on a uniform grid, the FFT can't be used to interpolate it.");
+    }
+
+    return mush::wrap_index(ix, divisions);
+}
+
+/// Grid with fractional coordinates a/a_dim and b/b_dim at each point, with all values set to zero
+mush::InterGrid make_uniform_grid(int a_dim, int b_dim)
+{
+    mush::InterGrid grid(a_dim, b_dim);
+    for (int a = 0; a < a_dim; ++a)
+    {
+        for (int b = 0; b < b_dim; ++b)
+        {
+            int ix = grid.index(a, b);
+            grid.a_fracs[ix] = static_cast<double>(a) / a_dim;
+            grid.b_fracs[ix] = static_cast<double>(b) / b_dim;
+        }
+    }
+    return grid;
+}
 } // namespace
 namespace mush
 {
@@ -49,8 +84,33 @@ bool InterPoint::operator<(const InterPoint& rhs) const
 
 //*********************************************************************************//
 
-Interpolator::Interpolator(const Lattice& init_lat, const std::vector<InterPoint>& real_data)
-    : Interpolator(init_lat, _grid_from_unrolled_data(real_data))
+InterGrid::InterGrid(int a_dim, int b_dim)
+    : a_fracs(a_dim * b_dim, 0.0),
+      b_fracs(a_dim * b_dim, 0.0),
+      values(a_dim * b_dim, 0.0),
+      weights(a_dim * b_dim, 1.0),
+      m_a_dim(a_dim),
+      m_b_dim(b_dim)
+{
+}
+
+InterPoint InterGrid::point(int ix) const
+{
+    InterPoint ipoint(a_fracs[ix], b_fracs[ix], values[ix]);
+    ipoint.weight = weights[ix];
+    return ipoint;
+}
+
+Eigen::Vector3d InterGrid::cart(int ix, const cu::xtal::Lattice& ref_lat) const
+{
+    Eigen::Vector3d vec = a_fracs[ix] * ref_lat.a() + b_fracs[ix] * ref_lat.b() + 0.0 * ref_lat.c();
+    return vec;
+}
+
+//*********************************************************************************//
+
+Interpolator::Interpolator(const Lattice& init_lat, const std::vector<InterPoint>& real_data, TransformMethod method)
+    : Interpolator(init_lat, _grid_from_unrolled_data(real_data), method)
 {
 }
 
@@ -60,68 +120,296 @@ Interpolator::Lattice make_phony_aligned_lattice(const Interpolator::Lattice& re
     return Interpolator::Lattice(real_aligned.a(),real_aligned.b(),Eigen::Vector3d(0,0,1));
 }
 
-Interpolator::Interpolator(const Lattice& init_lat, const InterGrid& init_values)
+Interpolator::Interpolator(const Lattice& init_lat, const InterGrid& init_values, TransformMethod method)
     : m_real_lat(make_phony_aligned_lattice(init_lat)),
       m_recip_lat(cu::xtal::make_reciprocal(this->m_real_lat)),
       m_real_ipoints(init_values),
-      /* m_real_ipoints(this->_r_weigner_seitz(init_values,this->m_real_lat)), */
-      m_k_values(this->_k_grid(this->m_real_ipoints, this->m_recip_lat))
+      m_k_values(this->_k_grid(this->m_real_ipoints))
 {
-    this->_take_fourier_transform();
+    this->_take_fourier_transform(method);
 }
 
-void Interpolator::_take_fourier_transform()
+Interpolator::Interpolator(const Lattice& aligned_lat, const Lattice& recip_lat, InterGrid&& init_values, const InterGrid& init_k_values)
+    : m_real_lat(aligned_lat), m_recip_lat(recip_lat), m_real_ipoints(std::move(init_values)), m_k_values(init_k_values)
 {
-    std::complex<double> im(0, 1);
-    double weight_sum=0.0;
-    for (const auto& r_row : m_real_ipoints)
+}
+
+std::vector<Interpolator> Interpolator::fit_batch(const Lattice& init_lat, const std::vector<std::vector<InterPoint>>& real_data_sets)
+{
+    std::vector<Interpolator> batch;
+    if (real_data_sets.empty())
     {
-        for (const auto& r_val : r_row)
-        {
-            weight_sum+=r_val.weight;
-        }
+        return batch;
     }
-    std::complex<double> normalization = 1.0 / weight_sum;
 
-    auto real_vals = _unrolled_values(m_real_ipoints);
-    auto k_vals = _unrolled_values(&m_k_values);
+    // Lay out a grid where the value of each slot is the index of the data point that goes there.
+    // Every data set can then be copied into the grid without sorting it again.
+    const auto& first_set = real_data_sets.front();
+    std::vector<InterPoint> index_points;
+    index_points.reserve(first_set.size());
+    for (int i = 0; i < first_set.size(); ++i)
+    {
+        index_points.emplace_back(first_set[i].a_frac, first_set[i].b_frac, static_cast<double>(i));
+    }
+    InterGrid layout = _grid_from_unrolled_data(index_points);
 
-    assert(real_vals.size() == k_vals.size() && real_vals.size() == this->size());
+    Lattice real_lat = make_phony_aligned_lattice(init_lat);
+    Lattice recip_lat = cu::xtal::make_reciprocal(real_lat);
+    InterGrid k_values = _k_grid(layout);
 
-    for (auto& k_row : m_k_values)
+    auto [periodic_adim, periodic_bdim] = _periodic_dims(layout);
+    FFTPlan row_plan(periodic_bdim);
+    FFTPlan col_plan(periodic_adim);
+
+    batch.reserve(real_data_sets.size());
+    for (const auto& real_data : real_data_sets)
     {
-        for (auto& k_val : k_row)
+        if (real_data.size() != first_set.size())
         {
-            k_val.value = 0.0;
-            Eigen::Vector3d k_vec = k_val.cart(this->m_recip_lat);
+            throw std::runtime_error("Every data set fitted in a batch must have the same number of points.");
+        }
 
-            for (const auto& r_row : m_real_ipoints)
+        // Map the points of this set back to the order of the first one
+        std::vector<int> first_set_order(real_data.size());
+        std::iota(first_set_order.begin(), first_set_order.end(), 0);
+        bool same_order = true;
+        for (int i = 0; i < real_data.size() && same_order; ++i)
+        {
+            same_order = ::almost_equal(real_data[i].a_frac, first_set[i].a_frac) && ::almost_equal(real_data[i].b_frac, first_set[i].b_frac);
+        }
+
+        if (!same_order)
+        {
+            std::vector<int> set_sorting(real_data.size());
+            std::iota(set_sorting.begin(), set_sorting.end(), 0);
+            std::sort(set_sorting.begin(), set_sorting.end(), [&](int lhs, int rhs) { return real_data[lhs] < real_data[rhs]; });
+
+            std::vector<int> first_sorting(first_set.size());
+            std::iota(first_sorting.begin(), first_sorting.end(), 0);
+            std::sort(first_sorting.begin(), first_sorting.end(), [&](int lhs, int rhs) { return first_set[lhs] < first_set[rhs]; });
+
+            for (int i = 0; i < real_data.size(); ++i)
             {
-                for (const auto& r_val : r_row)
+                const auto& point = real_data[set_sorting[i]];
+                const auto& reference = first_set[first_sorting[i]];
+                if (!::almost_equal(point.a_frac, reference.a_frac, 1e-8) || !::almost_equal(point.b_frac, reference.b_frac, 1e-8))
                 {
-                    Eigen::Vector3d r_vec = r_val.cart(this->m_real_lat);
-                    k_val.value += normalization * r_val.value * r_val.weight * std::exp(-im * k_vec.dot(r_vec));
+                    throw std::runtime_error("Every data set fitted in a batch must be sampled at the same grid points.");
                 }
+                first_set_order[first_sorting[i]] = set_sorting[i];
             }
         }
+
+        InterGrid real_values = layout;
+        for (int slot = 0; slot < layout.size(); ++slot)
+        {
+            int first_set_ix = std::lround(layout.values[slot].real());
+            real_values.values[slot] = real_data[first_set_order[first_set_ix]].value;
+        }
+
+        batch.emplace_back(Interpolator(real_lat, recip_lat, std::move(real_values), k_values));
+        batch.back()._take_fourier_transform_fft(row_plan, col_plan);
     }
 
+    return batch;
+}
+
+Interpolator Interpolator::fit_least_squares(const Lattice& init_lat, const std::vector<InterPoint>& real_data, double regularization)
+{
+    if (regularization < 0.0)
+    {
+        throw std::runtime_error("The regularization of a least squares fit can't be negative.");
+    }
+
+    Lattice real_lat = make_phony_aligned_lattice(init_lat);
+    Lattice recip_lat = cu::xtal::make_reciprocal(real_lat);
+    InterGrid real_values = _grid_from_unrolled_data(real_data);
+    InterGrid k_values = _k_grid(real_values);
+
+    Interpolator ipolator(real_lat, recip_lat, std::move(real_values), k_values);
+    ipolator._take_least_squares_fit(regularization);
+    return ipolator;
+}
+
+void Interpolator::_take_fourier_transform(TransformMethod method)
+{
+    switch (method)
+    {
+    case TransformMethod::FFT:
+        this->_take_fourier_transform_fft();
+        break;
+    case TransformMethod::DIRECT:
+        this->_take_fourier_transform_direct();
+        break;
+    }
     return;
 }
 
-std::pair<int, int> Interpolator::dims() const
+std::pair<int, int> Interpolator::_periodic_dims(const InterGrid& real_values)
+{
+    auto [adim, bdim] = real_values.dims();
+
+    // Grids with even dimensions got an extra row (column) at the periodic boundary
+    // to make them odd. The FFT has to run over the original periodic grid.
+    int periodic_adim = ::almost_equal(real_values.a_fracs[real_values.index(adim - 1, 0)], 1.0) ? adim - 1 : adim;
+    int periodic_bdim = ::almost_equal(real_values.b_fracs[real_values.index(0, bdim - 1)], 1.0) ? bdim - 1 : bdim;
+    return std::make_pair(periodic_adim, periodic_bdim);
+}
+
+void Interpolator::_take_fourier_transform_fft()
 {
-    for (const auto& k_row : m_k_values)
+    auto [periodic_adim, periodic_bdim] = _periodic_dims(m_real_ipoints);
+    this->_take_fourier_transform_fft(FFTPlan(periodic_bdim), FFTPlan(periodic_adim));
+    return;
+}
+
+void Interpolator::_take_fourier_transform_fft(const FFTPlan& row_plan, const FFTPlan& col_plan)
+{
+    const auto& r_grid = m_real_ipoints;
+    int periodic_adim = col_plan.size();
+    int periodic_bdim = row_plan.size();
+
+    // Fold every real point onto its periodic image. Repeated boundary values had
+    // their weights split, so adding them back together recovers the original weight.
+    std::vector<std::complex<double>> periodic_values(periodic_adim * periodic_bdim, 0.0);
+    double weight_sum = 0.0;
+    for (int ix = 0; ix < r_grid.size(); ++ix)
     {
-        assert(k_row.size() == m_k_values[0].size());
+        int a = ::periodic_grid_index(r_grid.a_fracs[ix], periodic_adim);
+        int b = ::periodic_grid_index(r_grid.b_fracs[ix], periodic_bdim);
+        periodic_values[a * periodic_bdim + b] += r_grid.values[ix] * r_grid.weights[ix];
+        weight_sum += r_grid.weights[ix];
     }
 
-    // TODO: Probaby overkill but you can also assert that the real
-    // values have the right dimensions too
+    fft_2d(periodic_values.data(), row_plan, col_plan);
 
-    assert(m_k_values.size() == m_real_ipoints.size());
+    // The k-points are integer multiples of the reciprocal vectors, so exp(-ik.r) only
+    // depends on the k-point index modulo the periodic grid dimensions
+    for (int ix = 0; ix < m_k_values.size(); ++ix)
+    {
+        int ka = wrap_index(std::lround(m_k_values.a_fracs[ix]), periodic_adim);
+        int kb = wrap_index(std::lround(m_k_values.b_fracs[ix]), periodic_bdim);
+        m_k_values.values[ix] = periodic_values[ka * periodic_bdim + kb] / weight_sum;
+    }
 
-    return std::make_pair(m_k_values.size(), m_k_values[0].size());
+    return;
+}
+
+void Interpolator::_take_fourier_transform_direct()
+{
+    std::complex<double> im(0, 1);
+    const auto& r_grid = m_real_ipoints;
+
+    double weight_sum = 0.0;
+    for (double w : r_grid.weights)
+    {
+        weight_sum += w;
+    }
+    std::complex<double> normalization = 1.0 / weight_sum;
+
+    assert(r_grid.size() == m_k_values.size() && r_grid.size() == this->size());
+
+    std::vector<Eigen::Vector3d> r_vecs;
+    for (int r_ix = 0; r_ix < r_grid.size(); ++r_ix)
+    {
+        r_vecs.emplace_back(r_grid.cart(r_ix, this->m_real_lat));
+    }
+
+    for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
+    {
+        auto& k_val = m_k_values.values[k_ix];
+        k_val = 0.0;
+        Eigen::Vector3d k_vec = m_k_values.cart(k_ix, this->m_recip_lat);
+
+        for (int r_ix = 0; r_ix < r_grid.size(); ++r_ix)
+        {
+            k_val += normalization * r_grid.values[r_ix] * r_grid.weights[r_ix] * std::exp(-im * k_vec.dot(r_vecs[r_ix]));
+        }
+    }
+
+    return;
+}
+
+void Interpolator::_take_least_squares_fit(double regularization)
+{
+    std::complex<double> im(0, 1);
+    const auto& r_grid = m_real_ipoints;
+
+    std::vector<int> fitted_ixs;
+    for (int r_ix = 0; r_ix < r_grid.size(); ++r_ix)
+    {
+        if (r_grid.weights[r_ix] > 0.0)
+        {
+            fitted_ixs.push_back(r_ix);
+        }
+    }
+
+    if (fitted_ixs.empty())
+    {
+        throw std::runtime_error("None of the points have any weight, there is nothing to fit.");
+    }
+
+    std::vector<Eigen::Vector3d> k_vecs;
+    for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
+    {
+        k_vecs.emplace_back(m_k_values.cart(k_ix, m_recip_lat));
+    }
+
+    // Every row is scaled by the square root of its weight, so the plain least squares
+    // solution of the scaled system is the weighted one
+    Eigen::MatrixXcd design(fitted_ixs.size(), m_k_values.size());
+    Eigen::VectorXcd targets(fitted_ixs.size());
+    for (int row = 0; row < fitted_ixs.size(); ++row)
+    {
+        int r_ix = fitted_ixs[row];
+        double root_weight = std::sqrt(r_grid.weights[r_ix]);
+        Eigen::Vector3d r_vec = r_grid.cart(r_ix, m_real_lat);
+
+        targets(row) = root_weight * r_grid.values[r_ix];
+        for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
+        {
+            design(row, k_ix) = root_weight * std::exp(im * r_vec.dot(k_vecs[k_ix]));
+        }
+    }
+
+    Eigen::VectorXcd coefficients;
+    if (regularization > 0.0)
+    {
+        Eigen::MatrixXcd normal = design.adjoint() * design;
+        normal.diagonal().array() += regularization;
+        coefficients = normal.llt().solve(design.adjoint() * targets);
+    }
+    else
+    {
+        coefficients = design.completeOrthogonalDecomposition().solve(targets);
+    }
+
+    // The k-points at the edges of an even grid alias each other, so only their sum is fitted, split
+    // evenly between them. Like the transform, give each of them the whole sum, which the weights of
+    // the k-grid split back up.
+    auto [periodic_adim, periodic_bdim] = _periodic_dims(r_grid);
+    std::map<std::pair<long, long>, std::complex<double>> aliased_sums;
+    for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
+    {
+        auto periodic_k = std::make_pair(wrap_index(std::lround(m_k_values.a_fracs[k_ix]), periodic_adim),
+                                         wrap_index(std::lround(m_k_values.b_fracs[k_ix]), periodic_bdim));
+        aliased_sums[periodic_k] += coefficients(k_ix);
+    }
+
+    for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
+    {
+        auto periodic_k = std::make_pair(wrap_index(std::lround(m_k_values.a_fracs[k_ix]), periodic_adim),
+                                         wrap_index(std::lround(m_k_values.b_fracs[k_ix]), periodic_bdim));
+        m_k_values.values[k_ix] = aliased_sums.at(periodic_k);
+    }
+
+    return;
+}
+
+std::pair<int, int> Interpolator::dims() const
+{
+    assert(m_k_values.dims() == m_real_ipoints.dims());
+    return m_k_values.dims();
 }
 
 
@@ -189,150 +477,304 @@ Interpolator::InterGrid Interpolator::_direct_reshape(const std::vector<mush::In
         throw std::runtime_error("Cannot reshape vector to the specified grid.");
     }
 
-    int i = 0;
-    InterGrid final_grid;
-    for (int ka = 0; ka < ka_dim; ++ka)
+    InterGrid final_grid(ka_dim, kb_dim);
+    for (int i = 0; i < unrolled_data.size(); ++i)
     {
-        InterGrid::value_type kb_row;
-        for (int kb = 0; kb < kb_dim; ++kb, ++i)
-        {
-            kb_row.push_back(unrolled_data[i]);
-        }
-        final_grid.emplace_back(std::move(kb_row));
+        final_grid.a_fracs[i] = unrolled_data[i].a_frac;
+        final_grid.b_fracs[i] = unrolled_data[i].b_frac;
+        final_grid.values[i] = unrolled_data[i].value;
+        final_grid.weights[i] = unrolled_data[i].weight;
     }
 
     return final_grid;
 }
 
-std::vector<InterPoint*> Interpolator::_unrolled_values(InterGrid* grid_values_ptr)
+Interpolator::InterGrid Interpolator::_k_grid(const InterGrid& init_values)
 {
-    std::vector<InterPoint*> unrolled_values;
-    auto& grid_values = *grid_values_ptr;
-    for (auto& row : grid_values)
+    auto [num_as, num_bs] = init_values.dims();
+
+    // Yes, you want integers. Anything that doesn't fall on the reciprical lattice points is
+    // gonna mess your interpolation up.
+    // At this point grids are always odd, because when you made the grid from the data, you
+    // enforced periodicity by "repeating" the values at the edges.
+    assert(num_as % 2 == 1);
+    assert(num_bs % 2 == 1);
+    int ka_centrize = num_as / 2;
+    int kb_centrize = num_bs / 2;
+
+    // If the grid was even, the k-points at both edges are the same plane wave on the grid, and each
+    // gets half of its weight, so together they count once
+    auto [periodic_adim, periodic_bdim] = _periodic_dims(init_values);
+    bool a_aliased = periodic_adim != num_as;
+    bool b_aliased = periodic_bdim != num_bs;
+
+    InterGrid k_values(num_as, num_bs);
+    for (int a = 0; a < num_as; ++a)
     {
-        for (auto& val : row)
+        for (int b = 0; b < num_bs; ++b)
         {
-            unrolled_values.push_back(&val);
+            int ix = k_values.index(a, b);
+            k_values.a_fracs[ix] = a - ka_centrize;
+            k_values.b_fracs[ix] = b - kb_centrize;
+            if (a_aliased && (a == 0 || a == num_as - 1))
+            {
+                k_values.weights[ix] /= 2.0;
+            }
+            if (b_aliased && (b == 0 || b == num_bs - 1))
+            {
+                k_values.weights[ix] /= 2.0;
+            }
         }
     }
-    return unrolled_values;
+
+    return k_values;
+}
+
+std::pair<cu::xtal::Lattice, Interpolator::InterGrid> Interpolator::interpolate(int a_dim, int b_dim, TransformMethod method) const
+{
+    switch (method)
+    {
+    case TransformMethod::FFT:
+        return std::make_pair(m_real_lat, this->_interpolate_fft(a_dim, b_dim));
+    case TransformMethod::DIRECT:
+        return std::make_pair(m_real_lat, this->_interpolate_direct(a_dim, b_dim));
+    }
+
+    throw std::runtime_error("Unknown method for interpolating the Fourier coefficients.");
+}
+
+Interpolator::InterGrid Interpolator::_interpolate_fft(int a_dim, int b_dim) const
+{
+    InterGrid interpolated_values = ::make_uniform_grid(a_dim, b_dim);
+
+    // Every k-point lands on the bin of its index modulo the output grid. If the output is
+    // finer than the k-point grid this is plain zero-padding. If it's coarser, the k-points
+    // alias onto each other, which is exactly what the plane waves do on that grid anyway.
+    auto& spectrum = interpolated_values.values;
+    for (int ix = 0; ix < m_k_values.size(); ++ix)
+    {
+        int ka = wrap_index(std::lround(m_k_values.a_fracs[ix]), a_dim);
+        int kb = wrap_index(std::lround(m_k_values.b_fracs[ix]), b_dim);
+        spectrum[ka * b_dim + kb] += m_k_values.values[ix] * m_k_values.weights[ix];
+    }
+
+    // The values of the grid are already contiguous and row-major, transform them in place
+    fft_2d(&spectrum, a_dim, b_dim, true);
+    return interpolated_values;
 }
 
-std::vector<const InterPoint*> Interpolator::_unrolled_values(const InterGrid& grid_values)
+Interpolator::InterGrid Interpolator::_interpolate_direct(int a_dim, int b_dim) const
 {
-    // TODO: There's some clever way to avoid the code duplication with some template or const_cast magic, but
-    // I can't be bothered right now.
-    std::vector<const InterPoint*> unrolled_values;
-    for (auto& row : grid_values)
+    std::complex<double> im(0, 1);
+    InterGrid interpolated_values = ::make_uniform_grid(a_dim, b_dim);
+
+    std::vector<Eigen::Vector3d> k_vecs;
+    for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
     {
-        for (auto& val : row)
+        k_vecs.emplace_back(m_k_values.cart(k_ix, m_recip_lat));
+    }
+
+    for (int r_ix = 0; r_ix < interpolated_values.size(); ++r_ix)
+    {
+        auto r_vec = interpolated_values.cart(r_ix, this->m_real_lat);
+        auto& value = interpolated_values.values[r_ix];
+        for (int k_ix = 0; k_ix < m_k_values.size(); ++k_ix)
         {
-            unrolled_values.push_back(&val);
+            value += m_k_values.values[k_ix] * m_k_values.weights[k_ix] * std::exp(im * r_vec.dot(k_vecs[k_ix]));
         }
     }
-    return unrolled_values;
+
+    return interpolated_values;
 }
 
-Interpolator::InterGrid Interpolator::_k_grid(const InterGrid& init_values, const Lattice& reciprocal_lattice)
-{
-    InterGrid k_values;
+//********************************************************************************************
 
-    auto num_as = init_values.size();
-    auto num_bs = init_values[0].size();
+Analytiker::Analytiker(const Interpolator& init_ipolator)
+    : m_k_points(init_ipolator.k_values()),
+      m_formula_bits(this->_formula_bits(init_ipolator.k_values())),
+      m_recip_lat(init_ipolator.reciprocal_lattice())
+{
+}
 
-    // Yes, you want integers. Anything that doesn't fall on the reciprical lattice points is
-    // gonna mess your interpolation up.
-    // At this point grids are always even, because when you made the grid from the data, you
-    // enforced periodicity by "repeating" the values at the edges.
-    assert(num_as % 2 == 1);
-    assert(num_bs % 2 == 1);
-    int ka_centrize = num_as / 2;
-    int kb_centrize = num_bs / 2;
-    Eigen::Vector3d center_shift(ka_centrize,kb_centrize,0.0);
+Analytiker::Analytiker(const Interpolator& init_ipolator, const std::vector<Eigen::Matrix2i>& shift_group)
+    : m_k_points(init_ipolator.k_values()), m_recip_lat(init_ipolator.reciprocal_lattice())
+{
+    auto [periodic_adim, periodic_bdim] = init_ipolator.periodic_dims();
+    m_formula_bits = this->_star_formula_bits(m_k_points, this->_k_stars(m_k_points, shift_group, periodic_adim, periodic_bdim), &m_stars);
+}
 
-    for (int a = 0; a < init_values.size(); ++a)
+std::vector<int> Analytiker::star(int k_ix) const
+{
+    auto members = m_stars.find(k_ix);
+    if (members == m_stars.end())
     {
-        InterGrid::value_type kb_row;
-        double ka_frac = static_cast<double>(a) / num_as;
-        ka_frac = a;
+        return {k_ix};
+    }
+    return members->second;
+}
 
-        const auto& a_row = init_values[a];
-        if (a_row.size() != num_bs)
+std::vector<std::vector<int>>
+Analytiker::_k_stars(const InterGrid& k_values, const std::vector<Eigen::Matrix2i>& shift_group, int periodic_adim, int periodic_bdim)
+{
+    // Stars are the connected groups of k-points, found by joining each k-point with everything it maps to
+    std::vector<int> parents(k_values.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    auto find_root = [&parents](int ix) {
+        while (parents[ix] != ix)
         {
-            throw std::runtime_error("The grid of values to interpolate is not uniform.");
+            parents[ix] = parents[parents[ix]];
+            ix = parents[ix];
         }
+        return ix;
+    };
+    auto join = [&](int lhs, int rhs) { parents[find_root(lhs)] = find_root(rhs); };
+
+    // The k-points at the edges of the grid alias each other, and are the same coefficient
+    std::map<std::pair<long, long>, int> k_ixs;
+    std::map<std::pair<long, long>, int> periodic_k_ixs;
+    std::vector<bool> aliased(k_values.size(), false);
+    for (int ix = 0; ix < k_values.size(); ++ix)
+    {
+        long p = std::lround(k_values.a_fracs[ix]);
+        long q = std::lround(k_values.b_fracs[ix]);
+        k_ixs[std::make_pair(p, q)] = ix;
 
-        for (int b = 0; b < a_row.size(); ++b)
+        auto periodic_k_ix = periodic_k_ixs.emplace(std::make_pair(wrap_index(p, periodic_adim), wrap_index(q, periodic_bdim)), ix);
+        if (!periodic_k_ix.second)
         {
-            double kb_frac = static_cast<double>(b) / num_bs;
-            kb_frac = b;
-            Eigen::Vector3d k_coord(ka_frac,kb_frac,0.0);
-            k_coord -= center_shift;
-            /* k_coord.voronoi_within(); */
-
-            /* kb_row.emplace_back(std::move(k_coord)); */
-            kb_row.emplace_back(k_coord(0), k_coord(1), 0.0);
+            join(ix, periodic_k_ix.first->second);
+            aliased[ix] = true;
+            aliased[periodic_k_ix.first->second] = true;
         }
-        k_values.emplace_back(std::move(kb_row));
     }
 
-    assert(k_values.size()==init_values.size());
-    assert(k_values[0].size()==init_values[0].size());
+    for (const auto& op : shift_group)
+    {
+        // Operations that map the grid onto itself also map aliases onto aliases, so any periodic image of
+        // the mapped k-point is fine. Otherwise (e.g. rotations of a hexagonal cell on a non-square grid)
+        // the coefficients are only symmetric as long as nothing aliases, so only k-points away from the
+        // edges of the grid that map directly onto another one get joined.
+        bool maps_grid = (op(0, 1) * periodic_adim) % periodic_bdim == 0 && (op(1, 0) * periodic_bdim) % periodic_adim == 0;
+        for (int ix = 0; ix < k_values.size(); ++ix)
+        {
+            long p = std::lround(k_values.a_fracs[ix]);
+            long q = std::lround(k_values.b_fracs[ix]);
+            long mapped_p = op(0, 0) * p + op(1, 0) * q;
+            long mapped_q = op(0, 1) * p + op(1, 1) * q;
 
-    /* for(int i=0; i<k_values.size(); ++i) */
-    /* { */
-    /*     for(int j=0; j<k_values[i].size(); ++j) */
-    /*     { */
-    /*         std::cout<<init_values[i][j].weight<<"    "; */
-    /*         k_values[i][j].weight=init_values[i][j].weight; */
-    /*     } */
-    /*     std::cout<<"\n"; */
-    /* } */
+            if (maps_grid)
+            {
+                join(ix, periodic_k_ixs.at(std::make_pair(wrap_index(mapped_p, periodic_adim), wrap_index(mapped_q, periodic_bdim))));
+                continue;
+            }
 
-    return k_values;
+            auto mapped_ix = k_ixs.find(std::make_pair(mapped_p, mapped_q));
+            if (!aliased[ix] && mapped_ix != k_ixs.end() && !aliased[mapped_ix->second])
+            {
+                join(ix, mapped_ix->second);
+            }
+        }
+    }
+
+    // Stars are listed in order of their first k-point
+    std::vector<std::vector<int>> stars;
+    std::map<int, int> root_to_star;
+    for (int ix = 0; ix < k_values.size(); ++ix)
+    {
+        auto star = root_to_star.emplace(find_root(ix), stars.size());
+        if (star.second)
+        {
+            stars.emplace_back();
+        }
+        stars[star.first->second].push_back(ix);
+    }
+    return stars;
 }
 
-std::pair<cu::xtal::Lattice, Interpolator::InterGrid> Interpolator::interpolate(int a_dim, int b_dim) const
+std::vector<Analytiker::FormulaBit> Analytiker::_star_formula_bits(const Interpolator::InterGrid& k_values,
+                                                                   const std::vector<std::vector<int>>& stars,
+                                                                   std::map<int, std::vector<int>>* star_members)
 {
-    std::complex<double> im(0, 1);
-    InterGrid interpolated_values;
-    const auto k_vals = _unrolled_values(this->m_k_values);
-    for (int a = 0; a < a_dim; ++a)
+    // The k-point grid is odd and centered on gamma, so -k is at the mirrored row-major index
+    auto inverse_ix = [&k_values](int ix) { return k_values.size() - 1 - ix; };
+
+    std::vector<int> star_of(k_values.size());
+    std::vector<std::complex<double>> star_values(stars.size(), 0.0);
+    for (int s = 0; s < stars.size(); ++s)
     {
-        InterGrid::value_type inter_row;
-        for (int b = 0; b < b_dim; ++b)
+        for (int ix : stars[s])
         {
-            InterPoint ipoint(static_cast<double>(a) / a_dim, static_cast<double>(b) / b_dim, 0.0);
-            auto r_vec = ipoint.cart(this->m_real_lat);
-            for (const auto& k_val : k_vals)
+            star_of[ix] = s;
+            star_values[s] += k_values.values[ix] * k_values.weights[ix];
+        }
+        star_values[s] /= static_cast<double>(stars[s].size());
+    }
+
+    std::vector<FormulaBit> formula_bits;
+    std::vector<bool> visited(stars.size(), false);
+    for (int s = 0; s < stars.size(); ++s)
+    {
+        if (visited[s])
+        {
+            continue;
+        }
+
+        const auto& star = stars[s];
+        int inv_s = star_of[inverse_ix(star.front())];
+        const auto& curv = star_values[s];
+        const auto& invv = star_values[inv_s];
+
+        std::vector<int> members;
+        if (inv_s == s)
+        {
+            // The star holds both k and -k, so the sin terms cancel out, and since cos(-k)=cos(k)
+            // only half of the star has to be summed over. Gamma is the only k-point that is its own inverse.
+            for (int ix : star)
             {
-                auto k_vec = k_val->cart(m_recip_lat);
-                ipoint.value += k_val->value * k_val->weight * std::exp(im * r_vec.dot(k_vec));
+                if (ix <= inverse_ix(ix))
+                {
+                    members.push_back(ix);
+                }
             }
-            inter_row.emplace_back(std::move(ipoint));
+            double multiplicity = members.size() == star.size() ? 1.0 : 2.0;
+
+            formula_bits.emplace_back(curv.real() * multiplicity, FormulaBitBasis::RECOS, members.front());
+            formula_bits.emplace_back(0.0, FormulaBitBasis::IMSIN, members.front());
+            formula_bits.emplace_back(curv.imag() * multiplicity, FormulaBitBasis::IMCOS, members.front());
+            formula_bits.emplace_back(0.0, FormulaBitBasis::RESIN, members.front());
         }
-        interpolated_values.emplace_back(std::move(inter_row));
-    }
+        else
+        {
+            // Same pairing as for individual k-points, the inverse star holds -k for every k of the star
+            members = star;
 
-    return std::make_pair(m_real_lat, interpolated_values);
-}
+            // clang-format off
+            formula_bits.emplace_back( curv.real() + invv.real(),FormulaBitBasis::RECOS, members.front());
+            formula_bits.emplace_back( curv.real() - invv.real(),FormulaBitBasis::IMSIN, members.front());
+            formula_bits.emplace_back( curv.imag() + invv.imag(),FormulaBitBasis::IMCOS, members.front());
+            formula_bits.emplace_back(-curv.imag() + invv.imag(),FormulaBitBasis::RESIN, members.front());
+            // clang-format on
+        }
 
-//********************************************************************************************
+        (*star_members)[members.front()] = std::move(members);
+        visited[s] = true;
+        visited[inv_s] = true;
+    }
 
-Analytiker::Analytiker(const Interpolator& init_ipolator)
-    : m_formula_bits(this->_formula_bits(init_ipolator.k_values())), m_recip_lat(init_ipolator.reciprocal_lattice())
-{
+    std::sort(formula_bits.begin(), formula_bits.end(), [](const FormulaBit& lhs, const FormulaBit& rhs) -> bool {
+        return std::abs(std::get<0>(lhs)) < std::abs(std::get<0>(rhs));
+    });
+    return formula_bits;
 }
 
 std::vector<Analytiker::FormulaBit> Analytiker::_formula_bits(const Interpolator::InterGrid& k_values)
 {
     std::vector<FormulaBit> formula_bits;
 
-    int adim = k_values.size();
-    int bdim = k_values[0].size();
+    auto [adim, bdim] = k_values.dims();
 
     // Keep track of which points you visited via inversion
-    std::vector<std::vector<bool>> visited(bdim, std::vector<bool>(adim, false));
+    std::vector<bool> visited(k_values.size(), false);
 
     assert(adim % 2 == 1);
     assert(bdim % 2 == 1);
@@ -341,16 +783,18 @@ std::vector<Analytiker::FormulaBit> Analytiker::_formula_bits(const Interpolator
     int bcex = bdim / 2;
 
     // First deal with the gamma point, which is the center of the grid, and has no inversion "twin"
-    auto gamma_ptr = std::make_shared<const InterPoint>(k_values[acex][bcex]);
-    assert(almost_equal(gamma_ptr->a_frac,0.0));
-    assert(almost_equal(gamma_ptr->b_frac,0.0));
+    int gamma_ix = k_values.index(acex, bcex);
+    const auto& gamma_value = k_values.values[gamma_ix];
+    const auto& gamma_weight = k_values.weights[gamma_ix];
+    assert(almost_equal(k_values.a_fracs[gamma_ix],0.0));
+    assert(almost_equal(k_values.b_fracs[gamma_ix],0.0));
 
-    formula_bits.emplace_back(gamma_ptr->value.real() * gamma_ptr->weight, FormulaBitBasis::RECOS, gamma_ptr);
-    formula_bits.emplace_back(0.0, FormulaBitBasis::IMSIN, gamma_ptr);
-    formula_bits.emplace_back(gamma_ptr->value.imag() * gamma_ptr->weight, FormulaBitBasis::IMCOS, gamma_ptr);
-    formula_bits.emplace_back(0.0, FormulaBitBasis::RESIN, gamma_ptr);
+    formula_bits.emplace_back(gamma_value.real() * gamma_weight, FormulaBitBasis::RECOS, gamma_ix);
+    formula_bits.emplace_back(0.0, FormulaBitBasis::IMSIN, gamma_ix);
+    formula_bits.emplace_back(gamma_value.imag() * gamma_weight, FormulaBitBasis::IMCOS, gamma_ix);
+    formula_bits.emplace_back(0.0, FormulaBitBasis::RESIN, gamma_ix);
 
-    visited[acex][bcex] = true;
+    visited[gamma_ix] = true;
 
     // You only need to loop over half
     // We're pairing up k-points together because we can reduce the number
@@ -360,29 +804,28 @@ std::vector<Analytiker::FormulaBit> Analytiker::_formula_bits(const Interpolator
     {
         for (int b = -bcex; b <= bcex; ++b)
         {
-            int cura = acex + a;
-            int curb = bcex + b;
-            int inva = acex - a;
-            int invb = bcex - b;
+            int cur_ix = k_values.index(acex + a, bcex + b);
+            int inv_ix = k_values.index(acex - a, bcex - b);
 
-            if (visited[cura][curb])
+            if (visited[cur_ix])
             {
                 continue;
             }
 
-            const auto& curk = k_values[cura][curb];
-            const auto& invk = k_values[inva][invb];
-            auto curk_ptr = std::make_shared<const InterPoint>(curk);
+            const auto& curv = k_values.values[cur_ix];
+            const auto& invv = k_values.values[inv_ix];
+            double curw = k_values.weights[cur_ix];
+            double invw = k_values.weights[inv_ix];
 
             // clang-format off
-            formula_bits.emplace_back( curk.value.real() * curk.weight + invk.value.real() * invk.weight,FormulaBitBasis::RECOS, curk_ptr);
-            formula_bits.emplace_back( curk.value.real() * curk.weight - invk.value.real() * invk.weight,FormulaBitBasis::IMSIN, curk_ptr);
-            formula_bits.emplace_back( curk.value.imag() * curk.weight + invk.value.imag() * invk.weight,FormulaBitBasis::IMCOS, curk_ptr);
-            formula_bits.emplace_back(-curk.value.imag() * curk.weight + invk.value.imag() * invk.weight,FormulaBitBasis::RESIN, curk_ptr);
+            formula_bits.emplace_back( curv.real() * curw + invv.real() * invw,FormulaBitBasis::RECOS, cur_ix);
+            formula_bits.emplace_back( curv.real() * curw - invv.real() * invw,FormulaBitBasis::IMSIN, cur_ix);
+            formula_bits.emplace_back( curv.imag() * curw + invv.imag() * invw,FormulaBitBasis::IMCOS, cur_ix);
+            formula_bits.emplace_back(-curv.imag() * curw + invv.imag() * invw,FormulaBitBasis::RESIN, cur_ix);
             // clang-format on
 
-            visited[cura][curb] = true;
-            visited[inva][invb] = true;
+            visited[cur_ix] = true;
+            visited[inv_ix] = true;
         }
     }
 
@@ -444,13 +887,43 @@ std::pair<std::string, std::string> Analytiker::python_cart(std::string x_var, s
 {
     std::string real_formula("0"), imag_formula("0");
 
+    // Argument of the function for a single k-point, (X1*K1+X2*K2)
+    auto make_dots = [&](int k_ix) {
+        auto kcart = m_k_points.cart(k_ix, m_recip_lat);
+        assert(almost_equal(kcart(2),0.0,precision));
+
+        // First work on the first entry within the function
+        std::string dots = "(" + _to_string_formatted(kcart(0), precision) + "*" + x_var;
+
+        // Then work on the second entry within the function
+        if (kcart(1) >= 0)
+        {
+            dots.push_back('+');
+        }
+        dots += _to_string_formatted(kcart(1), precision) + "*" + y_var + ")";
+        return dots;
+    };
+
+    // The function of a bit, summed over every k-point of its star
+    auto make_function = [&](const std::string& function, int k_ix) {
+        auto members = this->star(k_ix);
+        if (members.size() == 1)
+        {
+            return numpy + "." + function + make_dots(k_ix);
+        }
+
+        std::string summed = "(";
+        for (int m = 0; m < members.size(); ++m)
+        {
+            summed += (m == 0 ? "" : "+") + numpy + "." + function + make_dots(members[m]);
+        }
+        return summed + ")";
+    };
+
     for (const auto& bit : m_formula_bits)
     {
         auto value = std::get<0>(bit);
-        const auto& kpoint = *std::get<2>(bit).get();
-        auto kcart = kpoint.cart(m_recip_lat);
-
-        assert(almost_equal(kcart(2),0.0,precision));
+        int k_ix = std::get<2>(bit);
 
         if (almost_equal(value, 0.0, precision))
         {
@@ -467,29 +940,19 @@ std::pair<std::string, std::string> Analytiker::python_cart(std::string x_var, s
         }
         value_str += _to_string_formatted(value, precision);
 
-        // Next work on the first entry within the function
-        std::string dots = "(" + _to_string_formatted(kcart(0), precision) + "*" + x_var;
-
-        // Then work on the second entry within the function
-        if (kcart(1) >= 0)
-        {
-            dots.push_back('+');
-        }
-        dots += _to_string_formatted(kcart(1), precision) + "*" + y_var + ")";
-
         switch (std::get<1>(bit))
         {
         case FormulaBitBasis::RECOS:
-            real_formula += value_str + "*" + numpy + ".cos" + dots;
+            real_formula += value_str + "*" + make_function("cos", k_ix);
             break;
         case FormulaBitBasis::IMSIN:
-            imag_formula += value_str + "*" + numpy + ".sin" + dots;
+            imag_formula += value_str + "*" + make_function("sin", k_ix);
             break;
         case FormulaBitBasis::IMCOS:
-            imag_formula += value_str + "*" + numpy + ".cos" + dots;
+            imag_formula += value_str + "*" + make_function("cos", k_ix);
             break;
         case FormulaBitBasis::RESIN:
-            real_formula += value_str + "*" + numpy + ".sin" + dots;
+            real_formula += value_str + "*" + make_function("sin", k_ix);
             break;
         }
     }
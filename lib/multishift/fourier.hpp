@@ -2,7 +2,12 @@
 #define FOURIER_HH
 
 #include "./definitions.hpp"
+#include "./fft.hpp"
 #include <complex>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <casmutils/xtal/lattice.hpp>
 
 namespace mush
@@ -36,6 +41,46 @@ public:
 private:
 };
 
+/**
+ * Uniform 2d grid of points on the surface, stored as a structure of arrays.
+ * The fractional coordinates, values and weights each live in their own contiguous
+ * array, in row-major order: the entry at (a,b) is at index a*b_dim+b of every array.
+ * This way the values can be handed straight to the FFT without copying.
+ */
+
+class InterGrid
+{
+public:
+    /// Creates a grid with every coordinate and value set to zero, and unit weights
+    InterGrid(int a_dim, int b_dim);
+
+    std::vector<double> a_fracs;
+    std::vector<double> b_fracs;
+    std::vector<std::complex<double>> values;
+    std::vector<double> weights;
+
+    int a_dim() const { return m_a_dim; }
+    int b_dim() const { return m_b_dim; }
+    std::pair<int, int> dims() const { return std::make_pair(m_a_dim, m_b_dim); }
+
+    /// Total number of points in the grid
+    int size() const { return m_a_dim * m_b_dim; }
+
+    /// Row-major index of the point at (a,b)
+    int index(int a, int b) const { return a * m_b_dim + b; }
+
+    /// Copy of the point at the given row-major index
+    InterPoint point(int ix) const;
+
+    /// Cartesian coordinate of the point at the given row-major index, relative to the given lattice.
+    /// Same as InterPoint::cart.
+    Eigen::Vector3d cart(int ix, const cu::xtal::Lattice& ref_lat) const;
+
+private:
+    int m_a_dim;
+    int m_b_dim;
+};
+
 /**
  * Given a lattice (only ab-vectors matter) and a list of values
  * and grid points, creates a reciprocal space from which to sample
@@ -49,10 +94,33 @@ private:
 class Interpolator
 {
 public:
-    typedef std::vector<std::vector<InterPoint>> InterGrid;
+    typedef mush::InterGrid InterGrid;
     typedef mush::cu::xtal::Lattice Lattice;
 
-    Interpolator(const Lattice& init_lat, const std::vector<InterPoint>& real_data);
+    /// How the coefficients of the k-points get calculated. The FFT is much faster, but
+    /// requires the data to fall on a uniform grid. The direct sum is kept around as a
+    /// reference implementation.
+    enum class TransformMethod
+    {
+        FFT,
+        DIRECT
+    };
+
+    Interpolator(const Lattice& init_lat, const std::vector<InterPoint>& real_data, TransformMethod method = TransformMethod::FFT);
+
+    /// Fit several sets of data that were all sampled at the same grid points (e.g. different properties, or
+    /// different cleavages of the same shift grid). The grid layout, k-points, lattices and FFT plans are
+    /// only set up once, and reused to transform every set of values. The data sets can list their points
+    /// in any order, as long as each one has the same points.
+    static std::vector<Interpolator> fit_batch(const Lattice& init_lat, const std::vector<std::vector<InterPoint>>& real_data_sets);
+
+    /// Fit the coefficients by weighted least squares instead of a transform, which works even if some of
+    /// the grid points have no value. Every point of the grid must still be listed, but points with zero
+    /// weight don't constrain the fit. The regularization penalizes the squared magnitude of every
+    /// coefficient, which keeps the k-points the data can't resolve small. Without it, the smallest set
+    /// of coefficients that fits best is taken. For a complete grid, odd or even, the coefficients are the
+    /// same as the ones of the FFT.
+    static Interpolator fit_least_squares(const Lattice& init_lat, const std::vector<InterPoint>& real_data, double regularization = 0.0);
 
     const InterGrid& sampled_values() const { return m_real_ipoints; }
 
@@ -68,12 +136,21 @@ public:
     /// Number of k-points/data points along each direction
     std::pair<int, int> dims() const;
 
-    /// Use the Fourier basis to reconstruct the signal at an arbitrary resolution
-    std::pair<Lattice, InterGrid> interpolate(int a_dim, int b_dim) const;
+    /// Dimensions of the periodic grid the data was sampled on, without the values that were
+    /// repeated at the boundary to make the grid odd
+    std::pair<int, int> periodic_dims() const { return _periodic_dims(m_real_ipoints); }
+
+    /// Use the Fourier basis to reconstruct the signal at an arbitrary resolution.
+    /// With the FFT, the k-point coefficients are zero-padded (or folded, for resolutions coarser than the
+    /// k-point grid) onto an a_dim x b_dim grid, and a single inverse transform gives every value.
+    std::pair<Lattice, InterGrid> interpolate(int a_dim, int b_dim, TransformMethod method = TransformMethod::FFT) const;
 
 private:
     /// The InterGrid must have specific dimensions, which should not be determined by outside forces
-    Interpolator(const Lattice& init_lat, const InterGrid& init_values);
+    Interpolator(const Lattice& init_lat, const InterGrid& init_values, TransformMethod method);
+
+    /// Everything already set up, but the coefficients of the k-points haven't been calculated yet
+    Interpolator(const Lattice& aligned_lat, const Lattice& recip_lat, InterGrid&& init_values, const InterGrid& init_k_values);
 
     /// This one is for when you call deserialize, don't use it for other stuff
     /* Interpolator(Lattice&& init_real, Lattice&& init_recip, InterGrid&& init_rpoints, InterGrid&& init_kpoints); */
@@ -97,18 +174,37 @@ private:
     /// the information of a gamma surface falls within a single real space unit
     /// cell (think about it, it's like the opposite of phonons, where you want 1st
     /// Brillouin zone)
-    static InterGrid _k_grid(const InterGrid& init_values, const Lattice& reciprocal_lattice);
+    /// For even grids, the k-points at opposite edges are aliases of each other. They all
+    /// get the full coefficient, and split the weight of a single k-point between them.
+    static InterGrid _k_grid(const InterGrid& init_values);
+
+    /// Sets the coefficients for each of the k points, using the requested method
+    void _take_fourier_transform(TransformMethod method);
 
-    /// Sets the coefficients for each of the k points
-    void _take_fourier_transform();
+    /// Sets the coefficients by explicitly summing over every real point for every k point.
+    /// Scales as O(N^2), but works for arbitrary positions of the real points.
+    void _take_fourier_transform_direct();
 
-    /// Helper to avoid so many loops. Unrolls 2d vector into a 1d vector.
-    static std::vector<InterPoint*> _unrolled_values(InterGrid* grid_values);
+    /// Sets the coefficients with a 2d FFT over the periodic grid of real values.
+    /// Values that were repeated at the periodic boundary by _make_unrolled_data_odd are
+    /// folded back onto their periodic images (along with their weights), so the transform
+    /// only runs over the original grid. Gives the same coefficients as the direct sum.
+    void _take_fourier_transform_fft();
 
-    /// Helper to avoid so many loops. Unrolls 2d vector into a 1d vector, but pointers are const.
-    static std::vector<const InterPoint*> _unrolled_values(const InterGrid& grid_values);
+    /// Same as _take_fourier_transform_fft, but with plans that were already made for the periodic grid.
+    /// The row plan runs along b, the column plan along a.
+    void _take_fourier_transform_fft(const FFTPlan& row_plan, const FFTPlan& col_plan);
 
-    /// Given an unrolled vector of grid data, reshape it to the specified dimensions
+    /// Sets the coefficients that minimize the weighted squared error at the real points, plus the
+    /// regularization times the squared magnitude of the coefficients. Solves the normal equations
+    /// if there is any regularization, and uses a complete orthogonal decomposition otherwise, since
+    /// the problem is underdetermined as soon as any point is missing.
+    void _take_least_squares_fit(double regularization);
+
+    /// Dimensions of the real grid without the repeated values at the periodic boundary
+    static std::pair<int, int> _periodic_dims(const InterGrid& real_values);
+
+    /// Given an unrolled vector of grid data (sorted in row-major order), reshape it to the specified dimensions
     static InterGrid _direct_reshape(const std::vector<mush::InterPoint>& unrolled_data, int ka_dim, int kb_dim);
 
     /// Given unrolled data for ab-grid fractions and values, reshape the data into a 2d-grid,
@@ -122,6 +218,12 @@ private:
     /// reshaping the grid results in odd dimensions along both a and b.
     /// Even dimensions are made odd by repeating the boundary values on the opposite side.
     static void _make_unrolled_data_odd(std::vector<mush::InterPoint>* unrolled_data, int* final_adim, int* final_bdim);
+
+    /// Reconstruct the signal by summing every plane wave at every requested point
+    InterGrid _interpolate_direct(int a_dim, int b_dim) const;
+
+    /// Reconstruct the signal with an inverse FFT of the zero-padded k-point coefficients
+    InterGrid _interpolate_fft(int a_dim, int b_dim) const;
 };
 
 /**
@@ -144,18 +246,40 @@ public:
         RESIN,
     };
 
-    /// Couples an InterPoint (k-point coefficient) with decomposed coefficients
-    typedef std::tuple<double, FormulaBitBasis, std::shared_ptr<const InterPoint>> FormulaBit;
+    /// Couples a k-point (row-major index into the k-point grid) with decomposed coefficients
+    typedef std::tuple<double, FormulaBitBasis, int> FormulaBit;
 
     /// Initialize with an interpolator
     Analytiker(const Interpolator& init_ipolator);
 
+    /// Initialize with an interpolator, grouping the k-points into stars under the given symmetry
+    /// operations, which act on the fractional coordinates of the surface (see make_shift_group).
+    /// Every star gets a single coefficient, the average of the coefficients of its k-points, so
+    /// there are up to as many times fewer formula bits as there are operations. If the data has
+    /// the symmetry of the operations, the formula is the same as the one without stars, as long as
+    /// the operations map the grid onto itself. Otherwise, only the k-points that don't alias anything
+    /// are guaranteed to share their coefficients.
+    Analytiker(const Interpolator& init_ipolator, const std::vector<Eigen::Matrix2i>& shift_group);
+
     /// Print the analytical expression in a Python compatible format, where the
     /// expected input are numpy like arrays for the x and y coordinates
     /// The first entry in the pair is made up of the real basis functions, while the
     /// second one has the imaginary ones (which are probably zero)
     std::pair<std::string,std::string> python_cart(std::string x_var, std::string y_var, std::string numpy, double precision) const;
 
+    /// Coefficients for each of the basis functions, sorted by magnitude
+    const std::vector<FormulaBit>& formula_bits() const { return m_formula_bits; }
+
+    /// Reciprocal lattice that the k-points of the formula bits are fractional coordinates of
+    const Interpolator::Lattice& reciprocal_lattice() const { return m_recip_lat; }
+
+    /// Grid of k-points that the formula bits index into
+    const InterGrid& k_points() const { return m_k_points; }
+
+    /// Indexes into the k-point grid of every plane wave that the basis function of a formula bit sums
+    /// over, given the index the bit holds. Without stars, that's only the k-point of the bit itself.
+    std::vector<int> star(int k_ix) const;
+
 private:
     /// Checks that the imaginary coefficients cancelled out when creating
     /// the formula bits
@@ -168,12 +292,33 @@ private:
     /// since the terms can be halved by taking inversion symmetry of sin/cos into account.
     static std::vector<FormulaBit> _formula_bits(const Interpolator::InterGrid& k_values);
 
+    /// Group the k-points into stars. Data that is symmetric on the periodic grid has Fourier coefficients
+    /// that are symmetric under the transpose of the operations. If an operation maps the grid onto itself,
+    /// that holds up to the periodicity of the grid, so k-points are in the same star if any of their periodic
+    /// images are. Otherwise only k-points that map directly onto another k-point of the grid are joined,
+    /// and only if neither of them is at the edge of the grid, where they alias another k-point.
+    static std::vector<std::vector<int>>
+    _k_stars(const InterGrid& k_values, const std::vector<Eigen::Matrix2i>& shift_group, int periodic_adim, int periodic_bdim);
+
+    /// Same as _formula_bits, but with a single set of sin/cos terms for each pair of stars that are
+    /// inversions of each other. The k-points that each bit sums over are saved in star_members,
+    /// keyed by the k-point index that the bit holds.
+    static std::vector<FormulaBit> _star_formula_bits(const Interpolator::InterGrid& k_values,
+                                                      const std::vector<std::vector<int>>& stars,
+                                                      std::map<int, std::vector<int>>* star_members);
+
+    /// Copy of the k-point grid of the interpolator that *this was constructed with
+    InterGrid m_k_points;
+
     /// Contains coefficients for each fo the basis functions
     std::vector<FormulaBit> m_formula_bits;
 
     /// Reciprocal lattice of the interpolator that *this was constructed with
     Interpolator::Lattice m_recip_lat;
 
+    /// Every k-point that the basis functions of each formula bit sum over, empty if there are no stars
+    std::map<int, std::vector<int>> m_stars;
+
     /// Turn a double into a string. If the precision is small enough, use scientific notation
     static std::string _to_string_formatted(double value, double precision);
 };
@@ -0,0 +1,91 @@
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mush
+{
+/// Number of threads to use when the user asks for num_threads. Anything smaller than one
+/// means "use every core", as far as the standard library can tell how many there are.
+inline int resolve_thread_count(int num_threads)
+{
+    if (num_threads > 0)
+    {
+        return num_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Call work(i) for every i in [0,n), spread over a pool of threads. Indexes are
+ * handed out one at a time, so uneven amounts of work per index balance out.
+ * The order in which indexes get processed is not defined, so anything that has
+ * to be deterministic (records, logs) should be done outside of work, or ordered
+ * after the fact.
+ *
+ * If any call throws, the remaining indexes are abandoned and the first exception
+ * is rethrown once every thread is done.
+ * With a single thread, everything runs in the calling thread, in order.
+ */
+
+template <typename WorkType>
+void parallel_for(int n, int num_threads, WorkType&& work)
+{
+    num_threads = std::min(resolve_thread_count(num_threads), std::max(n, 1));
+    if (num_threads == 1)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            work(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next_ix(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr first_error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        for (int i = next_ix++; i < n && !failed; i = next_ix++)
+        {
+            try
+            {
+                work(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!failed.exchange(true))
+                {
+                    first_error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < num_threads; ++t)
+    {
+        pool.emplace_back(worker);
+    }
+
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+
+    if (first_error)
+    {
+        std::rethrow_exception(first_error);
+    }
+    return;
+}
+} // namespace mush
+
+#endif
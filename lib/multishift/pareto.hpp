@@ -0,0 +1,116 @@
+#ifndef PARETO_HH
+#define PARETO_HH
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Keeps the candidates that are the best trade-offs between two quantities that
+ * should both be small, e.g. the size of a supercell and the strain needed to make
+ * it commensurate. A candidate is dominated if another one is at least as small in
+ * both, and dominated candidates never stay on the front.
+ *
+ * The front never holds more than max_size candidates. Once it's full, the candidate
+ * whose removal leaves the smallest gap goes, where the gap is the distance between its
+ * neighbors on the front, with sizes and costs each scaled by their range on the front.
+ * With room for at least two, the smallest and the cheapest candidates are only ever
+ * dropped for ones that dominate them, so a full front still spans every trade-off it
+ * has seen.
+ */
+
+template <typename ItemType>
+class ParetoFront
+{
+public:
+    struct Entry
+    {
+        double size;
+        double cost;
+        ItemType item;
+    };
+
+    ParetoFront(int max_size) : m_max_size(max_size) { assert(max_size > 0); }
+
+    /// True if a candidate of the given size could make it onto the front, provided its cost is no
+    /// larger than the given value. Partial costs that can only grow can be checked early this way.
+    bool is_competitive(double size, double cost) const
+    {
+        for (const auto& entry : m_entries)
+        {
+            if (entry.size <= size && entry.cost <= cost)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Add the candidate if it's competitive, dropping everything it dominates.
+    /// Returns true if the candidate was kept.
+    bool insert(double size, double cost, ItemType item)
+    {
+        if (!this->is_competitive(size, cost))
+        {
+            return false;
+        }
+
+        auto dominated = [size, cost](const Entry& entry) { return size <= entry.size && cost <= entry.cost; };
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), dominated), m_entries.end());
+
+        auto position = std::upper_bound(
+            m_entries.begin(), m_entries.end(), size, [](double new_size, const Entry& entry) { return new_size < entry.size; });
+        m_entries.insert(position, Entry{size, cost, std::move(item)});
+
+        if (m_entries.size() > m_max_size)
+        {
+            this->_drop_most_crowded();
+        }
+        return true;
+    }
+
+    /// True if the front holds as many candidates as it's allowed to
+    bool full() const { return m_entries.size() >= m_max_size; }
+
+    /// Candidates on the front, sorted by increasing size (and therefore decreasing cost)
+    const std::vector<Entry>& entries() const { return m_entries; }
+
+private:
+    std::size_t m_max_size;
+    std::vector<Entry> m_entries;
+
+    /// Remove the entry between two others whose neighbors are closest together. Without one
+    /// (a front of a single candidate), the largest candidate goes.
+    void _drop_most_crowded()
+    {
+        if (m_entries.size() < 3)
+        {
+            m_entries.pop_back();
+            return;
+        }
+
+        double size_range = m_entries.back().size - m_entries.front().size;
+        double cost_range = m_entries.front().cost - m_entries.back().cost;
+        auto scaled = [](double difference, double range) { return range > 0.0 ? difference / range : 0.0; };
+
+        std::size_t crowded = 1;
+        double smallest_gap = std::numeric_limits<double>::max();
+        for (std::size_t i = 1; i + 1 < m_entries.size(); ++i)
+        {
+            double gap = scaled(m_entries[i + 1].size - m_entries[i - 1].size, size_range) +
+                         scaled(m_entries[i - 1].cost - m_entries[i + 1].cost, cost_range);
+            if (gap < smallest_gap)
+            {
+                smallest_gap = gap;
+                crowded = i;
+            }
+        }
+        m_entries.erase(m_entries.begin() + crowded);
+    }
+};
+} // namespace mush
+
+#endif
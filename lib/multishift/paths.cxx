@@ -0,0 +1,263 @@
+#include "./paths.hpp"
+#include "./profile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+/// Newton iterations before giving up on a starting point
+const int MAX_NEWTON_ITERATIONS = 100;
+
+/// Hessian as a matrix, from the xx, xy and yy components the SurfaceEvaluator gives
+Eigen::Matrix2d make_hessian(const Eigen::Vector3d& components)
+{
+    Eigen::Matrix2d hessian;
+    hessian << components(0), components(1), components(1), components(2);
+    return hessian;
+}
+
+/// Cartesian distance between two points, taking the shortest way through the periodic boundaries
+double periodic_distance(const Eigen::Matrix2d& cell, const Eigen::Vector2d& lhs, const Eigen::Vector2d& rhs)
+{
+    Eigen::Vector2d frac_diff = cell.inverse() * (lhs - rhs);
+    frac_diff -= frac_diff.array().round().matrix();
+    return (cell * frac_diff).norm();
+}
+
+/// Evaluate everything there is to know about the point, after bringing it into the unit cell
+mush::StationaryPoint make_stationary_point(const mush::SurfaceEvaluator& surface, const Eigen::Matrix2d& cell, const Eigen::Vector2d& cart)
+{
+    mush::StationaryPoint point;
+    point.frac = cell.inverse() * cart;
+    point.frac -= point.frac.array().floor().matrix();
+    for (int i = 0; i < 2; ++i)
+    {
+        // Rounding can leave something like 0.9999999999999999, which is the origin
+        if (point.frac(i) > 1.0 - 1e-12)
+        {
+            point.frac(i) = 0.0;
+        }
+    }
+    point.cart = cell * point.frac;
+
+    Eigen::Matrix2Xd points = point.cart;
+    auto batch = surface.evaluate(points);
+    point.value = batch.values(0);
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> eigen(::make_hessian(batch.hessians.col(0)));
+    point.curvatures = eigen.eigenvalues();
+    point.soft_mode = eigen.eigenvectors().col(0);
+    point.order = (point.curvatures.array() < 0.0).count();
+    return point;
+}
+
+/// Move the images so they're equally spaced along the piecewise linear path through them
+void reparametrize(std::vector<Eigen::Vector2d>* images_ptr)
+{
+    auto& images = *images_ptr;
+    std::vector<double> arc_lengths(images.size(), 0.0);
+    for (int i = 1; i < images.size(); ++i)
+    {
+        arc_lengths[i] = arc_lengths[i - 1] + (images[i] - images[i - 1]).norm();
+    }
+
+    auto old_images = images;
+    double total = arc_lengths.back();
+    int segment = 0;
+    for (int i = 1; i + 1 < images.size(); ++i)
+    {
+        double target = total * i / (images.size() - 1);
+        while (segment + 2 < arc_lengths.size() && arc_lengths[segment + 1] < target)
+        {
+            ++segment;
+        }
+
+        double length = arc_lengths[segment + 1] - arc_lengths[segment];
+        double t = length > 0.0 ? (target - arc_lengths[segment]) / length : 0.0;
+        images[i] = (1.0 - t) * old_images[segment] + t * old_images[segment + 1];
+    }
+    return;
+}
+} // namespace
+
+namespace mush
+{
+StationaryPoint refine_stationary_point(
+    const SurfaceEvaluator& surface, const Eigen::Matrix2d& cell, const Eigen::Vector2d& start, double tolerance, bool* converged)
+{
+    double max_step = 0.1 * std::min(cell.col(0).norm(), cell.col(1).norm());
+
+    Eigen::Vector2d cart = start;
+    Eigen::Matrix2Xd points(2, 1);
+    *converged = false;
+    for (int iteration = 0; iteration < ::MAX_NEWTON_ITERATIONS; ++iteration)
+    {
+        points.col(0) = cart;
+        auto batch = surface.evaluate(points);
+        Eigen::Vector2d gradient = batch.gradients.col(0);
+        if (gradient.norm() < tolerance)
+        {
+            *converged = true;
+            break;
+        }
+
+        // Newton step in the eigenbasis of the Hessian. Curvatures that are too small to trust
+        // get clamped, the step is capped anyway.
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> eigen(::make_hessian(batch.hessians.col(0)));
+        double smallest_curvature = 1e-8 * std::max(1.0, eigen.eigenvalues().cwiseAbs().maxCoeff());
+        Eigen::Vector2d step = Eigen::Vector2d::Zero();
+        for (int i = 0; i < 2; ++i)
+        {
+            double curvature = eigen.eigenvalues()(i);
+            if (std::abs(curvature) < smallest_curvature)
+            {
+                curvature = curvature < 0.0 ? -smallest_curvature : smallest_curvature;
+            }
+            step -= eigen.eigenvectors().col(i) * eigen.eigenvectors().col(i).dot(gradient) / curvature;
+        }
+
+        if (step.norm() > max_step)
+        {
+            step *= max_step / step.norm();
+        }
+        cart += step;
+    }
+
+    return ::make_stationary_point(surface, cell, cart);
+}
+
+std::vector<StationaryPoint> find_stationary_points(const SurfaceEvaluator& surface, const Eigen::Matrix2d& cell, int seeds, double tolerance)
+{
+    ScopedTimer timer("stationary_points");
+    if (seeds < 1)
+    {
+        throw std::runtime_error("Stationary points need at least one starting point to be searched for.");
+    }
+
+    // Anything closer than this is the same point
+    double same_distance = 1e-4 * std::min(cell.col(0).norm(), cell.col(1).norm());
+
+    std::vector<StationaryPoint> stationary_points;
+    for (int a = 0; a < seeds; ++a)
+    {
+        for (int b = 0; b < seeds; ++b)
+        {
+            Eigen::Vector2d start = cell * Eigen::Vector2d(static_cast<double>(a) / seeds, static_cast<double>(b) / seeds);
+
+            bool converged = false;
+            auto point = refine_stationary_point(surface, cell, start, tolerance, &converged);
+            profile_count("newton_searches");
+            if (!converged)
+            {
+                continue;
+            }
+
+            bool seen = std::any_of(stationary_points.begin(), stationary_points.end(), [&](const StationaryPoint& other) {
+                return ::periodic_distance(cell, point.cart, other.cart) < same_distance;
+            });
+            if (!seen)
+            {
+                stationary_points.push_back(point);
+            }
+        }
+    }
+
+    std::sort(stationary_points.begin(), stationary_points.end(), [](const StationaryPoint& lhs, const StationaryPoint& rhs) {
+        return lhs.order != rhs.order ? lhs.order < rhs.order : lhs.value < rhs.value;
+    });
+    return stationary_points;
+}
+
+MinimumEnergyPath find_minimum_energy_path(const SurfaceEvaluator& surface,
+                                           const Eigen::Matrix2d& cell,
+                                           const Eigen::Vector2d& start,
+                                           const Eigen::Vector2d& end,
+                                           const StringSettings& settings)
+{
+    ScopedTimer timer("string_method");
+    if (settings.images < 3)
+    {
+        throw std::runtime_error("A path needs at least 3 images, including both ends.");
+    }
+    if ((end - start).norm() < 1e-8)
+    {
+        throw std::runtime_error("The path has to connect two different points.");
+    }
+
+    int num_images = settings.images;
+    std::vector<Eigen::Vector2d> images;
+    for (int i = 0; i < num_images; ++i)
+    {
+        double t = static_cast<double>(i) / (num_images - 1);
+        images.push_back((1.0 - t) * start + t * end);
+    }
+
+    MinimumEnergyPath path;
+    path.converged = false;
+    path.iterations = 0;
+
+    Eigen::Matrix2Xd points(2, num_images);
+    SurfaceEvaluator::Batch batch;
+    while (!path.converged && path.iterations < settings.max_iterations)
+    {
+        ++path.iterations;
+        for (int i = 0; i < num_images; ++i)
+        {
+            points.col(i) = images[i];
+        }
+        batch = surface.evaluate(points);
+
+        // Steepest descent is stable as long as the step is below 2/curvature
+        double largest_curvature = 0.0;
+        for (int i = 1; i + 1 < num_images; ++i)
+        {
+            largest_curvature = std::max(largest_curvature, spectral_radius(batch.hessians.col(i)));
+        }
+        double step = 0.5 / std::max(largest_curvature, std::numeric_limits<double>::min());
+
+        auto previous_images = images;
+        for (int i = 1; i + 1 < num_images; ++i)
+        {
+            images[i] -= step * batch.gradients.col(i);
+        }
+        ::reparametrize(&images);
+
+        // Only the part of the gradient perpendicular to the path moves it, the rest gets undone by the
+        // reparametrization. Once the images stop moving, what's left of it is balanced out.
+        double largest_displacement = 0.0;
+        for (int i = 1; i + 1 < num_images; ++i)
+        {
+            largest_displacement = std::max(largest_displacement, (images[i] - previous_images[i]).norm());
+        }
+        path.converged = largest_displacement < settings.tolerance * step;
+    }
+
+    // Values at the final images
+    for (int i = 0; i < num_images; ++i)
+    {
+        points.col(i) = images[i];
+    }
+    batch = surface.evaluate(points, SurfaceEvaluator::Order::VALUE);
+
+    path.points = images;
+    path.values.assign(batch.values.data(), batch.values.data() + num_images);
+    path.arc_lengths.assign(num_images, 0.0);
+    for (int i = 1; i < num_images; ++i)
+    {
+        path.arc_lengths[i] = path.arc_lengths[i - 1] + (images[i] - images[i - 1]).norm();
+    }
+    path.highest_image = std::max_element(path.values.begin(), path.values.end()) - path.values.begin();
+
+    // The saddle point lies somewhere between the images around the highest one
+    double spacing = path.arc_lengths.back() / (num_images - 1);
+    bool refined = false;
+    path.saddle = refine_stationary_point(surface, cell, images[path.highest_image], 1e-8, &refined);
+    path.has_saddle = refined && path.saddle.order == 1 && ::periodic_distance(cell, path.saddle.cart, images[path.highest_image]) < spacing;
+
+    double highest = path.has_saddle ? std::max(path.saddle.value, path.values[path.highest_image]) : path.values[path.highest_image];
+    path.barrier = highest - path.values.front();
+    return path;
+}
+} // namespace mush
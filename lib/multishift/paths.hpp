@@ -0,0 +1,97 @@
+#ifndef PATHS_HH
+#define PATHS_HH
+
+#include "./definitions.hpp"
+#include "./evaluator.hpp"
+#include <vector>
+
+namespace mush
+{
+/**
+ * A point of a fitted surface where the gradient vanishes. The curvatures are the
+ * eigenvalues of the Hessian in ascending order, and the number of negative ones
+ * tells minima (0), first order saddle points (1) and maxima (2) apart.
+ *
+ * The cell the surface is periodic in is given by its in-plane lattice vectors as
+ * the columns of a 2x2 matrix, in the same Cartesian coordinates the SurfaceEvaluator
+ * takes (see Interpolator::real_lattice).
+ */
+
+struct StationaryPoint
+{
+    /// Cartesian coordinates, brought into the unit cell
+    Eigen::Vector2d cart;
+    /// Fractional coordinates along a and b, within [0,1)
+    Eigen::Vector2d frac;
+    /// Value of the surface at the point
+    double value;
+    /// Eigenvalues of the Hessian, lowest first
+    Eigen::Vector2d curvatures;
+    /// Eigenvector of the lowest curvature, the direction a saddle point goes downhill along
+    Eigen::Vector2d soft_mode;
+    /// Number of negative curvatures
+    int order;
+};
+
+/// Newton iterations on the gradient from the starting point, using the analytic Hessian. Steps are
+/// capped at a tenth of the shortest lattice vector, and directions with vanishing curvature get damped.
+/// Converges to whatever stationary point is nearby, regardless of its order. If the gradient never
+/// drops below the tolerance, converged is set to false and the last point is returned.
+StationaryPoint refine_stationary_point(
+    const SurfaceEvaluator& surface, const Eigen::Matrix2d& cell, const Eigen::Vector2d& start, double tolerance, bool* converged);
+
+/// Every distinct stationary point in the cell that Newton iterations converge to, when started from each
+/// point of a seeds x seeds grid. Periodic images are only kept once. Sorted by order, then by value.
+std::vector<StationaryPoint>
+find_stationary_points(const SurfaceEvaluator& surface, const Eigen::Matrix2d& cell, int seeds, double tolerance = 1e-8);
+
+/// Settings of the string method used by find_minimum_energy_path
+struct StringSettings
+{
+    /// Number of images along the path, including both ends
+    int images = 33;
+    /// Give up after this many steps, even if the path didn't converge
+    int max_iterations = 2000;
+    /// The path is converged once no image moves by more than this times the step size, i.e. once
+    /// the gradient perpendicular to the path is balanced out everywhere
+    double tolerance = 1e-4;
+};
+
+/// Result of find_minimum_energy_path. Every point is in Cartesian coordinates, without being
+/// brought back into the unit cell, so the path is continuous.
+struct MinimumEnergyPath
+{
+    std::vector<Eigen::Vector2d> points;
+    std::vector<double> values;
+    /// Distance along the path from the start to each image
+    std::vector<double> arc_lengths;
+    /// Image with the highest value
+    int highest_image;
+    /// Saddle point refined from the highest image, only meaningful if has_saddle is set
+    StationaryPoint saddle;
+    /// True if the highest image led to a first order saddle point right next to it
+    bool has_saddle;
+    /// Highest value along the path (the saddle point, if there is one) relative to the start
+    double barrier;
+    int iterations;
+    bool converged;
+};
+
+/**
+ * Find the path of lowest energy between two points with the string method: every image moves
+ * downhill, and gets redistributed at equal distances along the path after each step. Both ends
+ * stay in place, so they should be minima. The end can be a periodic image of the start (e.g.
+ * the start plus a lattice vector) to get the glide path between equivalent minima.
+ *
+ * The path starts out as a straight line. The step size is set by the largest curvature along
+ * the path at each iteration, so it stays stable without having to be tuned.
+ */
+
+MinimumEnergyPath find_minimum_energy_path(const SurfaceEvaluator& surface,
+                                           const Eigen::Matrix2d& cell,
+                                           const Eigen::Vector2d& start,
+                                           const Eigen::Vector2d& end,
+                                           const StringSettings& settings = StringSettings());
+} // namespace mush
+
+#endif
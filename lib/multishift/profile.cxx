@@ -0,0 +1,140 @@
+#include "./profile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sys/resource.h>
+
+namespace mush
+{
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Tally& Profiler::_local_tally()
+{
+    // The profiler is constructed before the first tally, so it's still around when the tallies
+    // of the main thread get destroyed at exit
+    struct RegisteredTally
+    {
+        Tally tally;
+        RegisteredTally()
+        {
+            auto& profiler = Profiler::instance();
+            std::lock_guard<std::mutex> lock(profiler.m_mutex);
+            profiler.m_tallies.push_back(&tally);
+        }
+        ~RegisteredTally() { Profiler::instance()._retire(&tally); }
+    };
+
+    thread_local RegisteredTally local;
+    return local.tally;
+}
+
+void Profiler::_retire(Tally* tally)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> tally_lock(tally->mutex);
+    for (const auto& [name, phase] : tally->phases)
+    {
+        m_phases[name].seconds += phase.seconds;
+        m_phases[name].calls += phase.calls;
+    }
+    for (const auto& [name, amount] : tally->counters)
+    {
+        m_counters[name] += amount;
+    }
+    m_tallies.erase(std::remove(m_tallies.begin(), m_tallies.end(), tally), m_tallies.end());
+    return;
+}
+
+void Profiler::add_time(const char* phase, double seconds)
+{
+    auto& tally = this->_local_tally();
+    std::lock_guard<std::mutex> lock(tally.mutex);
+    auto& total = tally.phases[phase];
+    total.seconds += seconds;
+    ++total.calls;
+    return;
+}
+
+void Profiler::count(const char* counter, long amount)
+{
+    auto& tally = this->_local_tally();
+    std::lock_guard<std::mutex> lock(tally.mutex);
+    tally.counters[counter] += amount;
+    return;
+}
+
+json Profiler::report() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto phases = m_phases;
+    auto counters = m_counters;
+    for (Tally* tally : m_tallies)
+    {
+        std::lock_guard<std::mutex> tally_lock(tally->mutex);
+        for (const auto& [name, phase] : tally->phases)
+        {
+            phases[name].seconds += phase.seconds;
+            phases[name].calls += phase.calls;
+        }
+        for (const auto& [name, amount] : tally->counters)
+        {
+            counters[name] += amount;
+        }
+    }
+
+    json report;
+    report["phases"] = json::object();
+    for (const auto& [name, phase] : phases)
+    {
+        report["phases"][name] = {{"seconds", phase.seconds}, {"calls", phase.calls}};
+    }
+    report["counters"] = counters;
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - m_start;
+    report["wall_seconds"] = wall_time.count();
+    report["peak_resident_bytes"] = peak_resident_bytes();
+    return report;
+}
+
+void Profiler::write_report(const fs::path& target)
+{
+    auto dumped = this->report().dump(4);
+    std::ofstream report_stream(target);
+    report_stream << dumped;
+    m_reported = true;
+    return;
+}
+
+void Profiler::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phases.clear();
+    m_counters.clear();
+    for (Tally* tally : m_tallies)
+    {
+        std::lock_guard<std::mutex> tally_lock(tally->mutex);
+        tally->phases.clear();
+        tally->counters.clear();
+    }
+    m_reported = false;
+    return;
+}
+
+long peak_resident_bytes()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return -1;
+    }
+#ifdef __APPLE__
+    // Already in bytes on macOS
+    return usage.ru_maxrss;
+#else
+    // Kilobytes everywhere else
+    return usage.ru_maxrss * 1024;
+#endif
+}
+} // namespace mush
@@ -0,0 +1,143 @@
+#ifndef PROFILE_HH
+#define PROFILE_HH
+
+#include "./definitions.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Collects how much time is spent in each phase of a run, and counts of things
+ * like structures and bytes written. Everything goes through a single instance,
+ * which starts out disabled. While disabled, timers and counters only check a
+ * flag, so they can stay in the code permanently.
+ *
+ * Phases are named by the caller, and time spent in the same phase adds up over
+ * every call, across threads. Phases can be nested, in which case the outer one
+ * includes the time of the inner one.
+ *
+ * Every thread adds up its times and counts in a tally of its own, so threads
+ * that stop a timer at the same time don't wait on each other. The tallies only
+ * get merged for the report, and when their thread exits.
+ */
+
+class Profiler
+{
+public:
+    static Profiler& instance();
+
+    /// Start (or stop) collecting. The wall time in the report starts counting here.
+    void enable(bool on = true)
+    {
+        m_enabled = on;
+        m_start = std::chrono::steady_clock::now();
+    }
+    bool enabled() const { return m_enabled; }
+
+    /// Add time spent in the phase
+    void add_time(const char* phase, double seconds);
+
+    /// Increase the counter by amount
+    void count(const char* counter, long amount = 1);
+
+    /// Time per phase (total seconds and number of calls), counters, wall time since the profiler was enabled,
+    /// and the peak memory used by the process
+    json report() const;
+
+    /// Save the report as json. Remembers that it happened, so it isn't saved somewhere else as well.
+    void write_report(const fs::path& target);
+
+    /// True if write_report has been called
+    bool reported() const { return m_reported; }
+
+    /// Forget every time and count collected so far
+    void reset();
+
+private:
+    Profiler() : m_enabled(false), m_reported(false) {}
+
+    bool m_enabled;
+    bool m_reported;
+    std::chrono::steady_clock::time_point m_start;
+
+    struct Phase
+    {
+        double seconds = 0.0;
+        long calls = 0;
+    };
+
+    /// Times and counts of a single thread. Only the report and reset ever wait on its mutex.
+    struct Tally
+    {
+        std::mutex mutex;
+        std::map<std::string, Phase> phases;
+        std::map<std::string, long> counters;
+    };
+
+    /// Tally of the calling thread, which gets registered the first time the thread uses it
+    Tally& _local_tally();
+
+    /// Add everything in the tally to the totals of the threads that are gone, and stop tracking it
+    void _retire(Tally* tally);
+
+    /// Guards the list of tallies and the totals
+    mutable std::mutex m_mutex;
+    std::vector<Tally*> m_tallies;
+    std::map<std::string, Phase> m_phases;
+    std::map<std::string, long> m_counters;
+};
+
+/// Adds the time between its construction and destruction to a phase of the Profiler.
+/// Doesn't even look at the clock unless the profiler is enabled.
+class ScopedTimer
+{
+public:
+    ScopedTimer(const char* phase) : m_phase(phase), m_active(Profiler::instance().enabled())
+    {
+        if (m_active)
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() { this->stop(); }
+
+    /// Add the time so far to the phase, before the timer goes out of scope. Later calls do nothing.
+    void stop()
+    {
+        if (m_active)
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+            Profiler::instance().add_time(m_phase, elapsed.count());
+            m_active = false;
+        }
+    }
+
+private:
+    const char* m_phase;
+    bool m_active;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/// Shorthand for Profiler::instance().count(), which does nothing if profiling is off
+inline void profile_count(const char* counter, long amount = 1)
+{
+    auto& profiler = Profiler::instance();
+    if (profiler.enabled())
+    {
+        profiler.count(counter, amount);
+    }
+}
+
+/// Largest amount of memory the process has had resident at once, in bytes
+long peak_resident_bytes();
+} // namespace mush
+
+#endif
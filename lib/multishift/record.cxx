@@ -0,0 +1,800 @@
+#include "./record.hpp"
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+/// Indentation used for JSON records, same as what write_json uses
+const int JSON_INDENT = 4;
+
+/// Dump the value as indented JSON, with every line after the first shifted to the given depth
+std::string dump_indented(const mush::json& value, int depth)
+{
+    std::string dumped = value.dump(::JSON_INDENT);
+    std::string indent(::JSON_INDENT * depth, ' ');
+
+    std::string indented;
+    indented.reserve(dumped.size());
+    for (char c : dumped)
+    {
+        indented.push_back(c);
+        if (c == '\n')
+        {
+            indented += indent;
+        }
+    }
+    return indented;
+}
+
+/// Everything that's kept from a single entry of "ids"
+struct ParsedId
+{
+    double cleavage = 0.0;
+    bool has_cleavage = false;
+    mush::json grid_point;
+    /// Grid point of the representative, if there is one
+    int representative_a = -1;
+    int representative_b = -1;
+    /// Label of the orbit the id belongs to, if there is one
+    int orbit = -1;
+    std::vector<std::pair<std::string, double>> values;
+};
+
+/// Entries of an id that describe the structure rather than hold values
+const std::unordered_set<std::string> BOOKKEEPING_KEYS{
+    "cleavage", "grid_point", "orbit", "shift", "directory", "equivalent_structures", "representative", "hash", "reused_from"};
+
+/**
+ * SAX handler for the records, tracks where in the document it is and only
+ * keeps what's needed. Small top level entries get captured as json, and every
+ * id gets handed to a callback as soon as its object is closed.
+ *
+ * If a target for the ids is given, everything is kept instead: each id is captured
+ * in full and only added to the target once its object is closed.
+ */
+
+class RecordSaxHandler : public mush::json::json_sax_t
+{
+public:
+    using json = mush::json;
+
+    RecordSaxHandler(const std::vector<std::string>& value_keys, json* header, std::function<void(ParsedId&&)> on_id, json* ids = nullptr)
+        : m_value_keys(value_keys.begin(), value_keys.end()), m_header(header), m_on_id(on_id), m_ids(ids), m_depth(0), m_keys(1)
+    {
+    }
+
+    bool null() override { return this->_scalar(nullptr); }
+    bool boolean(bool val) override { return this->_scalar(val); }
+    bool number_integer(number_integer_t val) override { return this->_number(val, val); }
+    bool number_unsigned(number_unsigned_t val) override { return this->_number(val, val); }
+    bool number_float(number_float_t val, const string_t& /*s*/) override { return this->_number(val, val); }
+    bool binary(binary_t& /*val*/) override { return true; }
+
+    bool string(string_t& val) override
+    {
+        if (!this->_capturing() && this->_in_id_entry() && m_keys[3] == "representative")
+        {
+            // Ids look like a:b:cleavage
+            auto first = val.find(':');
+            auto second = val.find(':', first + 1);
+            if (first == std::string::npos || second == std::string::npos)
+            {
+                throw std::runtime_error("Could not read the grid point of representative '" + val + "'.");
+            }
+            m_id.representative_a = std::stoi(val.substr(0, first));
+            m_id.representative_b = std::stoi(val.substr(first + 1, second - first - 1));
+            return true;
+        }
+        return this->_scalar(val);
+    }
+
+    bool start_object(std::size_t /*elements*/) override { return this->_start_container(json::object()); }
+    bool start_array(std::size_t /*elements*/) override { return this->_start_container(json::array()); }
+
+    bool end_object() override
+    {
+        this->_end_container();
+        if (m_depth == 2 && this->_in_ids())
+        {
+            if (m_ids != nullptr)
+            {
+                (*m_ids)[m_keys[2]] = std::move(m_pending_id);
+            }
+            m_on_id(std::move(m_id));
+        }
+        return true;
+    }
+
+    bool end_array() override
+    {
+        this->_end_container();
+        return true;
+    }
+
+    bool key(string_t& val) override
+    {
+        m_keys[m_depth] = val;
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string& /*last_token*/, const nlohmann::detail::exception& ex) override
+    {
+        error_position = position;
+        error_message = ex.what();
+        return false;
+    }
+
+    std::size_t error_position = 0;
+    std::string error_message;
+
+private:
+    std::unordered_set<std::string> m_value_keys;
+    json* m_header;
+    std::function<void(ParsedId&&)> m_on_id;
+    /// Where complete ids go when everything is being kept
+    json* m_ids;
+    /// Id that's currently being captured, when everything is being kept
+    json m_pending_id;
+
+    /// Number of containers the parser is currently inside of
+    int m_depth;
+    /// Most recent key of every object the parser is currently inside of, indexed by depth
+    std::vector<std::string> m_keys;
+    /// Containers of the value that's currently being captured, innermost last
+    std::vector<json*> m_capture_stack;
+    /// Depth at which the capture started
+    int m_capture_depth = 0;
+
+    ParsedId m_id;
+
+    bool _capturing() const { return !m_capture_stack.empty(); }
+    bool _in_ids() const { return m_depth >= 1 && m_keys[1] == "ids"; }
+    /// True if the parser is directly inside the object of a single id
+    bool _in_id_entry() const { return m_depth == 3 && this->_in_ids(); }
+
+    /// Where a value at the current position should go, if it's being kept at all
+    json* _capture_target()
+    {
+        if (this->_capturing())
+        {
+            json* parent = m_capture_stack.back();
+            if (parent->is_array())
+            {
+                parent->push_back(nullptr);
+                return &parent->back();
+            }
+            return &(*parent)[m_keys[m_depth]];
+        }
+
+        if (m_depth == 1 && m_keys[1] != "ids" && (m_keys[1] != "equivalents" || m_ids != nullptr))
+        {
+            return &(*m_header)[m_keys[1]];
+        }
+
+        if (m_depth == 2 && m_ids != nullptr && this->_in_ids())
+        {
+            return &m_pending_id;
+        }
+
+        if (this->_in_id_entry() && m_keys[3] == "grid_point")
+        {
+            return &m_id.grid_point;
+        }
+
+        return nullptr;
+    }
+
+    bool _scalar(json val)
+    {
+        json* target = this->_capture_target();
+        if (target != nullptr)
+        {
+            *target = std::move(val);
+        }
+        return true;
+    }
+
+    bool _number(json val, double as_double)
+    {
+        if (!this->_capturing() && this->_in_id_entry())
+        {
+            const auto& key = m_keys[3];
+            if (key == "cleavage")
+            {
+                m_id.cleavage = as_double;
+                m_id.has_cleavage = true;
+                return true;
+            }
+            if (key == "orbit")
+            {
+                m_id.orbit = static_cast<int>(as_double);
+                return true;
+            }
+            if (m_value_keys.empty() ? BOOKKEEPING_KEYS.count(key) == 0 : m_value_keys.count(key) != 0)
+            {
+                m_id.values.emplace_back(key, as_double);
+                return true;
+            }
+        }
+        return this->_scalar(std::move(val));
+    }
+
+    bool _start_container(json empty)
+    {
+        json* target = this->_capture_target();
+        if (target != nullptr)
+        {
+            *target = std::move(empty);
+            if (!this->_capturing())
+            {
+                m_capture_depth = m_depth;
+            }
+            m_capture_stack.push_back(target);
+        }
+
+        if (m_depth == 2 && this->_in_ids())
+        {
+            m_id = ParsedId();
+        }
+
+        ++m_depth;
+        if (m_keys.size() <= m_depth)
+        {
+            m_keys.resize(m_depth + 1);
+        }
+        m_keys[m_depth].clear();
+        return true;
+    }
+
+    void _end_container()
+    {
+        --m_depth;
+        if (this->_capturing() && m_depth >= m_capture_depth)
+        {
+            m_capture_stack.pop_back();
+        }
+        return;
+    }
+};
+
+mush::json::input_format_t input_format(mush::RecordWriter::FORMAT format)
+{
+    if (format == mush::RecordWriter::FORMAT::CBOR)
+    {
+        return mush::json::input_format_t::cbor;
+    }
+    if (format == mush::RecordWriter::FORMAT::MSGPACK)
+    {
+        return mush::json::input_format_t::msgpack;
+    }
+    return mush::json::input_format_t::json;
+}
+} // namespace
+
+namespace mush
+{
+RecordWriter::RecordWriter(const fs::path& target, FORMAT format)
+    : m_target(target),
+      m_format(format),
+      m_stream(target, std::ios::binary | std::ios::trunc),
+      m_closed(false),
+      m_in_ids(false),
+      m_entry_count(0),
+      m_id_count(0)
+{
+    if (!m_stream)
+    {
+        throw std::runtime_error("Could not open " + target.string() + " to write the record.");
+    }
+    m_entry_count_pos = this->_open_map();
+}
+
+RecordWriter::~RecordWriter()
+{
+    try
+    {
+        this->close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void RecordWriter::write_entry(const std::string& key, const json& value)
+{
+    if (m_closed || m_in_ids)
+    {
+        throw std::runtime_error("Cannot write the entry '" + key + "' to " + m_target.string() + " right now.");
+    }
+    this->_write_pair(key, value, 0, m_entry_count == 0);
+    ++m_entry_count;
+    return;
+}
+
+void RecordWriter::begin_ids()
+{
+    if (m_closed || m_in_ids)
+    {
+        throw std::runtime_error("Cannot start writing ids to " + m_target.string() + " right now.");
+    }
+
+    // Only the key gets written, the value is the map that follows
+    if (m_format == FORMAT::JSON)
+    {
+        m_stream << (m_entry_count == 0 ? "\n" : ",\n") << std::string(::JSON_INDENT, ' ') << json("ids").dump() << ": ";
+    }
+    else if (m_format == FORMAT::CBOR)
+    {
+        this->_write_bytes(json::to_cbor(json("ids")));
+    }
+    else
+    {
+        this->_write_bytes(json::to_msgpack(json("ids")));
+    }
+
+    ++m_entry_count;
+    m_in_ids = true;
+    m_id_count = 0;
+    m_id_count_pos = this->_open_map();
+    return;
+}
+
+void RecordWriter::write_id(const std::string& id, const json& chunk)
+{
+    if (!m_in_ids)
+    {
+        throw std::runtime_error("Ids have to be written between begin_ids() and end_ids().");
+    }
+    this->_write_pair(id, chunk, 1, m_id_count == 0);
+    ++m_id_count;
+    return;
+}
+
+void RecordWriter::end_ids()
+{
+    if (!m_in_ids)
+    {
+        throw std::runtime_error("Cannot end ids in " + m_target.string() + " without beginning them first.");
+    }
+    this->_close_map(1, m_id_count, m_id_count_pos);
+    m_in_ids = false;
+    return;
+}
+
+void RecordWriter::close()
+{
+    if (m_closed)
+    {
+        return;
+    }
+
+    if (m_in_ids)
+    {
+        this->end_ids();
+    }
+
+    this->_close_map(0, m_entry_count, m_entry_count_pos);
+    m_stream.close();
+    m_closed = true;
+    return;
+}
+
+void RecordWriter::_write_pair(const std::string& key, const json& value, int depth, bool first)
+{
+    if (m_format == FORMAT::JSON)
+    {
+        m_stream << (first ? "\n" : ",\n") << std::string(::JSON_INDENT * (depth + 1), ' ') << json(key).dump() << ": "
+                 << ::dump_indented(value, depth + 1);
+    }
+
+    else if (m_format == FORMAT::CBOR)
+    {
+        this->_write_bytes(json::to_cbor(json(key)));
+        this->_write_bytes(json::to_cbor(value));
+    }
+
+    else
+    {
+        this->_write_bytes(json::to_msgpack(json(key)));
+        this->_write_bytes(json::to_msgpack(value));
+    }
+    return;
+}
+
+std::streampos RecordWriter::_open_map()
+{
+    std::streampos count_pos;
+    if (m_format == FORMAT::JSON)
+    {
+        m_stream << "{";
+    }
+
+    else if (m_format == FORMAT::CBOR)
+    {
+        // Map of indefinite length, terminated by a break byte
+        m_stream.put(static_cast<char>(0xBF));
+    }
+
+    else
+    {
+        // map 32, followed by the big endian number of entries, which isn't known yet
+        m_stream.put(static_cast<char>(0xDF));
+        count_pos = m_stream.tellp();
+        this->_write_bytes({0, 0, 0, 0});
+    }
+    return count_pos;
+}
+
+void RecordWriter::_close_map(int depth, std::uint32_t count, std::streampos count_pos)
+{
+    if (m_format == FORMAT::JSON)
+    {
+        if (count > 0)
+        {
+            m_stream << "\n" << std::string(::JSON_INDENT * depth, ' ');
+        }
+        m_stream << "}";
+    }
+
+    else if (m_format == FORMAT::CBOR)
+    {
+        m_stream.put(static_cast<char>(0xFF));
+    }
+
+    else
+    {
+        std::streampos end_pos = m_stream.tellp();
+        m_stream.seekp(count_pos);
+        this->_write_bytes({static_cast<std::uint8_t>(count >> 24),
+                            static_cast<std::uint8_t>(count >> 16),
+                            static_cast<std::uint8_t>(count >> 8),
+                            static_cast<std::uint8_t>(count)});
+        m_stream.seekp(end_pos);
+    }
+
+    if (!m_stream)
+    {
+        throw std::runtime_error("Failed to write the record to " + m_target.string() + ".");
+    }
+    return;
+}
+
+void RecordWriter::_write_bytes(const std::vector<std::uint8_t>& bytes)
+{
+    m_stream.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return;
+}
+
+RecordWriter::FORMAT RecordWriter::format_from_extension(const fs::path& path)
+{
+    auto ext = path.extension();
+    if (ext == ".json")
+    {
+        return FORMAT::JSON;
+    }
+    if (ext == ".cbor")
+    {
+        return FORMAT::CBOR;
+    }
+    if (ext == ".msgpack")
+    {
+        return FORMAT::MSGPACK;
+    }
+    throw std::runtime_error("Unknown record format for " + path.string() + ". Use a .json, .cbor or .msgpack extension.");
+}
+
+std::string RecordWriter::extension(FORMAT format)
+{
+    switch (format)
+    {
+    case FORMAT::JSON:
+        return ".json";
+    case FORMAT::CBOR:
+        return ".cbor";
+    case FORMAT::MSGPACK:
+        return ".msgpack";
+    }
+    throw std::runtime_error("Unknown record format");
+}
+
+//*********************************************************************************//
+
+json load_record(const fs::path& record_path)
+{
+    auto format = RecordWriter::format_from_extension(record_path);
+    std::ifstream record_stream(record_path, std::ios::binary);
+    if (!record_stream)
+    {
+        throw std::runtime_error("Could not open the record " + record_path.string() + ".");
+    }
+
+    if (format == RecordWriter::FORMAT::JSON)
+    {
+        json j;
+        record_stream >> j;
+        return j;
+    }
+
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(record_stream)), std::istreambuf_iterator<char>());
+    if (format == RecordWriter::FORMAT::CBOR)
+    {
+        return json::from_cbor(bytes);
+    }
+    return json::from_msgpack(bytes);
+}
+
+json load_record(const fs::path& record_path, bool* complete)
+{
+    auto format = RecordWriter::format_from_extension(record_path);
+    std::ifstream record_stream(record_path, std::ios::binary);
+    if (!record_stream)
+    {
+        throw std::runtime_error("Could not open the record " + record_path.string() + ".");
+    }
+
+    json record = json::object();
+    json ids = json::object();
+    RecordSaxHandler handler({}, &record, [](ParsedId&&) {}, &ids);
+    *complete = json::sax_parse(record_stream, &handler, ::input_format(format));
+
+    record["ids"] = std::move(ids);
+    return record;
+}
+
+void write_record(const json& record, const fs::path& target)
+{
+    RecordWriter writer(target, RecordWriter::format_from_extension(target));
+    for (const auto& [key, value] : record.items())
+    {
+        if (key != "ids")
+        {
+            writer.write_entry(key, value);
+            continue;
+        }
+
+        writer.begin_ids();
+        for (const auto& [id, chunk] : value.items())
+        {
+            writer.write_id(id, chunk);
+        }
+        writer.end_ids();
+    }
+    writer.close();
+    return;
+}
+
+bool is_bookkeeping_key(const std::string& key) { return ::BOOKKEEPING_KEYS.count(key) != 0; }
+
+std::string content_hash(const std::string& contents)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (char c : contents)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+
+    std::stringstream hex_stream;
+    hex_stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex_stream.str();
+}
+
+//*********************************************************************************//
+
+RecordReader::RecordReader(const fs::path& record_path, const std::vector<std::string>& value_keys, bool tolerant)
+    : m_size(0), m_complete(true)
+{
+    auto format = RecordWriter::format_from_extension(record_path);
+    std::ifstream record_stream(record_path, std::ios::binary);
+    if (!record_stream)
+    {
+        throw std::runtime_error("Could not open the record " + record_path.string() + ".");
+    }
+
+    // Grid points of the representatives get resolved into indexes once everything has been read
+    std::vector<std::vector<std::pair<int, int>>> slice_representatives;
+
+    auto on_id = [&](ParsedId&& id) {
+        if (!id.has_cleavage || !id.grid_point.is_array() || id.grid_point.size() != 2)
+        {
+            throw std::runtime_error("Found an id without a cleavage or grid point in " + record_path.string() + ".");
+        }
+
+        int slice_ix = this->_slice_index(id.cleavage);
+        if (slice_ix < 0)
+        {
+            slice_ix = m_slices.size();
+            m_slices.emplace_back(id.cleavage, CleavageSlice());
+            slice_representatives.emplace_back();
+        }
+        auto* slice = &m_slices[slice_ix].second;
+        int id_ix = slice->a_indexes.size();
+
+        slice->a_indexes.push_back(id.grid_point[0]);
+        slice->b_indexes.push_back(id.grid_point[1]);
+        slice->representatives.push_back(-1);
+        slice->orbits.push_back(id.orbit);
+        slice_representatives[slice_ix].emplace_back(id.representative_a, id.representative_b);
+
+        for (const auto& [key, value] : id.values)
+        {
+            auto& key_values = slice->values[key];
+            key_values.resize(id_ix + 1, std::numeric_limits<double>::quiet_NaN());
+            key_values[id_ix] = value;
+        }
+
+        ++m_size;
+    };
+
+    RecordSaxHandler handler(value_keys, &m_header, on_id);
+    bool parsed = json::sax_parse(record_stream, &handler, ::input_format(format));
+    if (!parsed)
+    {
+        if (!tolerant)
+        {
+            throw std::runtime_error("Failed to read the record " + record_path.string() + ": " + handler.error_message);
+        }
+        m_complete = false;
+    }
+
+    for (int s = 0; s < m_slices.size(); ++s)
+    {
+        auto& slice = m_slices[s].second;
+        for (auto& [key, key_values] : slice.values)
+        {
+            key_values.resize(slice.a_indexes.size(), std::numeric_limits<double>::quiet_NaN());
+        }
+
+        std::map<std::pair<int, int>, int> grid_point_to_ix;
+        for (int i = 0; i < slice.a_indexes.size(); ++i)
+        {
+            grid_point_to_ix[std::make_pair(slice.a_indexes[i], slice.b_indexes[i])] = i;
+        }
+
+        for (int i = 0; i < slice.a_indexes.size(); ++i)
+        {
+            auto representative = grid_point_to_ix.find(slice_representatives[s][i]);
+            if (representative != grid_point_to_ix.end())
+            {
+                slice.representatives[i] = representative->second;
+            }
+        }
+    }
+}
+
+int RecordReader::_slice_index(double cleavage) const
+{
+    for (int s = 0; s < m_slices.size(); ++s)
+    {
+        if (almost_equal(m_slices[s].first, cleavage, 1e-8))
+        {
+            return s;
+        }
+    }
+    return -1;
+}
+
+const RecordReader::CleavageSlice* RecordReader::_find_slice(double cleavage) const
+{
+    int slice_ix = this->_slice_index(cleavage);
+    return slice_ix < 0 ? nullptr : &m_slices[slice_ix].second;
+}
+
+std::array<int, 2> RecordReader::grid_dims() const
+{
+    if (!m_header.contains("grid"))
+    {
+        throw std::runtime_error("The record doesn't specify the dimensions of the shift grid.");
+    }
+    return {m_header["grid"][0].get<int>(), m_header["grid"][1].get<int>()};
+}
+
+std::vector<double> RecordReader::cleavages() const
+{
+    std::vector<double> cleavages;
+    for (const auto& slice : m_slices)
+    {
+        cleavages.push_back(slice.first);
+    }
+    return cleavages;
+}
+
+std::vector<std::string> RecordReader::value_keys(double cleavage) const
+{
+    std::vector<std::string> keys;
+    const auto* slice = this->_find_slice(cleavage);
+    if (slice != nullptr)
+    {
+        for (const auto& key_values : slice->values)
+        {
+            keys.push_back(key_values.first);
+        }
+    }
+    return keys;
+}
+
+std::vector<InterPoint> RecordReader::unrolled_data(double cleavage, const std::string& value_key, bool allow_missing) const
+{
+    const auto* slice = this->_find_slice(cleavage);
+    if (slice == nullptr)
+    {
+        throw std::runtime_error("The record has no structures with cleavage " + std::to_string(cleavage) + ".");
+    }
+
+    auto key_values = slice->values.find(value_key);
+    if (key_values == slice->values.end())
+    {
+        throw std::runtime_error("The record has no values for '" + value_key + "' at cleavage " + std::to_string(cleavage) + ".");
+    }
+    const auto& values = key_values->second;
+
+    // Average of the known values of every orbit, for ids that neither have a value nor a representative with one
+    std::map<int, std::pair<double, int>> orbit_sums;
+    for (int i = 0; i < values.size(); ++i)
+    {
+        if (slice->orbits[i] >= 0 && !std::isnan(values[i]))
+        {
+            auto& [sum, count] = orbit_sums[slice->orbits[i]];
+            sum += values[i];
+            ++count;
+        }
+    }
+
+    auto [amax, bmax] = this->grid_dims();
+    std::vector<InterPoint> unrolled_data;
+    unrolled_data.reserve(allow_missing ? amax * bmax : values.size());
+    std::set<std::pair<int, int>> listed;
+    for (int i = 0; i < values.size(); ++i)
+    {
+        // Records made with --irreducible only need values for the representative of each orbit
+        double v = values[i];
+        if (std::isnan(v) && slice->representatives[i] >= 0)
+        {
+            v = values[slice->representatives[i]];
+        }
+
+        auto orbit_sum = orbit_sums.find(slice->orbits[i]);
+        if (std::isnan(v) && orbit_sum != orbit_sums.end())
+        {
+            v = orbit_sum->second.first / orbit_sum->second.second;
+        }
+
+        int a = slice->a_indexes[i];
+        int b = slice->b_indexes[i];
+        listed.emplace(a, b);
+        if (std::isnan(v) && !allow_missing)
+        {
+            throw std::runtime_error("Missing value for '" + value_key + "' at grid point " + std::to_string(a) + ", " +
+                                     std::to_string(b) + " (cleavage " + std::to_string(cleavage) + ").");
+        }
+
+        unrolled_data.emplace_back(static_cast<double>(a) / amax, static_cast<double>(b) / bmax, std::isnan(v) ? 0.0 : v);
+        unrolled_data.back().weight = std::isnan(v) ? 0.0 : 1.0;
+    }
+
+    if (allow_missing)
+    {
+        for (int a = 0; a < amax; ++a)
+        {
+            for (int b = 0; b < bmax; ++b)
+            {
+                if (listed.count(std::make_pair(a, b)) == 0)
+                {
+                    unrolled_data.emplace_back(static_cast<double>(a) / amax, static_cast<double>(b) / bmax, 0.0);
+                    unrolled_data.back().weight = 0.0;
+                }
+            }
+        }
+    }
+
+    return unrolled_data;
+}
+} // namespace mush
@@ -0,0 +1,186 @@
+#ifndef RECORD_HH
+#define RECORD_HH
+
+#include "./definitions.hpp"
+#include "./fourier.hpp"
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mush
+{
+/**
+ * Writes a record one entry at a time, so that the full document never has to
+ * be held in memory. The record is an object with a few small top level entries,
+ * and one large "ids" object that gets filled in as the structures are generated.
+ *
+ * The same layout can be written as indented JSON, CBOR or MessagePack.
+ * CBOR uses indefinite-length maps, and MessagePack uses 32 bit map sizes that
+ * get filled in once the map is closed, so the number of entries never has to
+ * be known up front.
+ *
+ * Entries are written in the order they are given, so the top level keys are not
+ * sorted the way nlohmann::json would sort them. Any reader treats the document the same.
+ */
+
+class RecordWriter
+{
+public:
+    enum class FORMAT
+    {
+        JSON,
+        CBOR,
+        MSGPACK
+    };
+
+    /// Opens the target file and starts the top level object
+    RecordWriter(const fs::path& target, FORMAT format);
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    /// Closes the document if that hasn't been done already
+    ~RecordWriter();
+
+    /// Write a single top level entry. Can't be called while the ids are being written.
+    void write_entry(const std::string& key, const json& value);
+
+    /// Start the "ids" object. Every call to write_id that follows adds an entry to it.
+    void begin_ids();
+
+    /// Add one entry to the "ids" object
+    void write_id(const std::string& id, const json& chunk);
+
+    /// Close the "ids" object, after which more top level entries can be written
+    void end_ids();
+
+    /// Close the top level object and the file. Nothing else can be written afterwards.
+    void close();
+
+    /// Record format that corresponds to the extension of the path (.json, .cbor or .msgpack)
+    static FORMAT format_from_extension(const fs::path& path);
+
+    /// Extension (with the leading dot) used for records of the given format
+    static std::string extension(FORMAT format);
+
+private:
+    fs::path m_target;
+    FORMAT m_format;
+    std::ofstream m_stream;
+
+    bool m_closed;
+    bool m_in_ids;
+
+    /// Number of entries written so far into the top level object, and into "ids"
+    std::uint32_t m_entry_count;
+    std::uint32_t m_id_count;
+
+    /// Location of the 32 bit size of the top level and "ids" maps (MessagePack only)
+    std::streampos m_entry_count_pos;
+    std::streampos m_id_count_pos;
+
+    /// Write the key and value of a map entry, where depth is the nesting level of the map
+    void _write_pair(const std::string& key, const json& value, int depth, bool first);
+
+    /// Start a map whose entries will follow, returns where its size is stored (MessagePack only)
+    std::streampos _open_map();
+
+    /// Terminate a map with the given number of entries, whose size was reserved at count_pos
+    void _close_map(int depth, std::uint32_t count, std::streampos count_pos);
+
+    void _write_bytes(const std::vector<std::uint8_t>& bytes);
+};
+
+/// Load a complete record written as JSON, CBOR or MessagePack, based on the file extension
+json load_record(const fs::path& record_path);
+
+/// Same as load_record, but a record that ends early is not an error. Only the ids that were read in full are kept,
+/// and complete is set to false if the record was cut short.
+json load_record(const fs::path& record_path, bool* complete);
+
+/// Write a record that's already in memory, with every top level entry in the order they appear in the object
+void write_record(const json& record, const fs::path& target);
+
+/// True if the entry of an id describes the structure (directory, grid point, ...) rather than holding a value
+bool is_bookkeeping_key(const std::string& key);
+
+/// 64 bit FNV-1a hash of the contents, as 16 hex digits. Stored in records to recognize files that were already written.
+std::string content_hash(const std::string& contents);
+
+/**
+ * Reads the values stored in a record made by cleave, shift or chain, in a single pass,
+ * without ever building the full document in memory. The ids are grouped by cleavage
+ * as they're read, so values for any key and cleavage can be pulled out afterwards
+ * without parsing again.
+ *
+ * The top level entries other than "ids" and "equivalents" are small, and are kept
+ * as a regular json object in header().
+ *
+ * In tolerant mode, a record that ends early (e.g. the run that was writing it got
+ * killed) is not an error. Every id that was read in full is kept, and complete()
+ * returns false.
+ */
+
+class RecordReader
+{
+public:
+    /// Read the record, keeping the numerical values of the given keys for every id.
+    /// If no keys are given, every numerical value that isn't part of the bookkeeping is kept.
+    RecordReader(const fs::path& record_path, const std::vector<std::string>& value_keys = {}, bool tolerant = false);
+
+    /// Top level entries such as "grid", "cleavages" and "shift_units"
+    const json& header() const { return m_header; }
+
+    /// Grid dimensions the shifts were made on
+    std::array<int, 2> grid_dims() const;
+
+    /// Every cleavage value found among the ids, in the order they first appeared
+    std::vector<double> cleavages() const;
+
+    /// Every value key found for the ids at the given cleavage
+    std::vector<std::string> value_keys(double cleavage) const;
+
+    /// Values of the key for every grid point at the given cleavage, in fractional coordinates.
+    /// Ids without the value take it from their representative, if they have one, or else from
+    /// the average of the ids in the same orbit that do have it.
+    /// Grid points that still don't have a value are an error, unless allow_missing is set. They
+    /// are then included with a weight of zero, along with any grid point the record doesn't list,
+    /// so the data can be fitted with Interpolator::fit_least_squares.
+    std::vector<InterPoint> unrolled_data(double cleavage, const std::string& value_key, bool allow_missing = false) const;
+
+    /// Number of ids that were read
+    int size() const { return m_size; }
+
+    /// False if the record ended before the document was closed (only possible in tolerant mode)
+    bool complete() const { return m_complete; }
+
+    /// Values for every id that shares the same cleavage, stored as parallel arrays
+    struct CleavageSlice
+    {
+        std::vector<int> a_indexes;
+        std::vector<int> b_indexes;
+        /// For each id, index of its representative within the slice, or -1 if it doesn't have one
+        std::vector<int> representatives;
+        /// For each id, label of the orbit it belongs to, or -1 if the record doesn't say
+        std::vector<int> orbits;
+        /// Value of each id for every key, NaN where the id doesn't have it
+        std::map<std::string, std::vector<double>> values;
+    };
+
+private:
+    json m_header;
+    std::vector<std::pair<double, CleavageSlice>> m_slices;
+    int m_size;
+    bool m_complete;
+
+    /// Index of the slice with the given cleavage, or -1 if there isn't one
+    int _slice_index(double cleavage) const;
+
+    /// Slice with the given cleavage, returns nullptr if there isn't one
+    const CleavageSlice* _find_slice(double cleavage) const;
+};
+} // namespace mush
+
+#endif
@@ -1,23 +1,138 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <map>
+#include <set>
+#include <stdexcept>
 #include <unordered_map>
 #include "./shifter.hpp"
+#include "./profile.hpp"
 #include "casmutils/xtal/lattice.hpp"
+#include "casmutils/xtal/symmetry.hpp"
+
+namespace
+{
+/// Tolerance used to find the factor group of the slab
+const double SYMMETRY_TOL = 1e-5;
+} // namespace
 
 namespace mush
 {
-Shifter::Shifter(const Structure& slab, int a_max, int b_max): grid_dims{a_max,b_max}
+Shifter::Shifter(const Structure& slab, int a_max, int b_max, bool validate_equivalence): slab(slab), grid_dims{a_max,b_max}
 {
+    ScopedTimer timer("shifter");
     const cu::xtal::Lattice& slab_lat = slab.lattice();
-    auto [shift_vectors, _shift_records] = make_uniform_in_plane_shift_vectors(slab_lat, a_max, b_max);
+    auto [_shift_vectors, _shift_records] = make_uniform_in_plane_shift_vectors(slab_lat, a_max, b_max);
+    std::swap(_shift_vectors,this->shift_vectors);
     std::swap(_shift_records,this->shift_records);  //Discard temporary variable _shift_records
     auto [wg_shift_vectors, wg_shift_records] = make_uniform_in_plane_wigner_seitz_shift_vectors(slab_lat, a_max, b_max);
+    std::swap(wg_shift_vectors,this->wigner_seitz_shift_vectors);
 
     assert(shift_records==wg_shift_records);
 
-    shifted_structures=make_shifted_structures(slab,shift_vectors);
-    wigner_seitz_shifted_structures=make_shifted_structures(slab,wg_shift_vectors);
+    equivalence_map=make_shift_orbits(slab, shift_records, a_max, b_max);
+
+    if(validate_equivalence)
+    {
+        ScopedTimer validate_timer("validate_symmetry");
+        //Comparing the structures requires all of them at once, but they're
+        //thrown away as soon as the check is done
+        auto compared_map=categorize_equivalently_shifted_structures(make_shifted_structures(slab,shift_vectors));
+        for(auto& equivalents : compared_map)
+        {
+            std::sort(equivalents.begin(),equivalents.end());
+        }
+
+        if(compared_map!=equivalence_map)
+        {
+            throw std::runtime_error("Equivalent shifts found through the factor group of the slab don't match the ones found by comparing shifted structures.");
+        }
+    }
+}
+
+Shifter::Structure Shifter::shifted_structure(int i) const
+{
+    ScopedTimer timer("shift_structure");
+    return make_shifted_structures(slab,{shift_vectors.at(i)}).front();
+}
+
+Shifter::Structure Shifter::wigner_seitz_shifted_structure(int i) const
+{
+    return make_shifted_structures(slab,{wigner_seitz_shift_vectors.at(i)}).front();
+}
+
+std::vector<Eigen::Matrix2i> make_shift_group(const cu::xtal::Structure& slab)
+{
+    const Eigen::Matrix3d& lat_mat=slab.lattice().column_vector_matrix();
+    Eigen::Matrix3d inv_lat_mat=lat_mat.inverse();
+
+    std::vector<Eigen::Matrix2i> shift_group;
+    for(const auto& op : cu::xtal::make_factor_group(slab, ::SYMMETRY_TOL))
+    {
+        Eigen::Matrix3d frac_op=inv_lat_mat*op.matrix*lat_mat;
+        Eigen::Matrix3d rounded=frac_op.array().round().matrix();
+        if((frac_op-rounded).cwiseAbs().maxCoeff()>::SYMMETRY_TOL)
+        {
+            throw std::runtime_error("Factor group operation of the slab is not an integer transformation of its lattice.");
+        }
+
+        //The ab-plane has to stay in place, the c vector may flip or pick up in-plane components
+        if(rounded(2,0)!=0 || rounded(2,1)!=0 || std::abs(rounded(2,2))!=1)
+        {
+            continue;
+        }
+
+        Eigen::Matrix2i shift_op=(rounded(2,2)*rounded.topLeftCorner<2,2>()).cast<int>();
+
+        //Operations that only differ by their translation act the same way on the shifts
+        if(std::find(shift_group.begin(),shift_group.end(),shift_op)==shift_group.end())
+        {
+            shift_group.push_back(shift_op);
+        }
+    }
+
+    return shift_group;
+}
+
+std::vector<std::vector<std::size_t>>
+make_shift_orbits(const cu::xtal::Structure& slab, const std::vector<ShiftRecord>& shift_records, int a_max, int b_max)
+{
+    ScopedTimer timer("shift_orbits");
+    auto shift_group=make_shift_group(slab);
+
+    std::map<std::pair<long,long>,std::size_t> grid_to_record_ix;
+    for(std::size_t i=0; i<shift_records.size(); ++i)
+    {
+        grid_to_record_ix[std::make_pair(static_cast<long>(shift_records[i].a),static_cast<long>(shift_records[i].b))]=i;
+    }
+
+    std::vector<std::vector<std::size_t>> orbits(shift_records.size());
+    for(std::size_t i=0; i<shift_records.size(); ++i)
+    {
+        long a=shift_records[i].a;
+        long b=shift_records[i].b;
+
+        std::set<std::size_t> orbit{i};
+        for(const auto& shift_op : shift_group)
+        {
+            //The shift (u,v)=(a/a_max,b/b_max) maps to sign*M*(u,v). Unless the operation maps the whole grid
+            //onto itself (e.g. rotations of a hexagonal slab on a non-square grid), only some grid points land
+            //on another grid point, and only those are equivalent through it.
+            long a_numerator=static_cast<long>(shift_op(0,1))*b*a_max;
+            long b_numerator=static_cast<long>(shift_op(1,0))*a*b_max;
+            if(a_numerator%b_max!=0 || b_numerator%a_max!=0)
+            {
+                continue;
+            }
+
+            long mapped_a=shift_op(0,0)*a+a_numerator/b_max;
+            long mapped_b=b_numerator/a_max+shift_op(1,1)*b;
+            orbit.insert(grid_to_record_ix.at(std::make_pair(wrap_index(mapped_a,a_max),wrap_index(mapped_b,b_max))));
+        }
+        orbits[i].assign(orbit.begin(),orbit.end());
+    }
 
-    equivalence_map=categorize_equivalently_shifted_structures(shifted_structures);
+    return orbits;
 }
 
 } // namespace mush
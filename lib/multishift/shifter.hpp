@@ -12,17 +12,33 @@ namespace mush
 {
     /**
      * Given a slab and the density along the a and b
-     * vectors, generate all shift structures, and a record
-     * of which ones are symmetrically equivalent.
+     * vectors, generate the shift vectors for every grid
+     * point, and a record of which ones are symmetrically
+     * equivalent. Only the slab and the shift vectors are
+     * kept around, the shifted structures are constructed
+     * one at a time, whenever they're asked for.
      */
 
     struct Shifter
     {
         using Structure=cu::xtal::Structure;
 
-        Shifter(const Structure& slab, int a_max, int b_max);
-        std::vector<Structure> shifted_structures;
-        std::vector<Structure> wigner_seitz_shifted_structures;
+        /// Equivalent shifts are found by applying the factor group of the slab to the grid indexes.
+        /// If validate_equivalence is set, the result is checked against comparing every shifted
+        /// structure to every other, which is slow, and an exception is thrown if they disagree.
+        Shifter(const Structure& slab, int a_max, int b_max, bool validate_equivalence = false);
+
+        /// Structure for the grid point at index i, with the top of the slab shifted
+        Structure shifted_structure(int i) const;
+        /// Same as shifted_structure, but with the shift vector brought into the Wigner-Seitz cell
+        Structure wigner_seitz_shifted_structure(int i) const;
+
+        /// Unshifted slab that every structure is created from
+        Structure slab;
+        /// Cartesian shift vector applied to each structure
+        std::vector<Eigen::Vector3d> shift_vectors;
+        /// Same shifts as shift_vectors, but within the Wigner-Seitz cell of the slab
+        std::vector<Eigen::Vector3d> wigner_seitz_shift_vectors;
         /// Minimal information to determine what shift has been applied to which structure 
         std::vector<ShiftRecord> shift_records; 
         /// For each index i, shows the indexes of the structures that are equivalent to i.
@@ -31,13 +47,36 @@ namespace mush
 
         int size() const
         {
-            assert(shifted_structures.size()==wigner_seitz_shifted_structures.size());
-            assert(shifted_structures.size()==shift_records.size());
+            assert(shift_vectors.size()==wigner_seitz_shift_vectors.size());
+            assert(shift_vectors.size()==shift_records.size());
             assert(shift_records.size()==equivalence_map.size());
             assert(shift_records.size()==grid_dims[0]*grid_dims[1]);
-            return shifted_structures.size();
+            return shift_records.size();
         }
     };
+
+    /**
+     * Symmetry operations of the slab, as they act on the fractional shift (u,v). Only the operations
+     * that keep the ab-plane in place count, and their action is the in-plane block of their fractional
+     * matrix, with the sign flipped if the c-axis gets inverted. Repeats are left out, so every matrix is
+     * only listed once. The gamma surface of the slab has the same value at every shift that these map onto
+     * each other. None of this depends on a shift grid, which the operations don't have to map onto itself.
+     */
+
+    std::vector<Eigen::Matrix2i> make_shift_group(const cu::xtal::Structure& slab);
+
+    /**
+     * Groups the grid points of the shift grid into orbits, using the operations of make_shift_group.
+     * Every operation is applied to the integer (a,b) grid indexes directly, so none of the shifted
+     * structures need to be constructed. Grid points that an operation maps off the grid aren't
+     * equivalent to anything through it, but the rest of the grid still is.
+     *
+     * The result has the same layout as the equivalence_map of the Shifter: for each index i
+     * of the shift records, the sorted indexes of every record in the same orbit as i.
+     */
+
+    std::vector<std::vector<std::size_t>>
+    make_shift_orbits(const cu::xtal::Structure& slab, const std::vector<ShiftRecord>& shift_records, int a_max, int b_max);
 }
 
 #endif
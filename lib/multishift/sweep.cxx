@@ -0,0 +1,31 @@
+#include "./sweep.hpp"
+#include <stdexcept>
+
+namespace mush
+{
+std::vector<double> make_sweep_angles(const std::vector<double>& sweep)
+{
+    if (sweep.size() != 3 || sweep[2] <= 0 || sweep[1] < sweep[0])
+    {
+        throw std::runtime_error("A sweep needs a start, a stop that isn't smaller than the start, and a positive step.");
+    }
+
+    // Computed from the start each time, so rounding errors don't pile up
+    int steps = std::floor((sweep[1] - sweep[0]) / sweep[2] + 1e-8);
+    std::vector<double> angles;
+    for (int i = 0; i <= steps; ++i)
+    {
+        angles.push_back(sweep[0] + i * sweep[2]);
+    }
+    return angles;
+}
+
+double deformation_error(const MoireLatticeReport& report) { return (report.approximation_deformation - Eigen::Matrix3d::Identity()).norm(); }
+
+int count_lattice_sites(const MoireLatticeReport& report, const Lattice& unit_lattice)
+{
+    double moire_volume = std::abs(report.approximate_moire_lattice.column_vector_matrix().determinant());
+    double unit_volume = std::abs(unit_lattice.column_vector_matrix().determinant());
+    return 2 * std::lround(moire_volume / unit_volume);
+}
+} // namespace mush
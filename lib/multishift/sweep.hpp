@@ -0,0 +1,101 @@
+#ifndef SWEEP_HH
+#define SWEEP_HH
+
+#include "./definitions.hpp"
+#include <algorithm>
+#include <casmutils/mush/twist.hpp>
+#include <casmutils/xtal/lattice.hpp>
+#include <cmath>
+#include <vector>
+
+namespace mush
+{
+/// Every angle from start to stop (inclusive) in steps of the given size, where the sweep is {start, stop, step}.
+/// The stop is included even if rounding leaves it a hair beyond the last step.
+std::vector<double> make_sweep_angles(const std::vector<double>& sweep);
+
+/// Distance of the deformation that makes the supercell of the report commensurate from the identity
+double deformation_error(const MoireLatticeReport& report);
+
+/// Number of lattice sites in the bilayer of the Moire supercell of the report, where the unit lattice
+/// is the one of a single layer
+int count_lattice_sites(const MoireLatticeReport& report, const Lattice& unit_lattice);
+
+/**
+ * Search space of the Moire supercells, carried from one twist angle to the next during a sweep.
+ * Neighboring angles need supercells of similar size, so rather than searching up to the full
+ * number of lattice sites for every angle, the search starts from the size of the supercells
+ * that were chosen for the previous angle, which can be smaller or larger than what the angle
+ * before that needed.
+ *
+ * The search stops early only once both layers have a supercell within the error tolerance of
+ * being exact. best_smallest only prefers a larger supercell if it's better by more than the
+ * tolerance, so no larger supercell can replace those. Otherwise the search space keeps doubling
+ * up to max_lattice_sites. The chosen supercells are therefore always the same as those of a
+ * search over the full max_lattice_sites, whatever angle came before; the warm start only saves
+ * time for angles that have a commensurate supercell smaller than max_lattice_sites.
+ *
+ * Works with both MoireApproximator and MoireStructureApproximator.
+ */
+
+template <typename ApproximatorType>
+class SweepBudget
+{
+public:
+    using ZONE = MoireLatticeReport::ZONE;
+    using LATTICE = MoireLatticeReport::LATTICE;
+
+    SweepBudget(const Lattice& unit_lattice, int max_lattice_sites, double error_tol, ZONE bz)
+        : m_unit_lattice(unit_lattice), m_max_lattice_sites(max_lattice_sites), m_error_tol(error_tol), m_bz(bz), m_previous_sites(0)
+    {
+    }
+
+    /// Expand the search space of the approximator for the next angle of the sweep, and remember
+    /// the size of the supercells it ends up choosing. Returns the number of lattice sites searched.
+    int expand(ApproximatorType* moirenator)
+    {
+        int minimum_budget = moirenator->minimum_lattice_sites(m_bz);
+        int full_budget = std::max(m_max_lattice_sites, minimum_budget);
+        int budget = std::min(std::max(m_previous_sites, minimum_budget), full_budget);
+
+        moirenator->expand(budget);
+        while (budget < full_budget && !this->_is_final(*moirenator))
+        {
+            budget = std::min(2 * budget, full_budget);
+            moirenator->expand(budget);
+        }
+
+        m_previous_sites = 0;
+        for (auto lat : {LATTICE::ALIGNED, LATTICE::ROTATED})
+        {
+            m_previous_sites = std::max(m_previous_sites, count_lattice_sites(moirenator->best_smallest(m_bz, lat, m_error_tol), m_unit_lattice));
+        }
+        return budget;
+    }
+
+private:
+    Lattice m_unit_lattice;
+    int m_max_lattice_sites;
+    double m_error_tol;
+    ZONE m_bz;
+
+    /// Lattice sites of the largest supercell chosen for the previous angle, zero before the first one
+    int m_previous_sites;
+
+    /// True if the supercells chosen for both layers are within the error tolerance of being exact,
+    /// in which case searching larger supercells can't change them
+    bool _is_final(const ApproximatorType& moirenator) const
+    {
+        for (auto lat : {LATTICE::ALIGNED, LATTICE::ROTATED})
+        {
+            if (deformation_error(moirenator.best_smallest(m_bz, lat, m_error_tol)) >= m_error_tol)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+} // namespace mush
+
+#endif
@@ -0,0 +1,167 @@
+#include "./adapt.hpp"
+#include "./chain.hpp"
+#include "./common_options.hpp"
+#include "./misc.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <multishift/adapt.hpp>
+#include <multishift/chain.hpp>
+#include <multishift/evaluator.hpp>
+#include <multishift/fourier.hpp>
+#include <multishift/profile.hpp>
+#include <multishift/record.hpp>
+#include <multishift/shifter.hpp>
+#include <stdexcept>
+
+namespace cu = casmutils;
+
+void setup_subcommand_adapt(CLI::App& app)
+{
+    auto data_path_ptr = std::make_shared<mush::fs::path>();
+    auto slab_path_ptr = std::make_shared<mush::fs::path>();
+    auto value_key_ptr = std::make_shared<std::string>();
+    auto cleavage_ptr = std::make_shared<double>();
+    auto factor_ptr = std::make_shared<int>();
+    auto budget_ptr = std::make_shared<int>();
+    auto output_path_ptr = std::make_shared<mush::fs::path>();
+    auto threads_ptr = std::make_shared<int>();
+
+    CLI::App* adapt_sub = app.add_subcommand("adapt", "Refine a gamma surface only where the current fit is least reliable.");
+
+    adapt_sub
+        ->add_option("-d,--data",
+                     *data_path_ptr,
+                     "Amended 'record.json' like file from shift or chain, with computed values for the structure ids. Grid points without a value are fitted by least squares.")
+        ->required();
+    adapt_sub->add_option("-k,--key", *value_key_ptr, "Key of the values that get fitted to find where to refine.")->required();
+    adapt_sub->add_option("-c,--cleavage", *cleavage_ptr, "Cleavage value of the surface to refine.")->default_val(0.0);
+    adapt_sub->add_option("-f,--factor", *factor_ptr, "How many times finer the new grid is along a and b. The current grid is part of the new one.")
+        ->default_val(2)
+        ->check(CLI::PositiveNumber);
+    adapt_sub->add_option("-n,--budget", *budget_ptr, "Number of new symmetrically distinct structures to create.")->required()->check(CLI::PositiveNumber);
+    adapt_sub->add_option("-i,--input", *slab_path_ptr, "Slab the record was made from. Defaults to the slab.vasp next to the record.");
+    populate_subcommand_output_option(adapt_sub, output_path_ptr.get());
+    adapt_sub->add_option("-j,--threads", *threads_ptr, "Number of threads used to create and write structures. Use 0 for all available cores.")
+        ->default_val(1);
+
+    adapt_sub->callback([=]() {
+        run_subcommand_adapt(*data_path_ptr,
+                             *slab_path_ptr,
+                             *value_key_ptr,
+                             *cleavage_ptr,
+                             *factor_ptr,
+                             *budget_ptr,
+                             *output_path_ptr,
+                             *threads_ptr,
+                             std::cout);
+    });
+}
+
+void run_subcommand_adapt(const mush::fs::path& data_path,
+                          const mush::fs::path& slab_path,
+                          const std::string& value_key,
+                          double cleavage,
+                          int factor,
+                          int budget,
+                          const mush::fs::path& output_dir,
+                          int threads,
+                          std::ostream& log)
+{
+    auto [record, recorded_cleavage, ipolator] = mush::fit_record(data_path, value_key, cleavage, log);
+    mush::SurfaceEvaluator surface(ipolator);
+
+    auto slab_source = slab_path.empty() ? data_path.parent_path() / "slab.vasp" : slab_path;
+    log << "Reading slab from " << slab_source << "...\n";
+    auto slab = cu::xtal::Structure::from_poscar(slab_source);
+
+    auto [a_dim, b_dim] = record.grid_dims();
+    log << "Refine " << a_dim << "x" << b_dim << " grid to " << factor * a_dim << "x" << factor * b_dim << "...\n";
+    mush::Shifter shifter(slab, factor * a_dim, factor * b_dim);
+
+    //Shifts of the record have to be the same as the ones of the slab, or the fit is of a different surface
+    auto fine_units = mush::make_shift_units(shifter);
+    const auto& coarse_units = record.header()["shift_units"];
+    for (int v = 0; v < 2; ++v)
+    {
+        for (int x = 0; x < 2; ++x)
+        {
+            if (std::abs(factor * fine_units[v][x] - coarse_units[v][x].get<double>()) > 1e-6)
+            {
+                throw std::runtime_error("The shifts of " + slab_source.string() + " don't match the ones in " + data_path.string() + ".");
+            }
+        }
+    }
+
+    auto scores = mush::score_refinement(surface, shifter, factor);
+    auto selected = mush::select_refinement(scores, shifter, factor, budget);
+
+    //Everything a uniform refinement would have to compute that isn't known yet
+    int unknown_orbits = 0;
+    for (int i = 0; i < shifter.size(); ++i)
+    {
+        const auto& orbit = shifter.equivalence_map[i];
+        bool known = std::any_of(orbit.begin(), orbit.end(), [&](int e) {
+            return shifter.shift_records[e].a % factor == 0 && shifter.shift_records[e].b % factor == 0;
+        });
+        unknown_orbits += orbit.front() == i && !known;
+    }
+    log << "Create " << selected.size() << " of the " << unknown_orbits << " new structures a uniform refinement would need...\n";
+
+    mush::json adapt;
+    adapt["data"] = data_path;
+    adapt["key"] = value_key;
+    adapt["cleavage"] = recorded_cleavage;
+    adapt["factor"] = factor;
+    adapt["coarse_grid"] = {a_dim, b_dim};
+    adapt["grid"] = shifter.grid_dims;
+    adapt["budget"] = budget;
+    adapt["unknown_orbits"] = unknown_orbits;
+    adapt["selected"] = mush::json::array();
+    for (int i : selected)
+    {
+        const auto& score = scores[i];
+        mush::json point;
+        point["id"] = mush::make_multirecord(recorded_cleavage, shifter, i).id();
+        point["grid_point"] = {shifter.shift_records[i].a, shifter.shift_records[i].b};
+        point["orbit_size"] = shifter.equivalence_map[i].size();
+        point["predicted"] = score.predicted;
+        point["curvature"] = score.curvature;
+        point["distance"] = score.distance;
+        point["estimated_error"] = score.estimated_error;
+        adapt["selected"].push_back(point);
+    }
+
+    mush::cautious_create_directory(output_dir);
+
+    //The points of the current grid go into the new record as well, pointing to their old structures and
+    //carrying their values, so the next round can fit everything that's known from the new record alone
+    mush::ChainSettings settings;
+    settings.threads = threads;
+    settings.irreducible = true;
+    settings.existing = make_reused_entries(data_path, shifter, {recorded_cleavage}, output_dir, log);
+    settings.selection = selected;
+    for (int i = 0; i < shifter.size(); ++i)
+    {
+        if (settings.existing.contains(mush::make_multirecord(recorded_cleavage, shifter, i).id()))
+        {
+            settings.selection.push_back(i);
+        }
+    }
+    adapt["reused"] = settings.existing.size();
+
+    log << "Stream record to " << output_dir / "record.json" << "...\n";
+    mush::RecordSink record_sink(output_dir / "record.json", mush::RecordWriter::FORMAT::JSON);
+    mush::DirectorySink directory_sink(output_dir, mush::json::object(), &log);
+    mush::enumerate_chain(shifter, {recorded_cleavage}, mush::SUBCOMMAND::CHAIN, settings, {&record_sink, &directory_sink});
+
+    log << "Save refinement to " << output_dir / "adapt.json" << "...\n";
+    mush::write_json(adapt, output_dir / "adapt.json");
+
+    if (mush::Profiler::instance().enabled())
+    {
+        log << "Save profile to " << output_dir / "profile.json" << "...\n";
+        mush::Profiler::instance().write_report(output_dir / "profile.json");
+    }
+    return;
+}
@@ -0,0 +1,23 @@
+#ifndef ADAPT_SUBCOMMAND_HH
+#define ADAPT_SUBCOMMAND_HH
+
+#include <CLI/CLI.hpp>
+#include <multishift/definitions.hpp>
+#include <ostream>
+#include <string>
+
+void setup_subcommand_adapt(CLI::App& app);
+
+//Fit the values of a record made by shift or chain, and create structures on a grid that is factor
+//times finer, only for the budget orbits where the fit is least trustworthy
+void run_subcommand_adapt(const mush::fs::path& data_path,
+                          const mush::fs::path& slab_path,
+                          const std::string& value_key,
+                          double cleavage,
+                          int factor,
+                          int budget,
+                          const mush::fs::path& output_dir,
+                          int threads,
+                          std::ostream& log);
+
+#endif
@@ -3,6 +3,7 @@
 #include "casmutils/xtal/structure.hpp"
 #include "casmutils/xtal/structure_tools.hpp"
 #include <multishift/definitions.hpp>
+#include <multishift/profile.hpp>
 #include <casmutils/mush/twist.hpp>
 #include <casmutils/mush/slab.hpp>
 #include <memory>
@@ -26,14 +27,21 @@ void setup_subcommand_align(CLI::App& app)
 
 void run_subcommand_align(const mush::fs::path& input_path, const mush::fs::path& output_path, bool prismatic, std::ostream& log)
 {
+    mush::ScopedTimer read_timer("read_structure");
     auto struc=mush::cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
+
+    mush::ScopedTimer align_timer("align");
     mush::make_aligned(&struc);
 
     if(prismatic)
     {
         struc.set_lattice(mush::make_prismatic_lattice(struc.lattice()),mush::cu::xtal::CART);
     }
+    align_timer.stop();
 
+    mush::ScopedTimer write_timer("write_structure");
     mush::cu::xtal::write_poscar(struc,output_path);
+    write_timer.stop();
     return;
 }
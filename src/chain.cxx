@@ -1,7 +1,12 @@
 #include "./chain.hpp"
 #include "./common_options.hpp"
 #include "./misc.hpp"
+#include <multishift/parallel.hpp>
 #include <multishift/shifter.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
 #include <nlohmann/json.hpp>
 
 namespace cu = casmutils;
@@ -12,6 +17,7 @@ void setup_subcommand_chain(CLI::App& app)
     auto output_path_ptr = std::make_shared<mush::fs::path>();
     auto celavages_ptr = std::make_shared<std::vector<double>>();
     auto grid_dims_ptr = std::make_shared<std::vector<int>>();
+    auto options_ptr = std::make_shared<ChainOptions>();
 
     CLI::App* chain_sub = app.add_subcommand("chain", "Combine cleave and shift commands for gamma surface calculations.");
 
@@ -27,67 +33,307 @@ void setup_subcommand_chain(CLI::App& app)
         ->expected(2)
         ->required();
 
-    chain_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::CHAIN>(*input_path_ptr, *output_path_ptr, *celavages_ptr, *grid_dims_ptr, std::cout); });
+    populate_subcommand_chain_options(chain_sub, options_ptr.get());
+
+    chain_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::CHAIN>(*input_path_ptr, *output_path_ptr, *celavages_ptr, *grid_dims_ptr, *options_ptr, std::cout); });
+}
+
+void populate_subcommand_chain_options(CLI::App* sub, ChainOptions* options)
+{
+    sub->add_option("-j,--threads",
+                    options->threads,
+                    "Number of threads used to create and write structures. Use 0 for all available cores. The record is the "
+                    "same regardless of the number of threads.")
+        ->default_val(1);
+    sub->add_flag("--validate-symmetry",
+                  options->validate_equivalence,
+                  "Check the equivalent shifts found with the factor group of the slab against a direct comparison of every "
+                  "shifted structure. Stops with an error if they disagree. Slow for large grids.");
+    sub->add_flag("--irreducible",
+                  options->irreducible,
+                  "Only write one structure for each orbit of equivalent shifts. Every id is still recorded, pointing to the "
+                  "directory of its representative.");
+    sub->add_option("--record-format",
+                    options->record_format,
+                    "Format of the record that describes every structure. Binary formats are smaller and faster to load. Defaults to "
+                    "json, or when resuming, the format of the record that is already there.")
+        ->check(CLI::IsMember({"json", "cbor", "msgpack"}, CLI::ignore_case));
+    auto archive_opt = sub->add_flag("--archive",
+                                     options->archive,
+                                     "Pack every structure and the record into a single archive file (given by --output) instead of "
+                                     "writing a directory tree. Use the extract subcommand to unpack it.");
+    sub->add_flag("--compress", options->compress, "Compress the structures in the archive.")->needs(archive_opt);
+    populate_subcommand_plan_option(sub, &options->plan);
+    sub->add_flag("--resume,--extend",
+                  options->resume,
+                  "Continue in an existing output directory. Structures that are already on disk and match the hashes in its "
+                  "record are kept, missing ones and new cleavage values are created, and everything is merged into the record.")
+        ->excludes(archive_opt);
+    sub->add_option("--reuse",
+                    options->reuse,
+                    "Record of an earlier run with the same slab, on a grid that the new one refines (e.g. 6x6 for a 12x12 grid). "
+                    "Shifts that land on its grid point to its structures (and carry over its values) instead of being written again.")
+        ->check(CLI::ExistingFile)
+        ->excludes(archive_opt);
+}
+
+mush::fs::path previous_record_path(const mush::fs::path& record_path)
+{
+    return record_path.parent_path() / ("previous_" + record_path.filename().string());
 }
 
-mush::MultiRecord make_multirecord(const double cleave, const mush::Shifter& shifter, int ix)
+mush::RecordWriter::FORMAT resolve_record_format(const mush::fs::path& output_dir, const std::string& requested, bool resuming)
 {
-    auto make_partial = [](double _cleave, const mush::Shifter& _shifter, int _ix) {
-        mush::MultiRecord record;
-        record.cleavage = _cleave;
-        record.a_index = _shifter.shift_records[_ix].a;
-        record.b_index = _shifter.shift_records[_ix].b;
-        return record;
-    };
-
-    auto record = make_partial(cleave, shifter, ix);
-    for (int eqx : shifter.equivalence_map[ix])
+    std::vector<std::string> found;
+    if (resuming)
     {
-        record.equivalent_structures.emplace_back(make_partial(cleave, shifter, eqx).id());
+        for (std::string format : {"json", "cbor", "msgpack"})
+        {
+            auto record_path = output_dir / ("record." + format);
+            if (mush::fs::exists(record_path) || mush::fs::exists(previous_record_path(record_path)))
+            {
+                found.push_back(format);
+            }
+        }
     }
 
-    return record;
+    if (found.size() > 1)
+    {
+        throw std::runtime_error("Cannot resume, " + output_dir.string() + " has records in more than one format. Remove the ones that don't belong to the run.");
+    }
+    if (!found.empty() && !requested.empty() && requested != found.front())
+    {
+        throw std::runtime_error("Cannot resume with --record-format " + requested + ", the previous run in " + output_dir.string() + " wrote a " +
+                                 found.front() + " record.");
+    }
+
+    auto format = !found.empty() ? found.front() : requested.empty() ? "json" : requested;
+    return mush::RecordWriter::format_from_extension("record." + format);
 }
 
-template<>
-mush::fs::path mush::make_target_directory<mush::SUBCOMMAND::CHAIN>(const mush::MultiRecord& record)
+mush::json load_resumable_record(const mush::fs::path& record_path, std::ostream& log)
 {
-    return mush::fs::path(mush::make_shift_dirname(record.a_index, record.b_index)) / mush::make_cleave_dirname(record.cleavage);
+    auto previous_path = previous_record_path(record_path);
+
+    mush::json merged;
+    merged["ids"] = mush::json::object();
+    for (const auto& path : {previous_path, record_path})
+    {
+        if (!mush::fs::exists(path))
+        {
+            continue;
+        }
+
+        bool complete = true;
+        auto record = mush::load_record(path, &complete);
+        log << "Recover " << record["ids"].size() << " ids from " << path << (complete ? "" : " (cut short)") << "...\n";
+
+        //The record is newer than anything a previous resume left behind
+        for (const auto& [key, value] : record.items())
+        {
+            if (key != "ids")
+            {
+                merged[key] = value;
+            }
+        }
+        for (const auto& [id, chunk] : record["ids"].items())
+        {
+            merged["ids"][id] = chunk;
+        }
+    }
+
+    //Staged first, so there's always at least one readable copy on disk
+    auto staged_path = record_path.parent_path() / ("staged_" + record_path.filename().string());
+    mush::write_record(merged, staged_path);
+    mush::fs::rename(staged_path, previous_path);
+    return merged;
 }
 
-mush::json serialize(const mush::MultiRecord& record)
+std::vector<double> merge_resumed_cleavages(const mush::json& previous_record,
+                                            const std::vector<int>& grid_dims,
+                                            bool irreducible,
+                                            const std::vector<double>& cleavages)
 {
-    mush::json j;
+    if (previous_record.contains("grid") && previous_record["grid"].get<std::vector<int>>() != grid_dims)
+    {
+        throw std::runtime_error("Cannot resume with a " + std::to_string(grid_dims[0]) + "x" + std::to_string(grid_dims[1]) +
+                                 " grid, the previous run used " + previous_record["grid"].dump() + ".");
+    }
 
-    j["grid_point"] = std::vector<int>{record.a_index, record.b_index};
-    j["cleavage"] = record.cleavage;
-    j["equivalent_structures"] = record.equivalent_structures;
+    //Ids that were recorded tell whether the previous run was irreducible, even if the record was cut short before saying so
+    bool previous_irreducible = previous_record.value("irreducible", false);
+    for (const auto& [id, chunk] : previous_record["ids"].items())
+    {
+        previous_irreducible = previous_irreducible || chunk.contains("representative");
+    }
+    if (!previous_record["ids"].empty() && previous_irreducible != irreducible)
+    {
+        throw std::runtime_error("Cannot resume, --irreducible has to be the same as in the previous run.");
+    }
+
+    std::vector<double> merged_cleavages;
+    if (previous_record.contains("cleavages"))
+    {
+        merged_cleavages = previous_record["cleavages"].get<std::vector<double>>();
+    }
 
-    return j;
+    for (double cleavage : cleavages)
+    {
+        auto is_same = [cleavage](double existing) { return mush::almost_equal(existing, cleavage, 1e-8); };
+        if (std::none_of(merged_cleavages.begin(), merged_cleavages.end(), is_same))
+        {
+            merged_cleavages.push_back(cleavage);
+        }
+    }
+    return merged_cleavages;
 }
 
-std::array<double,2> make_aligned_shift_vector(const mush::Shifter& shifter, int ix)
+mush::json make_reused_entries(const mush::fs::path& reuse_path,
+                               const mush::Shifter& shifter,
+                               const std::vector<double>& cleavages,
+                               const mush::fs::path& output_dir,
+                               std::ostream& log)
 {
-    auto aligned_lat=mush::make_aligned(shifter.shifted_structures[ix].lattice());
-    Eigen::Vector3d a_shift=static_cast<double>(shifter.shift_records[ix].a)/shifter.grid_dims[0]*aligned_lat.a();
-    Eigen::Vector3d b_shift=static_cast<double>(shifter.shift_records[ix].b)/shifter.grid_dims[1]*aligned_lat.b();
-    Eigen::Vector3d aligned_shift=a_shift+b_shift;
+    auto previous_dir = reuse_path.parent_path();
+    auto previous_slab = previous_dir / "slab.vasp";
+    if (!mush::fs::exists(previous_slab))
+    {
+        throw std::runtime_error("Cannot reuse structures from " + reuse_path.string() + ", there is no " + previous_slab.string() +
+                                 " to tell whether they were made from the same slab.");
+    }
+    if (!mush::matches_hash(previous_slab, mush::content_hash(mush::make_poscar_contents(shifter.slab))))
+    {
+        throw std::runtime_error("Cannot reuse structures made from " + previous_slab.string() + ", it's not the same slab.");
+    }
+
+    log << "Load structures to reuse from " << reuse_path << "...\n";
+    auto previous_record = mush::load_record(reuse_path);
+    auto previous_grid = previous_record["grid"].get<std::vector<int>>();
+    auto previous_cleavages = previous_record["cleavages"].get<std::vector<double>>();
+    const auto& previous_ids = previous_record["ids"];
+
+    //Everything gets recorded relative to the new output directory, so the runs can be moved together
+    auto absolute_output_dir = mush::fs::absolute(output_dir);
+    auto relative_record = mush::fs::relative(mush::fs::absolute(reuse_path), absolute_output_dir);
+
+    mush::json existing = mush::json::object();
+    for (double cleavage : cleavages)
+    {
+        auto is_same = [cleavage](double previous) { return mush::almost_equal(previous, cleavage, 1e-8); };
+        auto previous_cleavage = std::find_if(previous_cleavages.begin(), previous_cleavages.end(), is_same);
+        if (previous_cleavage == previous_cleavages.end())
+        {
+            continue;
+        }
+
+        for (int i = 0; i < shifter.size(); ++i)
+        {
+            //Shift a/A is on the previous grid if a*A'/A is a whole number
+            long a = static_cast<long>(shifter.shift_records[i].a) * previous_grid[0];
+            long b = static_cast<long>(shifter.shift_records[i].b) * previous_grid[1];
+            if (a % shifter.grid_dims[0] != 0 || b % shifter.grid_dims[1] != 0)
+            {
+                continue;
+            }
+
+            mush::MultiRecord previous_report;
+            previous_report.cleavage = *previous_cleavage;
+            previous_report.a_index = a / shifter.grid_dims[0];
+            previous_report.b_index = b / shifter.grid_dims[1];
+            auto previous_id = previous_ids.find(previous_report.id());
+            if (previous_id == previous_ids.end())
+            {
+                continue;
+            }
 
-    assert(cu::almost_equal(aligned_shift(2),0.0));
+            mush::json entry;
+            entry["directory"] = mush::fs::relative(mush::fs::absolute(previous_dir / (*previous_id)["directory"].get<std::string>()), absolute_output_dir);
+            entry["reused_from"] = {{"record", relative_record}, {"id", previous_report.id()}};
+            for (const auto& [key, value] : previous_id->items())
+            {
+                if (key == "hash" || !mush::is_bookkeeping_key(key))
+                {
+                    entry[key] = value;
+                }
+            }
 
-    return {aligned_shift(0),aligned_shift(1)};
+            mush::MultiRecord report;
+            report.cleavage = cleavage;
+            report.a_index = shifter.shift_records[i].a;
+            report.b_index = shifter.shift_records[i].b;
+            existing[report.id()] = entry;
+        }
+    }
+
+    log << "Reuse " << existing.size() << " structures of the " << previous_grid[0] << "x" << previous_grid[1] << " grid...\n";
+    return existing;
 }
 
-std::array<std::array<double,2>,2> make_shift_units(const mush::Shifter& shifter)
+mush::json make_chain_plan(const mush::Shifter& shifter, const std::vector<double>& cleavages, const ChainOptions& options, double setup_seconds)
 {
-    auto aligned_lat=mush::make_aligned(shifter.shifted_structures[0].lattice());
-    Eigen::Vector3d a_shift=1.0/shifter.grid_dims[0]*aligned_lat.a();
-    Eigen::Vector3d b_shift=1.0/shifter.grid_dims[1]*aligned_lat.b();
+    //Every orbit is listed once for each of its members, count it through its representative
+    std::map<int, int> orbit_sizes;
+    int num_orbits = 0;
+    for (int i = 0; i < shifter.size(); ++i)
+    {
+        if (shifter.equivalence_map[i].front() == i)
+        {
+            ++num_orbits;
+            ++orbit_sizes[shifter.equivalence_map[i].size()];
+        }
+    }
 
-    std::array<double,2> a{a_shift(0),a_shift(1)};
-    std::array<double,2> b{b_shift(0),b_shift(1)};
+    //Shifting and cleaving never change the number of atoms
+    int atoms_per_structure = shifter.slab.basis_sites().size();
+    int num_ids = shifter.size() * cleavages.size();
+    int num_written = (options.irreducible ? num_orbits : shifter.size()) * cleavages.size();
 
-    return {a,b};
-}
+    //Size of the record is dominated by the ids, which all look alike
+    double record_bytes = 0.0;
+    if (num_ids > 0)
+    {
+        auto report = mush::make_multirecord(cleavages.front(), shifter, 0);
+        auto chunk = mush::serialize(report);
+        chunk["directory"] = mush::make_target_directory<mush::SUBCOMMAND::CHAIN>(report);
+        chunk["shift"] = mush::make_aligned_shift_vector(shifter, 0);
+        chunk["orbit"] = 0;
+        mush::json id_entry;
+        id_entry[report.id()] = chunk;
 
+        auto format = mush::RecordWriter::format_from_extension("record." + (options.record_format.empty() ? "json" : options.record_format));
+        std::size_t entry_bytes = format == mush::RecordWriter::FORMAT::CBOR      ? mush::json::to_cbor(id_entry).size()
+                                  : format == mush::RecordWriter::FORMAT::MSGPACK ? mush::json::to_msgpack(id_entry).size()
+                                                                                  : id_entry.dump(4).size();
+        //Every id shows up once more in the equivalents
+        record_bytes = num_ids * (entry_bytes + report.id().size() + 4);
+    }
 
+    auto cost = mush::measure_poscar_cost(shifter.slab);
+    double structure_bytes = static_cast<double>(num_written) * atoms_per_structure * cost.bytes_per_atom;
+    int threads = mush::resolve_thread_count(options.threads);
+    double write_seconds = static_cast<double>(num_written) * atoms_per_structure * cost.seconds_per_atom / threads;
+
+    mush::json plan;
+    plan["grid"] = shifter.grid_dims;
+    plan["cleavages"] = cleavages;
+    plan["grid_points"] = shifter.size();
+    plan["ids"] = num_ids;
+    plan["structures"] = num_written;
+    plan["orbits_per_cleavage"] = num_orbits;
+    plan["orbits"] = num_orbits * cleavages.size();
+
+    //Keys are the size of an orbit, values how many orbits have that size
+    mush::json sizes = mush::json::object();
+    for (const auto& [size, count] : orbit_sizes)
+    {
+        sizes[std::to_string(size)] = count;
+    }
+    plan["orbit_sizes"] = sizes;
+
+    plan["atoms_per_structure"] = atoms_per_structure;
+    plan["total_atoms"] = static_cast<long>(num_written) * atoms_per_structure;
+    plan["estimated_bytes"] = {{"structures", structure_bytes}, {"record", record_bytes}, {"total", structure_bytes + record_bytes}};
+    plan["threads"] = threads;
+    plan["estimated_seconds"] = setup_seconds + write_seconds;
+    return plan;
+}
@@ -5,16 +5,79 @@
 #include <multishift/definitions.hpp>
 #include "./misc.hpp"
 #include "multishift/shifter.hpp"
+#include "multishift/chain.hpp"
+#include "multishift/record.hpp"
+#include "multishift/archive.hpp"
+#include "multishift/profile.hpp"
 #include <casmutils/xtal/structure_tools.hpp>
+#include <chrono>
+#include <memory>
 
 void setup_subcommand_chain(CLI::App& app);
 
 namespace cu = casmutils;
 
-mush::MultiRecord make_multirecord(const double cleave, const mush::Shifter& shifter, int ix);
-mush::json serialize(const mush::MultiRecord& record);
-std::array<double,2> make_aligned_shift_vector(const mush::Shifter& shifter, int ix);
-std::array<std::array<double,2>,2> make_shift_units(const mush::Shifter& shifter);
+//Settings for the cleave, shift, and chain subcommands that change how the
+//structures get generated and stored
+struct ChainOptions
+{
+    //Number of threads used to create and write the structures, less than 1 means all cores
+    int threads = 1;
+    //Cross check the equivalent shifts found by symmetry against comparing every shifted structure (slow)
+    bool validate_equivalence = false;
+    //Only write one structure per orbit, every equivalent id points to the directory of its representative
+    bool irreducible = false;
+    //Format of the record, either json, cbor or msgpack. If empty, json for a new run, or whatever
+    //the run that is being resumed used.
+    std::string record_format;
+    //Pack every structure and the record into a single archive file instead of a directory tree
+    bool archive = false;
+    //Compress the entries of the archive
+    bool compress = false;
+    //If set, nothing gets created, and a plan of the run is written here instead
+    mush::fs::path plan;
+    //Continue a run in an existing output directory, only creating structures that are missing or new
+    bool resume = false;
+    //Record of an earlier run on a grid the new one is a refinement of. Grid points that land on
+    //it point to the existing structures instead of getting written again.
+    mush::fs::path reuse;
+};
+
+void populate_subcommand_chain_options(CLI::App* sub, ChainOptions* options);
+
+//Where the ids recovered from earlier runs are kept while the record is being written again
+mush::fs::path previous_record_path(const mush::fs::path& record_path);
+
+//Format the record gets written in. When resuming, that's the format of the record (or previous record) already
+//in the output directory, and asking for a different one, or finding records in more than one format, is an error.
+//Otherwise it's the requested format, or json if none was requested.
+mush::RecordWriter::FORMAT resolve_record_format(const mush::fs::path& output_dir, const std::string& requested, bool resuming);
+
+//Everything recorded by earlier runs that were interrupted or are being extended: the record itself,
+//which may have been cut short, and whatever an interrupted resume couldn't write back in time.
+//The result is saved as the previous record, so nothing is lost if this run gets interrupted too.
+mush::json load_resumable_record(const mush::fs::path& record_path, std::ostream& log);
+
+//Makes sure the previous record was made with the same settings, and returns its cleavages followed
+//by any new ones
+std::vector<double> merge_resumed_cleavages(const mush::json& previous_record,
+                                            const std::vector<int>& grid_dims,
+                                            bool irreducible,
+                                            const std::vector<double>& cleavages);
+
+//Entries for every id that lands on a grid point of the earlier run at the same cleavage, pointing to its
+//directory (relative to the output directory) and carrying over its values. Grid points are matched exactly,
+//through their integer indexes. Throws unless the slab.vasp next to the earlier record is the slab of the shifter.
+mush::json make_reused_entries(const mush::fs::path& reuse_path,
+                               const mush::Shifter& shifter,
+                               const std::vector<double>& cleavages,
+                               const mush::fs::path& output_dir,
+                               std::ostream& log);
+
+//Counts of structures, orbits and atoms that a run would create, along with estimates
+//of its size on disk and how long it will take. Only needs the grid and symmetry of the shifter.
+//setup_seconds is how long it took to construct the shifter, and gets added to the estimated time.
+mush::json make_chain_plan(const mush::Shifter& shifter, const std::vector<double>& cleavages, const ChainOptions& options, double setup_seconds);
 
 //Used for cleave, shift,and chain subcommands. The only difference between them
 //is the output directory layout (single layer vs two layers)
@@ -23,73 +86,155 @@ void run_subcommand_chain(const mush::fs::path& input_path,
                           const mush::fs::path& output_dir,
                           const std::vector<double>& cleavages,
                           const std::vector<int>& grid_dims,
+                          const ChainOptions& options,
                           std::ostream& log)
 {
-    mush::cautious_create_directory(output_dir);
+    if(!options.plan.empty())
+    {
+        log << "Reading slab from " << input_path << "...\n";
+        auto slab = cu::xtal::Structure::from_poscar(input_path);
+
+        log << "Plan " << grid_dims[0] << "x" << grid_dims[1] << " grid with " << cleavages.size() << " cleavage values...\n";
+        auto start = std::chrono::steady_clock::now();
+        mush::Shifter shifter(slab, grid_dims[0], grid_dims[1], options.validate_equivalence);
+        std::chrono::duration<double> setup_time = std::chrono::steady_clock::now() - start;
+
+        auto plan = make_chain_plan(shifter, cleavages, options, setup_time.count());
+        plan["subcommand"] = subcommand == mush::SUBCOMMAND::CLEAVE ? "cleave" : subcommand == mush::SUBCOMMAND::SHIFT ? "shift" : "chain";
+        plan["output"] = output_dir;
+
+        log << "Save plan to " << options.plan << "...\n";
+        mush::write_json(plan, options.plan);
+        return;
+    }
+
+    //In archive mode the output is a single file, and everything that would go in
+    //the output directory becomes an entry of the archive instead
+    std::unique_ptr<mush::ArchiveWriter> archive;
+    bool resuming = options.resume && mush::fs::exists(output_dir);
+    if(options.archive)
+    {
+        if(mush::fs::exists(output_dir))
+        {
+            throw std::runtime_error("Will not continue because " + output_dir.string() + " already exists.");
+        }
+        log << "Pack structures into archive " << output_dir << "...\n";
+        archive.reset(new mush::ArchiveWriter(output_dir, options.compress));
+    }
+    else if(resuming)
+    {
+        log << "Resume previous run in " << output_dir << "...\n";
+    }
+    else
+    {
+        mush::cautious_create_directory(output_dir);
+    }
 
     log << "Reading slab from " << input_path << "...\n";
+    mush::ScopedTimer read_timer("read_slab");
     auto slab = cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
+
+    //The record is streamed to disk as the structures are generated. Archives get
+    //the record once it's complete, until then it sits next to the archive.
+    auto record_format=resolve_record_format(output_dir, options.record_format, resuming);
+    auto record_name="record"+mush::RecordWriter::extension(record_format);
+    auto record_path=archive ? mush::fs::path(output_dir.string()+"."+record_name) : output_dir/record_name;
+
+    //Whatever the previous runs left behind. Ids are only reused if their structure on disk still matches the hash.
+    std::vector<double> all_cleavages = cleavages;
+    mush::json previous_record;
+    previous_record["ids"] = mush::json::object();
+    if(resuming)
+    {
+        mush::ScopedTimer timer("read_previous_record");
+        previous_record = load_resumable_record(record_path, log);
+
+        //Without the slab there's no telling what the recorded structures were made from
+        auto previous_slab = output_dir / "slab.vasp";
+        if(!mush::fs::exists(previous_slab) && !previous_record["ids"].empty())
+        {
+            throw std::runtime_error("Cannot resume, there is no " + previous_slab.string() + " to tell whether the previous run used the same slab.");
+        }
+        if(mush::fs::exists(previous_slab) && !mush::matches_hash(previous_slab, mush::content_hash(mush::make_poscar_contents(slab))))
+        {
+            throw std::runtime_error("Cannot resume, " + previous_slab.string() + " is not the same slab as " + input_path.string() + ".");
+        }
 
-    mush::json full_record;
-    full_record["grid"] = grid_dims;
-    full_record["cleavages"] = cleavages;
+        all_cleavages = merge_resumed_cleavages(previous_record, grid_dims, options.irreducible, cleavages);
+    }
+
+    log << "Stream record to "<<record_path<<"...\n";
+    mush::RecordSink record_sink(record_path, record_format, previous_record["ids"]);
 
     if(subcommand!=mush::SUBCOMMAND::CLEAVE)
     {
-        log << "Shifting structures for " << grid_dims[0] << "x" << grid_dims[1] << " grid (please be patient)...\n";
+        log << "Shifting structures for " << grid_dims[0] << "x" << grid_dims[1] << " grid...\n";
+    }
+
+    if(options.validate_equivalence)
+    {
+        log << "Validating equivalent shifts against structure comparisons (please be patient)...\n";
     }
 
-    mush::Shifter shifter(slab, grid_dims[0], grid_dims[1]);
+    mush::Shifter shifter(slab, grid_dims[0], grid_dims[1], options.validate_equivalence);
     assert(shifter.grid_dims[0] == grid_dims[0] && shifter.grid_dims[1] == grid_dims[1]);
-    full_record["shift_units"]=make_shift_units(shifter);
 
-    std::vector<std::vector<std::string>> unique_equivalent_groups;
-    std::unordered_map<int,int> equivalence_map_ix_to_group_label;
-    for (double cleave : cleavages)
+    //Only there to report progress, everything gets written by the other sinks
+    struct CleavageLog : mush::ChainSink
     {
-        std::unordered_set<int> recorded_equivalents;
-        if(subcommand!=mush::SUBCOMMAND::SHIFT)
+        std::ostream& log;
+        CleavageLog(std::ostream& log) : log(log) {}
+        void begin_cleavage(double cleave) override
         {
-            log << "Cleaving " << cleave << " angstroms...\n";
-        }
-        for (int i = 0; i < shifter.size(); ++i)
-        {
-            auto cleaved_shifted_structure = mush::make_cleaved_structure(shifter.shifted_structures[i], cleave);
-            auto report = make_multirecord(cleave, shifter, i);
-
-            if (recorded_equivalents.count(i) == 0)
+            if(subcommand!=mush::SUBCOMMAND::SHIFT)
             {
-                for(int e : shifter.equivalence_map[i])
-                {
-                    equivalence_map_ix_to_group_label[e]=unique_equivalent_groups.size();
-                }
-                unique_equivalent_groups.push_back(report.equivalent_structures);
-                recorded_equivalents.insert(shifter.equivalence_map[i].begin(), shifter.equivalence_map[i].end());
+                log << "Cleaving " << cleave << " angstroms...\n";
             }
+        }
+    } cleavage_log(log);
 
-            auto dir = mush::make_target_directory<subcommand>(report);
-            auto target_file=output_dir/dir/"POSCAR";
-            log << "Write structure to " << target_file << "...\n";
-            mush::fs::create_directories(output_dir / dir);
-            cu::xtal::write_poscar(cleaved_shifted_structure, target_file);
+    std::unique_ptr<mush::ChainSink> structure_sink;
+    if(archive)
+    {
+        structure_sink.reset(new mush::ArchiveSink(archive.get(), &log));
+    }
+    else
+    {
+        structure_sink.reset(new mush::DirectorySink(output_dir, previous_record["ids"], &log));
+    }
 
-            auto chunk = serialize(report);
-            chunk["directory"] = dir;
-            chunk["shift"]=make_aligned_shift_vector(shifter, i);
-            chunk["orbit"]=equivalence_map_ix_to_group_label[i];
+    mush::ChainSettings settings;
+    settings.threads = options.threads;
+    settings.irreducible = options.irreducible;
+    if(!options.reuse.empty())
+    {
+        settings.existing = make_reused_entries(options.reuse, shifter, all_cleavages, output_dir, log);
+    }
+    mush::enumerate_chain(shifter, all_cleavages, subcommand, settings, {&cleavage_log, &record_sink, structure_sink.get()});
 
-            full_record["ids"][report.id()] = chunk;
-        }
+    if(resuming)
+    {
+        auto reused_count = static_cast<mush::DirectorySink*>(structure_sink.get())->reused();
+        log << "Reused " << reused_count << " structures from the previous run...\n";
     }
 
-    full_record["equivalents"] = unique_equivalent_groups;
+    if(archive)
+    {
+        archive->add_file(record_name, record_path);
+        archive->close();
+        mush::fs::remove(record_path);
+    }
 
-    log << "Back up slab structure to " << output_dir / "slab.vasp"
-        << "...\n";
-    cu::xtal::write_poscar(slab, output_dir / "slab.vasp");
+    //The new record has everything now
+    mush::fs::remove(previous_record_path(record_path));
 
-    log << "Save record to "<<output_dir/"record.json"<<"...\n";
-    mush::write_json(full_record,output_dir/"record.json");
+    if(mush::Profiler::instance().enabled())
+    {
+        auto profile_path=archive ? mush::fs::path(output_dir.string()+".profile.json") : output_dir/"profile.json";
+        log << "Save profile to " << profile_path << "...\n";
+        mush::Profiler::instance().write_report(profile_path);
+    }
 }
 
 #endif
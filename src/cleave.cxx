@@ -6,17 +6,12 @@
 #include <casmutils/mush/shift.hpp>
 #include <multishift/slice_settings.hpp>
 
-template<>
-mush::fs::path mush::make_target_directory<mush::SUBCOMMAND::CLEAVE>(const mush::MultiRecord& record)
-{
-    return mush::make_cleave_dirname(record.cleavage);
-}
-
 void setup_subcommand_cleave(CLI::App& app)
 {
     auto input_path_ptr = std::make_shared<mush::fs::path>();
     auto output_path_ptr = std::make_shared<mush::fs::path>();
     auto celavages_ptr = std::make_shared<std::vector<double>>();
+    auto options_ptr = std::make_shared<ChainOptions>();
 
     CLI::App* chain_sub = app.add_subcommand("cleave", "Create slab structures separated by a range of specified values in Angstrom.");
 
@@ -25,6 +20,8 @@ void setup_subcommand_cleave(CLI::App& app)
 
     chain_sub->add_option("-v,--values", *celavages_ptr, "List of cleavage values to insert between slabs.")->required();
 
-    chain_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::CLEAVE>(*input_path_ptr, *output_path_ptr, *celavages_ptr, {1,1}, std::cout); });
+    populate_subcommand_chain_options(chain_sub, options_ptr.get());
+
+    chain_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::CLEAVE>(*input_path_ptr, *output_path_ptr, *celavages_ptr, {1,1}, *options_ptr, std::cout); });
 }
 
@@ -14,3 +14,8 @@ void populate_subcommand_fractional(CLI::App* sub, bool* frac_ptr, CLI::Option*
 {
     sub->add_flag("--fractional", *frac_ptr, "Specifies that the parameters passed to "+needed->get_name()+" are in fractional coordinates, not Cartesian.")->needs(needed);
 }
+
+void populate_subcommand_plan_option(CLI::App* sub, mush::fs::path* plan)
+{
+    sub->add_option("--plan",*plan,"Don't create any structures. Instead, write a json file with the number of structures, atoms, and estimates of the disk space and time the run would take.");
+}
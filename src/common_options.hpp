@@ -14,5 +14,6 @@ struct StructureIOOptions
 void populate_subcommand_fractional(CLI::App* sub, bool* frac_ptr, CLI::Option* needed);
 void populate_subcommand_output_option(CLI::App* sub, mush::fs::path* out);
 void populate_subcommand_input_option(CLI::App* sub, mush::fs::path* in);
+void populate_subcommand_plan_option(CLI::App* sub, mush::fs::path* plan);
 
 #endif
@@ -0,0 +1,101 @@
+#include "./extract.hpp"
+#include "./common_options.hpp"
+#include "./misc.hpp"
+#include <algorithm>
+#include <memory>
+#include <multishift/archive.hpp>
+#include <multishift/profile.hpp>
+#include <multishift/record.hpp>
+#include <set>
+#include <stdexcept>
+
+void setup_subcommand_extract(CLI::App& app)
+{
+    auto input_path_ptr = std::make_shared<mush::fs::path>();
+    auto output_path_ptr = std::make_shared<mush::fs::path>();
+    auto ids_ptr = std::make_shared<std::vector<std::string>>();
+    auto orbits_ptr = std::make_shared<std::vector<int>>();
+
+    CLI::App* extract_sub = app.add_subcommand("extract", "Unpack structures from an archive made with --archive into the usual directory layout.");
+
+    extract_sub->add_option("-i,--input", *input_path_ptr, "Archive created by the cleave, shift, or chain subcommands.")->required();
+    populate_subcommand_output_option(extract_sub, output_path_ptr.get());
+    extract_sub->add_option("--ids", *ids_ptr, "Ids of the structures to unpack, as listed in the record.");
+    extract_sub->add_option("--orbits", *orbits_ptr, "Unpack every structure that belongs to these orbits.");
+
+    extract_sub->callback([=]() { run_subcommand_extract(*input_path_ptr, *output_path_ptr, *ids_ptr, *orbits_ptr, std::cout); });
+}
+
+void run_subcommand_extract(const mush::fs::path& archive_path,
+                            const mush::fs::path& output_dir,
+                            const std::vector<std::string>& ids,
+                            const std::vector<int>& orbits,
+                            std::ostream& log)
+{
+    log << "Open archive " << archive_path << "...\n";
+    mush::ScopedTimer open_timer("open_archive");
+    mush::ArchiveReader archive(archive_path);
+    open_timer.stop();
+
+    std::string record_name;
+    for (const std::string candidate : {"record.json", "record.cbor", "record.msgpack"})
+    {
+        if (archive.contains(candidate))
+        {
+            record_name = candidate;
+        }
+    }
+    if (record_name.empty())
+    {
+        throw std::runtime_error("The archive " + archive_path.string() + " doesn't have a record.");
+    }
+
+    //Extracting more structures into the same directory later on is fine
+    mush::fs::create_directories(output_dir);
+    log << "Extract record to " << output_dir / record_name << "...\n";
+    mush::ScopedTimer record_timer("extract_record");
+    archive.extract(record_name, output_dir / record_name);
+    archive.extract("slab.vasp", output_dir / "slab.vasp");
+    auto record = mush::load_record(output_dir / record_name);
+    record_timer.stop();
+
+    std::set<std::string> selected_ids(ids.begin(), ids.end());
+    std::set<int> selected_orbits(orbits.begin(), orbits.end());
+    bool extract_everything = ids.empty() && orbits.empty();
+
+    for (const auto& id : selected_ids)
+    {
+        if (!record["ids"].contains(id))
+        {
+            throw std::runtime_error("There is no structure with id " + id + " in the archive.");
+        }
+    }
+
+    //Several ids can point to the same structure when the archive was made with --irreducible
+    std::set<std::string> extracted_entries;
+    for (const auto& [id, chunk] : record["ids"].items())
+    {
+        bool selected = extract_everything || selected_ids.count(id) || selected_orbits.count(chunk["orbit"].get<int>());
+        if (!selected)
+        {
+            continue;
+        }
+
+        auto relative_path = mush::fs::path(chunk["directory"].get<std::string>()) / "POSCAR";
+        auto entry = relative_path.generic_string();
+        if (extracted_entries.count(entry))
+        {
+            continue;
+        }
+
+        log << "Extract " << id << " to " << output_dir / relative_path << "...\n";
+        mush::ScopedTimer extract_timer("extract_structure");
+        mush::fs::create_directories((output_dir / relative_path).parent_path());
+        archive.extract(entry, output_dir / relative_path);
+        extracted_entries.insert(entry);
+        mush::profile_count("structures_extracted");
+    }
+
+    log << "Extracted " << extracted_entries.size() << " structures.\n";
+    return;
+}
@@ -0,0 +1,19 @@
+#ifndef EXTRACT_SUBCOMMAND_HH
+#define EXTRACT_SUBCOMMAND_HH
+
+#include <CLI/CLI.hpp>
+#include <multishift/definitions.hpp>
+#include <string>
+#include <vector>
+
+void setup_subcommand_extract(CLI::App& app);
+
+//Unpack structures from an archive made by cleave, shift, or chain into the usual directory layout.
+//If no ids or orbits are given, everything gets unpacked.
+void run_subcommand_extract(const mush::fs::path& archive_path,
+                            const mush::fs::path& output_dir,
+                            const std::vector<std::string>& ids,
+                            const std::vector<int>& orbits,
+                            std::ostream& log);
+
+#endif
@@ -1,11 +1,19 @@
 #include "./fourier.hpp"
 #include "./misc.hpp"
+#include <algorithm>
+#include <array>
 #include <casmutils/mush/slab.hpp>
+#include <cmath>
 #include <filesystem>
 #include <memory>
 #include <multishift/fourier.hpp>
+#include <multishift/profile.hpp>
+#include <multishift/record.hpp>
+#include <multishift/shifter.hpp>
 #include <multishift/slice_settings.hpp>
 #include <ostream>
+#include <stdexcept>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -13,38 +21,93 @@ namespace cu = casmutils;
 
 namespace
 {
-std::vector<mush::InterPoint> read_unrolled_data(const mush::json record, double cleavage_slice, const std::string& value_key)
+/// Write the real part of the interpolated values as a numpy array, along with a small json
+/// header (same name, but .json extension) that describes the grid
+void write_interpolated_surface(const mush::Interpolator::InterGrid& ipolvalues,
+                                const cu::xtal::Lattice& lat,
+                                const std::string& value_key,
+                                double cleavage_slice,
+                                const mush::fs::path& surface_path)
 {
-    int amax=record["grid"][0];
-    int bmax=record["grid"][1];
-
-    std::vector<mush::InterPoint> unrolled_data;
-    for (const auto& id : record["ids"])
+    std::vector<double> flat_values;
+    flat_values.reserve(ipolvalues.size());
+    for (const auto& value : ipolvalues.values)
     {
-        if(!cu::almost_equal(cleavage_slice,id["cleavage"].get<double>(),1e-8))
-        {
-            continue;
-        }
-
-        int a=id["grid_point"][0];
-        int b=id["grid_point"][1];
-        double v=id[value_key];
-        unrolled_data.emplace_back(static_cast<double>(a)/amax,static_cast<double>(b)/bmax,v);
+        flat_values.push_back(value.real());
     }
 
-    return unrolled_data;
+    std::vector<int> shape{ipolvalues.a_dim(), ipolvalues.b_dim()};
+    mush::write_npy(flat_values, shape, surface_path);
+
+    mush::json header;
+    header["data"] = surface_path.filename();
+    header["key"] = value_key;
+    header["cleavage"] = cleavage_slice;
+    header["resolution"] = shape;
+    header["a"] = std::vector<double>{lat.a()(0), lat.a()(1)};
+    header["b"] = std::vector<double>{lat.b()(0), lat.b()(1)};
+    header["layout"] = "Row major, entry [i][j] is at Cartesian (i/resolution[0])*a+(j/resolution[1])*b";
+
+    mush::fs::path header_path = surface_path;
+    header_path.replace_extension(".json");
+    mush::write_json(header, header_path);
+    return;
 }
 
-cu::xtal::Lattice extract_pseudo_slab_lattice(const mush::json& record) {
-    auto su=record["shift_units"];
-    Eigen::Vector3d au(su[0][0],su[0][1],0.0);
-    Eigen::Vector3d bu(su[1][0],su[1][1],0.0);
-    Eigen::Vector3d c(0,0,1);
+/// Write the Fourier coefficients of a single fit as json, along with the formulas that reproduce it
+void write_fit(const mush::Interpolator& ipolator,
+               const mush::Analytiker& analyzer,
+               const std::string& value_key,
+               double cleavage_slice,
+               double crush_value,
+               const mush::fs::path& fit_path)
+{
+    const auto& k_values = ipolator.k_values();
+    std::vector<std::array<int, 2>> k_points;
+    std::vector<double> real_coefficients;
+    std::vector<double> imag_coefficients;
+    for (int ix = 0; ix < k_values.size(); ++ix)
+    {
+        k_points.push_back({static_cast<int>(std::lround(k_values.a_fracs[ix])), static_cast<int>(std::lround(k_values.b_fracs[ix]))});
+        auto coefficient = k_values.values[ix] * k_values.weights[ix];
+        real_coefficients.push_back(coefficient.real());
+        imag_coefficients.push_back(coefficient.imag());
+    }
+
+    auto [real_functions, imag_functions] = analyzer.python_cart("x", "y", "np", crush_value);
+
+    const auto& lat = ipolator.real_lattice();
+    mush::json fit;
+    fit["key"] = value_key;
+    fit["cleavage"] = cleavage_slice;
+    fit["a"] = std::vector<double>{lat.a()(0), lat.a()(1)};
+    fit["b"] = std::vector<double>{lat.b()(0), lat.b()(1)};
+    fit["k_points"] = k_points;
+    fit["real_coefficients"] = real_coefficients;
+    fit["imag_coefficients"] = imag_coefficients;
+    fit["layout"] = "Value at Cartesian r is the sum of coefficient*exp(i*2*pi*(p*fa+q*fb)) over every k_point (p,q), where "
+                    "(fa,fb) are the fractional coordinates of r along a and b";
+    fit["real_formula"] = real_functions;
+    fit["imag_formula"] = imag_functions;
 
-    int amax=record["grid"][0];
-    int bmax=record["grid"][1];
+    mush::write_json(fit, fit_path);
+    return;
+}
+
+/// Turn the values given on the command line into cleavages, where "all" means every cleavage in the record
+std::vector<double> resolve_cleavages(const std::vector<std::string>& requested, const mush::RecordReader& record)
+{
+    if (std::find(requested.begin(), requested.end(), "all") != requested.end())
+    {
+        return record.cleavages();
+    }
 
-    return cu::xtal::Lattice(au*amax,bu*bmax,c);
+    std::vector<double> cleavages;
+    for (const auto& cleavage : requested)
+    {
+        cleavages.push_back(std::stod(cleavage));
+    }
+    return cleavages;
 }
 
 } // namespace
@@ -54,9 +117,15 @@ cu::xtal::Lattice extract_pseudo_slab_lattice(const mush::json& record) {
 void setup_subcommand_fourier(CLI::App& app)
 {
     auto data_path_ptr = std::make_shared<mush::fs::path>();
-    auto cleavage_slice_ptr = std::make_shared<double>();
-    auto entry_key_ptr = std::make_shared<std::string>();
+    auto cleavage_slices_ptr = std::make_shared<std::vector<std::string>>();
+    auto entry_keys_ptr = std::make_shared<std::vector<std::string>>();
     auto crush_ptr = std::make_shared<double>();
+    auto surface_path_ptr = std::make_shared<mush::fs::path>();
+    auto resolution_ptr = std::make_shared<std::vector<int>>();
+    auto output_dir_ptr = std::make_shared<mush::fs::path>();
+    auto regularization_ptr = std::make_shared<double>();
+    auto stars_ptr = std::make_shared<bool>();
+    auto slab_path_ptr = std::make_shared<mush::fs::path>();
 
     CLI::App* fourier_sub = app.add_subcommand("fourier", "Perform Fourier decomposition and get analytical expression for data set.");
     fourier_sub
@@ -64,44 +133,191 @@ void setup_subcommand_fourier(CLI::App& app)
                      *data_path_ptr,
                      "Amended 'record.json' like file, with an additional entry for values to interpolate for each structure id.")
         ->required();
-    fourier_sub->add_option("-c,--cleavage-slice", *cleavage_slice_ptr, "Take data from these cleavage values.")->default_val(0.0);
-    fourier_sub->add_option("-k,--key", *entry_key_ptr, "Key of the value that is being interpolated.")->required();
+    fourier_sub->add_option("-c,--cleavage-slice", *cleavage_slices_ptr, "Take data from these cleavage values. Use 'all' for every cleavage in the record.")->default_val("0.0");
+    fourier_sub->add_option("-k,--key", *entry_keys_ptr, "Keys of the values that are being interpolated. Use 'all' for every value in the record.")->required();
     fourier_sub->add_option("-x,--crush", *crush_ptr, "Basis functions that fall within this threshold will get added together, reducing the total number of basis functions.")->default_val(0.0)->default_val(1e-9);
 
-    fourier_sub->callback([=]() { run_subcommand_fourier(*data_path_ptr, *cleavage_slice_ptr, *entry_key_ptr, *crush_ptr, std::cout); });
+    auto resolution_opt = fourier_sub->add_option("-r,--resolution", *resolution_ptr, "Grid dimensions along a and b to reconstruct the surface at, when writing it with --output or --output-dir.")->expected(2);
+    auto surface_opt = fourier_sub->add_option("-o,--output", *surface_path_ptr, "Write the reconstructed surface to this numpy (.npy) file, with a json header next to it. Only for a single key and cleavage.")->needs(resolution_opt);
+    fourier_sub->add_option("-O,--output-dir", *output_dir_ptr, "Write the Fourier coefficients of every key and cleavage to a separate json file in this directory. Reconstructed surfaces are saved next to them if a resolution is given.")->excludes(surface_opt);
+    fourier_sub->add_option("-R,--regularization", *regularization_ptr, "Fit every data set by least squares, penalizing the squared magnitude of the coefficients by this much. Data sets with grid points that have no value are always fitted by least squares.")->default_val(0.0)->check(CLI::NonNegativeNumber);
+    auto stars_opt = fourier_sub->add_flag("-s,--stars", *stars_ptr, "Group the k-points into stars under the symmetry of the slab, with a single coefficient for each star.");
+    fourier_sub->add_option("-i,--input", *slab_path_ptr, "Slab the record was made from, to get the symmetry for --stars. Defaults to the slab.vasp next to the record.")->needs(stars_opt);
+
+    fourier_sub->callback([=]() {
+        run_subcommand_fourier(*data_path_ptr,
+                               *cleavage_slices_ptr,
+                               *entry_keys_ptr,
+                               *crush_ptr,
+                               *surface_path_ptr,
+                               *resolution_ptr,
+                               *output_dir_ptr,
+                               *regularization_ptr,
+                               *stars_ptr,
+                               *slab_path_ptr,
+                               std::cout);
+    });
 }
 
-void run_subcommand_fourier(const mush::fs::path& data_path, double cleavage_slice, const std::string& value_key, double crush_value, std::ostream& log)
+void run_subcommand_fourier(const mush::fs::path& data_path,
+                            const std::vector<std::string>& cleavage_slices,
+                            const std::vector<std::string>& value_keys,
+                            double crush_value,
+                            const mush::fs::path& surface_path,
+                            const std::vector<int>& resolution,
+                            const mush::fs::path& output_dir,
+                            double regularization,
+                            bool stars,
+                            const mush::fs::path& slab_path,
+                            std::ostream& log)
 {
+    if (!resolution.empty() && surface_path.empty() && output_dir.empty())
+    {
+        throw std::runtime_error("A resolution only has an effect if the surface gets written. Use it with --output or --output-dir.");
+    }
+
+    bool all_keys = std::find(value_keys.begin(), value_keys.end(), "all") != value_keys.end();
+
     log << "Load data from "<<data_path<<"...\n";
-    auto record = mush::load_json(data_path);
+    mush::ScopedTimer read_timer("read_record");
+    mush::RecordReader record(data_path, all_keys ? std::vector<std::string>{} : value_keys);
+    read_timer.stop();
 
-    const auto& slab_lattice = ::extract_pseudo_slab_lattice(record);
+    const auto& slab_lattice = mush::make_pseudo_slab_lattice(record.header());
     /* log << "Inferred surface vectors as:\n"; */
     /* log << "    a: "<<slab_lattice.a().transpose()<<"\n"; */
     /* log << "    b: "<<slab_lattice.b().transpose()<<"\n"; */
 
-    log << "Extract values at cleavage "<<std::fixed << std::setprecision(6)<<cleavage_slice<<"...\n";
-    auto unrolled_data = ::read_unrolled_data(record, cleavage_slice, value_key);
-    mush::Interpolator ipolator(slab_lattice, unrolled_data);
+    // Every cleavage was sampled on the same shift grid, so all the data can be fitted with a single basis
+    std::vector<std::pair<std::string, double>> fitted_slices;
+    std::vector<std::vector<mush::InterPoint>> data_sets;
+    for (double cleavage_slice : ::resolve_cleavages(cleavage_slices, record))
+    {
+        log << "Extract values at cleavage "<<std::fixed << std::setprecision(6)<<cleavage_slice<<"...\n";
+        for (const auto& value_key : all_keys ? record.value_keys(cleavage_slice) : value_keys)
+        {
+            fitted_slices.emplace_back(value_key, cleavage_slice);
+            data_sets.emplace_back(record.unrolled_data(cleavage_slice, value_key, true));
+        }
+    }
 
-    const auto& start_values = ipolator.sampled_values();
-    auto [lat, ipolvalues] = ipolator.interpolate(start_values.size(), start_values[0].size());
+    if (!surface_path.empty() && data_sets.size() != 1)
+    {
+        throw std::runtime_error("Writing the surface to a single file only works for one key and cleavage. Use --output-dir instead.");
+    }
 
-    mush::Analytiker analyzer(ipolator);
+    // Complete data sets were all sampled on the same grid, and go through the FFT together. Sets with
+    // missing points, or every set if there's a regularization, get a least squares fit of their own.
+    std::vector<int> missing_points;
+    std::vector<std::vector<mush::InterPoint>> batched_sets;
+    for (const auto& data : data_sets)
+    {
+        missing_points.push_back(std::count_if(data.begin(), data.end(), [](const mush::InterPoint& point) { return point.weight == 0.0; }));
+        if (missing_points.back() == 0 && regularization == 0.0)
+        {
+            batched_sets.push_back(data);
+        }
+    }
 
-    log << "Crushing functions smaller than " << std::fixed << std::setprecision(9)<<crush_value << "...\n";
-    auto [real_functions, imag_functions] = analyzer.python_cart("x", "y", "np", crush_value);
+    log << "Fit " << data_sets.size() << " data sets, " << batched_sets.size() << " of them with the FFT...\n";
+    mush::ScopedTimer fit_timer("fit");
+    auto batched = mush::Interpolator::fit_batch(slab_lattice, batched_sets);
+
+    std::vector<mush::Interpolator> ipolators;
+    auto next_batched = batched.begin();
+    for (int i = 0; i < data_sets.size(); ++i)
+    {
+        if (missing_points[i] == 0 && regularization == 0.0)
+        {
+            ipolators.push_back(*next_batched++);
+            continue;
+        }
+
+        const auto& [value_key, cleavage_slice] = fitted_slices[i];
+        log << "Fit " << value_key << " at cleavage " << std::fixed << std::setprecision(6) << cleavage_slice << " by least squares, "
+            << missing_points[i] << " of " << data_sets[i].size() << " grid points have no value...\n";
+        ipolators.push_back(mush::Interpolator::fit_least_squares(slab_lattice, data_sets[i], regularization));
+    }
+    fit_timer.stop();
+
+    // The symmetry of the slab, which the coefficients of a star share
+    std::vector<Eigen::Matrix2i> shift_group;
+    if (stars)
+    {
+        auto slab_source = slab_path.empty() ? data_path.parent_path() / "slab.vasp" : slab_path;
+        log << "Reading slab from " << slab_source << "...\n";
+        shift_group = mush::make_shift_group(cu::xtal::Structure::from_poscar(slab_source));
+        log << "Group k-points into stars of " << shift_group.size() << " symmetry operations...\n";
+    }
+
+    auto make_analyzer = [&](const mush::Interpolator& ipolator) {
+        return stars ? mush::Analytiker(ipolator, shift_group) : mush::Analytiker(ipolator);
+    };
+
+    if (!output_dir.empty())
+    {
+        mush::fs::create_directories(output_dir);
+    }
+
+    for (int i = 0; i < ipolators.size(); ++i)
+    {
+        const auto& ipolator = ipolators[i];
+        const auto& [value_key, cleavage_slice] = fitted_slices[i];
 
-    log << "Real functions:\n";
-    log << real_functions;
-    log << "\n\n\n";
-    log << "Imaginary functions:\n";
-    log << imag_functions;
-    log << "\n";
-    log << "Surface lattice vectors:\n";
-    log << "    a: " << ipolator.real_lattice().a()(0) << ", " << ipolator.real_lattice().a()(1) << "\n";
-    log << "    b: " << ipolator.real_lattice().b()(0) << ", " << ipolator.real_lattice().b()(1) << "\n";
+        if (!output_dir.empty())
+        {
+            auto fit_path = output_dir / (value_key + "__" + mush::make_cleave_dirname(cleavage_slice) + ".json");
+            log << "Write fit of " << value_key << " to " << fit_path << "...\n";
+            mush::ScopedTimer write_timer("write_fit");
+            ::write_fit(ipolator, make_analyzer(ipolator), value_key, cleavage_slice, crush_value, fit_path);
+
+            if (!resolution.empty())
+            {
+                mush::ScopedTimer surface_timer("interpolate");
+                auto [lat, ipolvalues] = ipolator.interpolate(resolution[0], resolution[1]);
+                auto batch_surface_path = fit_path;
+                batch_surface_path.replace_extension(".surface.npy");
+                ::write_interpolated_surface(ipolvalues, lat, value_key, cleavage_slice, batch_surface_path);
+            }
+            continue;
+        }
+
+        if (!surface_path.empty())
+        {
+            log << "Reconstruct surface on " << resolution[0] << "x" << resolution[1] << " grid...\n";
+            mush::ScopedTimer surface_timer("interpolate");
+            auto [lat, ipolvalues] = ipolator.interpolate(resolution[0], resolution[1]);
+
+            log << "Write surface to " << surface_path << "...\n";
+            ::write_interpolated_surface(ipolvalues, lat, value_key, cleavage_slice, surface_path);
+        }
+
+        mush::ScopedTimer analyze_timer("analyze");
+        auto analyzer = make_analyzer(ipolator);
+
+        if (ipolators.size() > 1)
+        {
+            log << "\n" << value_key << " at cleavage " << std::fixed << std::setprecision(6) << cleavage_slice << ":\n";
+        }
+        log << "Crushing functions smaller than " << std::fixed << std::setprecision(9)<<crush_value << "...\n";
+        auto [real_functions, imag_functions] = analyzer.python_cart("x", "y", "np", crush_value);
+
+        log << "Real functions:\n";
+        log << real_functions;
+        log << "\n\n\n";
+        log << "Imaginary functions:\n";
+        log << imag_functions;
+        log << "\n";
+        log << "Surface lattice vectors:\n";
+        log << "    a: " << ipolator.real_lattice().a()(0) << ", " << ipolator.real_lattice().a()(1) << "\n";
+        log << "    b: " << ipolator.real_lattice().b()(0) << ", " << ipolator.real_lattice().b()(1) << "\n";
+    }
+
+    if (mush::Profiler::instance().enabled() && !output_dir.empty())
+    {
+        log << "Save profile to " << output_dir / "profile.json" << "...\n";
+        mush::Profiler::instance().write_report(output_dir / "profile.json");
+    }
 
     return;
 }
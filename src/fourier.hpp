@@ -5,6 +5,16 @@
 #include <multishift/definitions.hpp>
 
 void setup_subcommand_fourier(CLI::App& app);
-void run_subcommand_fourier(const mush::fs::path& data_path, double cleavage_slice, const std::string& value_key, double crush_value, std::ostream& log);
+void run_subcommand_fourier(const mush::fs::path& data_path,
+                            const std::vector<std::string>& cleavage_slices,
+                            const std::vector<std::string>& value_keys,
+                            double crush_value,
+                            const mush::fs::path& surface_path,
+                            const std::vector<int>& resolution,
+                            const mush::fs::path& output_dir,
+                            double regularization,
+                            bool stars,
+                            const mush::fs::path& slab_path,
+                            std::ostream& log);
 
 #endif
@@ -1,31 +1,16 @@
 #include "./misc.hpp"
+#include <algorithm>
+#include <casmutils/xtal/lattice.hpp>
+#include <casmutils/xtal/structure_tools.hpp>
+#include <chrono>
 #include <fstream>
+#include <iomanip>
+#include <multishift/profile.hpp>
 #include <stdexcept>
 #include <string>
 
 namespace mush
 {
-std::string MultiRecord::id() const
-{
-    std::string id = std::to_string(a_index) + ":" + std::to_string(b_index) + ":";
-
-    std::stringstream cleavestream;
-    cleavestream << std::fixed << std::setprecision(6) << cleavage;
-
-    id+=cleavestream.str();
-    return id;
-}
-
-std::string make_cleave_dirname(double cleavage)
-{
-    std::stringstream cleavestream;
-    cleavestream << std::fixed << std::setprecision(6) << cleavage;
-    return "cleave__" + cleavestream.str();
-}
-
-std::string make_shift_dirname(int a, int b) { return "shift__" + std::to_string(a) + "." + std::to_string(b); }
-
-
 json load_json(const mush::fs::path& json_path)
 {
     std::ifstream settings_stream(json_path);
@@ -41,6 +26,108 @@ void write_json(const json& json, const mush::fs::path& target)
     return;
 }
 
+void write_npy(const std::vector<double>& values, const std::vector<int>& shape, const mush::fs::path& target)
+{
+    std::size_t total = 1;
+    std::string shape_str = "(";
+    for (int d : shape)
+    {
+        total *= d;
+        shape_str += std::to_string(d) + ", ";
+    }
+    shape_str += ")";
+
+    if (total != values.size())
+    {
+        throw std::runtime_error("Cannot write " + std::to_string(values.size()) + " values to " + target.string() + " with shape " +
+                                 shape_str);
+    }
+
+    // Version 1.0 of the format: magic string, version, little endian header length, then
+    // a python dict literal padded with spaces so the data starts at a multiple of 64 bytes
+    const std::string magic("\x93NUMPY\x01\x00", 8);
+    std::string header = "{'descr': '<f8', 'fortran_order': False, 'shape': " + shape_str + ", }";
+    std::size_t unpadded = magic.size() + 2 + header.size() + 1;
+    header.append((64 - unpadded % 64) % 64, ' ');
+    header.push_back('\n');
+
+    std::ofstream npy_stream(target, std::ios::binary);
+    npy_stream.write(magic.data(), magic.size());
+    npy_stream.put(static_cast<char>(header.size() & 0xff));
+    npy_stream.put(static_cast<char>((header.size() >> 8) & 0xff));
+    npy_stream.write(header.data(), header.size());
+    npy_stream.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+    return;
+}
+
+PoscarCost measure_poscar_cost(const cu::xtal::Structure& structure)
+{
+    //Format a few times so the timing isn't dominated by a single cold run
+    const int repeats = 8;
+    std::size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        std::stringstream poscar_stream;
+        cu::xtal::print_poscar(structure, poscar_stream);
+        bytes = poscar_stream.str().size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double num_atoms = std::max<std::size_t>(structure.basis_sites().size(), 1);
+    PoscarCost cost;
+    cost.bytes_per_atom = bytes / num_atoms;
+    cost.seconds_per_atom = elapsed.count() / repeats / num_atoms;
+    return cost;
+}
+
+cu::xtal::Lattice make_pseudo_slab_lattice(const json& record)
+{
+    auto su = record["shift_units"];
+    Eigen::Vector3d au(su[0][0], su[0][1], 0.0);
+    Eigen::Vector3d bu(su[1][0], su[1][1], 0.0);
+    Eigen::Vector3d c(0, 0, 1);
+
+    int amax = record["grid"][0];
+    int bmax = record["grid"][1];
+
+    return cu::xtal::Lattice(au * amax, bu * bmax, c);
+}
+
+RecordFit fit_record(const mush::fs::path& data_path, const std::string& value_key, double cleavage, std::ostream& log)
+{
+    log << "Load data from " << data_path << "...\n";
+    mush::ScopedTimer read_timer("read_record");
+    RecordReader record(data_path, {value_key});
+    read_timer.stop();
+
+    auto recorded_cleavages = record.cleavages();
+    auto recorded = std::find_if(recorded_cleavages.begin(), recorded_cleavages.end(), [cleavage](double c) { return almost_equal(c, cleavage, 1e-8); });
+    if (recorded == recorded_cleavages.end())
+    {
+        throw std::runtime_error("The record " + data_path.string() + " has no structures at cleavage " + std::to_string(cleavage) + ".");
+    }
+
+    mush::ScopedTimer fit_timer("fit");
+    auto data = record.unrolled_data(*recorded, value_key, true);
+    int missing_points = std::count_if(data.begin(), data.end(), [](const InterPoint& point) { return point.weight == 0.0; });
+    bool incomplete = missing_points > 0;
+    log << "Fit " << value_key << " at cleavage " << std::fixed << std::setprecision(6) << *recorded;
+    if (incomplete)
+    {
+        log << " by least squares, " << missing_points << " of " << data.size() << " grid points have no value...\n";
+    }
+    else
+    {
+        log << " with the FFT...\n";
+    }
+    auto lattice = make_pseudo_slab_lattice(record.header());
+    auto ipolator = incomplete ? Interpolator::fit_least_squares(lattice, data) : Interpolator(lattice, data);
+    fit_timer.stop();
+
+    return RecordFit{std::move(record), *recorded, std::move(ipolator)};
+}
+
 void cautious_create_directory(const mush::fs::path new_dir)
 {
     if (mush::fs::exists(new_dir))
@@ -2,9 +2,13 @@
 #define MAIN_MISC_HH
 
 #include <multishift/definitions.hpp>
+#include <multishift/chain.hpp>
+#include <multishift/fourier.hpp>
+#include <multishift/record.hpp>
 #include <multishift/slicer.hpp>
 #include <casmutils/xtal/structure.hpp>
 #include <nlohmann/json.hpp>
+#include <ostream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -13,29 +17,45 @@
 namespace mush
 {
 
+json load_json(const mush::fs::path& json_path);
+void write_json(const json& json, const mush::fs::path& target);
+
+///Write row-major values to a numpy .npy binary file (little endian doubles) with the given shape
+void write_npy(const std::vector<double>& values, const std::vector<int>& shape, const mush::fs::path& target);
+
 /**
- * Keeps all the info for a particular structure, cleavage
+ * Cost of writing a structure as a POSCAR, measured by formatting a structure in memory.
+ * Used to estimate how much disk space and time a run will take before it happens.
+ * Both values scale with the number of atoms, and ignore file system latency.
  */
 
-struct MultiRecord
+struct PoscarCost
 {
-    double cleavage=0.0;
-    int a_index=0;
-    int b_index=0;
-    std::string id() const;
-    std::vector<std::string> equivalent_structures;
+    double bytes_per_atom=0.0;
+    double seconds_per_atom=0.0;
 };
 
-enum class SUBCOMMAND {CLEAVE,SHIFT,CHAIN};
+PoscarCost measure_poscar_cost(const cu::xtal::Structure& structure);
 
-std::string make_cleave_dirname(double cleavage);
-std::string make_shift_dirname(int a, int b);
-template<SUBCOMMAND>
-mush::fs::path make_target_directory(const mush::MultiRecord& record);
+///Lattice whose a and b vectors span the shift grid of a record (from its "grid" and "shift_units"), on the xy-plane.
+///Same as the aligned slab, without needing the slab itself.
+cu::xtal::Lattice make_pseudo_slab_lattice(const json& record);
 
+/**
+ * Values of a record made by shift or chain, fitted at one of its cleavages.
+ * The cleavage is the one as it was recorded, which only matches the requested one within a tolerance.
+ */
 
-json load_json(const mush::fs::path& json_path);
-void write_json(const json& json, const mush::fs::path& target);
+struct RecordFit
+{
+    RecordReader record;
+    double cleavage;
+    Interpolator ipolator;
+};
+
+///Load the record, find the requested cleavage in it (or throw if there is none) and fit the values of the key there.
+///Grid points without a value (e.g. only the irreducible structures were computed) are fitted by least squares.
+RecordFit fit_record(const mush::fs::path& data_path, const std::string& value_key, double cleavage, std::ostream& log);
 
 ///If directory already exists, throw exception, otherwise continue normally
 void cautious_create_directory(const mush::fs::path new_dir);
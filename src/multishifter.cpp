@@ -1,4 +1,5 @@
 #include <CLI/CLI.hpp>
+#include <iostream>
 #include <ostream>
 #include "./misc.hpp"
 #include "./slice.hpp"
@@ -11,6 +12,10 @@
 #include "./mutate.hpp"
 #include "./translate.hpp"
 #include "./align.hpp"
+#include "./extract.hpp"
+#include "./adapt.hpp"
+#include "./paths.hpp"
+#include <multishift/profile.hpp>
 
 int main(int argc, char** argv)
 {
@@ -28,13 +33,25 @@ int main(int argc, char** argv)
     setup_subcommand_shift(app);
     setup_subcommand_fourier(app);
     setup_subcommand_twist(app);
+    setup_subcommand_extract(app);
+    setup_subcommand_adapt(app);
+    setup_subcommand_paths(app);
 
     app.require_subcommand();
 
+    app.add_flag_callback("--profile", []() { mush::Profiler::instance().enable(); }, "Time each phase of the run, and count the structures and bytes written. The report is saved as profile.json in the output directory (or the working directory if there isn't one).");
+
     app.get_formatter()->column_width(40);
     app.get_formatter()->label("REQUIRED","*");
 
     CLI11_PARSE(app, argc, argv);
 
+    auto& profiler = mush::Profiler::instance();
+    if (profiler.enabled() && !profiler.reported())
+    {
+        std::cout << "Save profile to " << mush::fs::path("profile.json") << "...\n";
+        profiler.write_report("profile.json");
+    }
+
     return 0;
 }
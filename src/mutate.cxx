@@ -5,6 +5,7 @@
 #include "casmutils/xtal/structure.hpp"
 #include <casmutils/mush/shift.hpp>
 #include <memory>
+#include <multishift/profile.hpp>
 #include <vector>
 #include <casmutils/xtal/structure_tools.hpp>
 #include <casmutils/xtal/coordinate.hpp>
@@ -29,7 +30,9 @@ void setup_subcommand_mutate(CLI::App& app)
 void run_subcommand_mutate(const mush::fs::path& input_path, const mush::fs::path& output_path, const std::vector<double>& mutation, bool frac, std::ostream& log)
 {
     log << "Loading structure...\n";
+    mush::ScopedTimer read_timer("read_structure");
     auto struc=mush::cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
 
     Eigen::Vector3d vec_cart(mutation[0],mutation[1],mutation[2]);
     Eigen::Vector3d vec_frac=mush::cu::xtal::fractional_to_cartesian(vec_cart,struc.lattice());
@@ -47,8 +50,11 @@ void run_subcommand_mutate(const mush::fs::path& input_path, const mush::fs::pat
     }
 
     log << "Mutate c-vector by "<<vec_cart.transpose()<<" (Cartesian) or "<<vec_frac.transpose()<<" (fractional)...\n";
+    mush::ScopedTimer mutate_timer("mutate");
     struc=mush::mutate(struc,vec_cart);
+    mutate_timer.stop();
 
     log << "Write to "+output_path.string()<<"...\n";
+    mush::ScopedTimer write_timer("write_structure");
     mush::cu::xtal::write_poscar(struc,output_path);
 }
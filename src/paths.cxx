@@ -0,0 +1,160 @@
+#include "./paths.hpp"
+#include "./common_options.hpp"
+#include "./misc.hpp"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <multishift/evaluator.hpp>
+#include <multishift/fourier.hpp>
+#include <multishift/paths.hpp>
+#include <multishift/profile.hpp>
+#include <multishift/record.hpp>
+#include <stdexcept>
+
+namespace
+{
+mush::json serialize(const mush::StationaryPoint& point)
+{
+    mush::json serialized;
+    serialized["cart"] = {point.cart(0), point.cart(1)};
+    serialized["frac"] = {point.frac(0), point.frac(1)};
+    serialized["value"] = point.value;
+    serialized["curvatures"] = {point.curvatures(0), point.curvatures(1)};
+    serialized["soft_mode"] = {point.soft_mode(0), point.soft_mode(1)};
+    serialized["order"] = point.order;
+    return serialized;
+}
+} // namespace
+
+void setup_subcommand_paths(CLI::App& app)
+{
+    auto data_path_ptr = std::make_shared<mush::fs::path>();
+    auto value_key_ptr = std::make_shared<std::string>();
+    auto cleavage_ptr = std::make_shared<double>();
+    auto seeds_ptr = std::make_shared<int>();
+    auto path_minima_ptr = std::make_shared<std::vector<int>>(std::vector<int>{0, 0});
+    auto translation_ptr = std::make_shared<std::vector<int>>(std::vector<int>{1, 0});
+    auto images_ptr = std::make_shared<int>();
+    auto output_path_ptr = std::make_shared<mush::fs::path>();
+
+    CLI::App* paths_sub = app.add_subcommand("paths", "Find the minima, saddle points and minimum energy glide path of a gamma surface.");
+
+    paths_sub
+        ->add_option("-d,--data",
+                     *data_path_ptr,
+                     "Amended 'record.json' like file from shift or chain, with computed values for the structure ids. Grid points without a value are fitted by least squares.")
+        ->required();
+    paths_sub->add_option("-k,--key", *value_key_ptr, "Key of the values that get fitted.")->required();
+    paths_sub->add_option("-c,--cleavage", *cleavage_ptr, "Cleavage value of the surface.")->default_val(0.0);
+    paths_sub->add_option("-s,--seeds", *seeds_ptr, "Start a search for stationary points from each point of a grid this many points along a and b.")
+        ->default_val(12)
+        ->check(CLI::PositiveNumber);
+    paths_sub->add_option("-p,--path", *path_minima_ptr, "Indexes of the minima the path goes from and to, lowest minimum first.")->expected(2);
+    paths_sub->add_option("-t,--translate", *translation_ptr, "Lattice translation along a and b of the minimum the path goes to. The default glides from a minimum to its own image along a.")
+        ->expected(2);
+    paths_sub->add_option("-n,--images", *images_ptr, "Number of images along the path, including both ends.")->default_val(33)->check(CLI::PositiveNumber);
+    populate_subcommand_output_option(paths_sub, output_path_ptr.get());
+
+    paths_sub->callback([=]() {
+        run_subcommand_paths(*data_path_ptr,
+                             *value_key_ptr,
+                             *cleavage_ptr,
+                             *seeds_ptr,
+                             *path_minima_ptr,
+                             *translation_ptr,
+                             *images_ptr,
+                             *output_path_ptr,
+                             std::cout);
+    });
+}
+
+void run_subcommand_paths(const mush::fs::path& data_path,
+                          const std::string& value_key,
+                          double cleavage,
+                          int seeds,
+                          const std::vector<int>& path_minima,
+                          const std::vector<int>& translation,
+                          int images,
+                          const mush::fs::path& output_path,
+                          std::ostream& log)
+{
+    auto [record, recorded_cleavage, ipolator] = mush::fit_record(data_path, value_key, cleavage, log);
+    mush::SurfaceEvaluator surface(ipolator);
+
+    //The surface is evaluated in Cartesian coordinates of the aligned lattice
+    Eigen::Matrix2d cell;
+    cell.col(0) = ipolator.real_lattice().a().head<2>();
+    cell.col(1) = ipolator.real_lattice().b().head<2>();
+
+    log << "Search for stationary points from " << seeds << "x" << seeds << " starting points...\n";
+    auto stationary_points = mush::find_stationary_points(surface, cell, seeds);
+
+    std::vector<mush::StationaryPoint> minima;
+    std::copy_if(stationary_points.begin(), stationary_points.end(), std::back_inserter(minima), [](const mush::StationaryPoint& point) {
+        return point.order == 0;
+    });
+    int saddles = std::count_if(stationary_points.begin(), stationary_points.end(), [](const mush::StationaryPoint& point) { return point.order == 1; });
+    log << "Found " << minima.size() << " minima, " << saddles << " saddle points and " << stationary_points.size() - minima.size() - saddles
+        << " maxima.\n";
+
+    for (int ix : path_minima)
+    {
+        if (ix < 0 || ix >= minima.size())
+        {
+            throw std::runtime_error("There is no minimum " + std::to_string(ix) + ", only " + std::to_string(minima.size()) + " were found.");
+        }
+    }
+
+    const auto& from = minima[path_minima[0]];
+    const auto& to = minima[path_minima[1]];
+    Eigen::Vector2d end = to.cart + cell * Eigen::Vector2d(translation[0], translation[1]);
+
+    log << "Relax path from minimum " << path_minima[0] << " to minimum " << path_minima[1] << " translated by " << translation[0] << "a+" << translation[1]
+        << "b...\n";
+    mush::StringSettings settings;
+    settings.images = images;
+    auto path = mush::find_minimum_energy_path(surface, cell, from.cart, end, settings);
+    if (!path.converged)
+    {
+        log << "WARNING: The path didn't converge after " << path.iterations << " iterations.\n";
+    }
+    if (!path.has_saddle)
+    {
+        log << "WARNING: No saddle point was found next to the highest image, the barrier is the one of the highest image.\n";
+    }
+    log << "Barrier: " << path.barrier << "\n";
+
+    mush::json paths;
+    paths["data"] = data_path;
+    paths["key"] = value_key;
+    paths["cleavage"] = recorded_cleavage;
+    paths["lattice"] = {{cell(0, 0), cell(1, 0)}, {cell(0, 1), cell(1, 1)}};
+    paths["stationary_points"] = mush::json::array();
+    for (const auto& point : stationary_points)
+    {
+        paths["stationary_points"].push_back(::serialize(point));
+    }
+
+    mush::json& serialized_path = paths["path"];
+    serialized_path["minima"] = path_minima;
+    serialized_path["translation"] = translation;
+    serialized_path["cart"] = mush::json::array();
+    serialized_path["frac"] = mush::json::array();
+    for (const auto& point : path.points)
+    {
+        Eigen::Vector2d frac = cell.inverse() * point;
+        serialized_path["cart"].push_back({point(0), point(1)});
+        serialized_path["frac"].push_back({frac(0), frac(1)});
+    }
+    serialized_path["values"] = path.values;
+    serialized_path["arc_lengths"] = path.arc_lengths;
+    serialized_path["highest_image"] = path.highest_image;
+    serialized_path["barrier"] = path.barrier;
+    serialized_path["saddle"] = path.has_saddle ? ::serialize(path.saddle) : mush::json();
+    serialized_path["converged"] = path.converged;
+    serialized_path["iterations"] = path.iterations;
+
+    log << "Save paths to " << output_path << "...\n";
+    mush::write_json(paths, output_path);
+    return;
+}
@@ -0,0 +1,24 @@
+#ifndef PATHS_SUBCOMMAND_HH
+#define PATHS_SUBCOMMAND_HH
+
+#include <CLI/CLI.hpp>
+#include <multishift/definitions.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+void setup_subcommand_paths(CLI::App& app);
+
+//Fit the values of a record made by shift or chain, find the minima and saddle points of the surface, and
+//the minimum energy path from one minimum to a periodic image of another, shifted by whole lattice vectors
+void run_subcommand_paths(const mush::fs::path& data_path,
+                          const std::string& value_key,
+                          double cleavage,
+                          int seeds,
+                          const std::vector<int>& path_minima,
+                          const std::vector<int>& translation,
+                          int images,
+                          const mush::fs::path& output_path,
+                          std::ostream& log);
+
+#endif
@@ -5,17 +5,12 @@
 #include <casmutils/xtal/structure_tools.hpp>
 #include <multishift/slice_settings.hpp>
 
-template<>
-mush::fs::path mush::make_target_directory<mush::SUBCOMMAND::SHIFT>(const mush::MultiRecord& record)
-{
-    return mush::make_shift_dirname(record.a_index,record.b_index);
-}
-
 void setup_subcommand_shift(CLI::App& app)
 {
     auto input_path_ptr = std::make_shared<mush::fs::path>();
     auto output_path_ptr = std::make_shared<mush::fs::path>();
     auto grid_dims_ptr = std::make_shared<std::vector<int>>();
+    auto options_ptr = std::make_shared<ChainOptions>();
 
     CLI::App* shift_sub = app.add_subcommand("shift", "Shift slabs parallel to each other at regular intervals.");
 
@@ -29,5 +24,7 @@ void setup_subcommand_shift(CLI::App& app)
         ->expected(2)
         ->required();
 
-    shift_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::SHIFT>(*input_path_ptr, *output_path_ptr, {0.0}, *grid_dims_ptr, std::cout); });
+    populate_subcommand_chain_options(shift_sub, options_ptr.get());
+
+    shift_sub->callback([=]() { run_subcommand_chain<mush::SUBCOMMAND::SHIFT>(*input_path_ptr, *output_path_ptr, {0.0}, *grid_dims_ptr, *options_ptr, std::cout); });
 }
@@ -8,6 +8,7 @@
 #include <filesystem>
 #include <memory>
 #include <multishift/slice_settings.hpp>
+#include <multishift/profile.hpp>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -40,7 +41,9 @@ void run_subcommand_slice(
     const mush::fs::path& input_path, const mush::fs::path& output_path, const std::vector<int>& millers, bool align, std::ostream& log)
 {
     log << "Reading " << input_path << "...\n";
+    mush::ScopedTimer read_timer("read_structure");
     auto prim = mush::cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
 
     if (millers.size() != 3)
     {
@@ -48,6 +51,7 @@ void run_subcommand_slice(
     }
 
     log << "Slice along (" << millers[0]<<", "<<millers[1]<<", "<<millers[2]<<")...\n";
+    mush::ScopedTimer slice_timer("slice");
     auto sliced_prim=mush::cu::xtal::slice_along_plane(prim, Eigen::Vector3i(millers[0],millers[1],millers[2]));
 
     if(align)
@@ -55,7 +59,9 @@ void run_subcommand_slice(
         log<<"Align exposed plane to xy plane...\n";
         mush::make_aligned(&sliced_prim);
     }
+    slice_timer.stop();
 
     log << "Write final structure to "<<output_path<<"...\n";
+    mush::ScopedTimer write_timer("write_structure");
     mush::cu::xtal::write_poscar(sliced_prim,output_path);
 }
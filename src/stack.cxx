@@ -5,6 +5,7 @@
 #include "casmutils/xtal/frankenstein.hpp"
 #include "casmutils/mush/slab.hpp"
 #include "multishift/slice_settings.hpp"
+#include "multishift/profile.hpp"
 #include <filesystem>
 #include <memory>
 
@@ -25,17 +26,22 @@ void setup_subcommand_stack(CLI::App& app)
 void run_subcommand_stack(const std::vector<mush::fs::path>& input_paths, const mush::fs::path& output_path, std::ostream& log)
 {
     log << "Loading structures...\n";
+    mush::ScopedTimer read_timer("read_structure");
     std::vector<mush::cu::xtal::Structure> strucs;
     for(const auto& p : input_paths)
     {
         auto struc_in=cu::xtal::Structure::from_poscar(p);
         strucs.emplace_back(mush::make_aligned(struc_in));
     }
+    read_timer.stop();
 
     log << "Stacking structures...\n";
+    mush::ScopedTimer stack_timer("stack");
     auto stacked=mush::orthogonalize_c_vector(mush::cu::frankenstein::stack(strucs));
     stacked.within();
+    stack_timer.stop();
 
     log << "Write to "+output_path.string()<<"...\n";
+    mush::ScopedTimer write_timer("write_structure");
     mush::cu::xtal::write_poscar(stacked,output_path);
 }
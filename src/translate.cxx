@@ -8,6 +8,7 @@
 #include <casmutils/xtal/coordinate.hpp>
 #include <filesystem>
 #include <memory>
+#include <multishift/profile.hpp>
 #include <multishift/slice_settings.hpp>
 #include <stdexcept>
 #include <string>
@@ -47,7 +48,9 @@ void run_subcommand_translate(const mush::fs::path& input_path,
                               std::ostream& log)
 {
     log<<"Reading "<<input_path<<"...\n";
+    mush::ScopedTimer read_timer("read_structure");
     auto struc = mush::cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
     Eigen::Vector3d shift(_shift[0],_shift[1],_shift[2]);
 
     if (floor_ix != 0)
@@ -79,11 +82,15 @@ void run_subcommand_translate(const mush::fs::path& input_path,
 
 
     log<<"Translating basis by "<<shift.transpose()<<" (Cartesian) or "<<frac_shift.transpose()<<" (fractional)...\n";
+    mush::ScopedTimer translate_timer("translate");
     auto translated_struc=mush::cu::frankenstein::translate_basis(struc,shift);
     translated_struc.within();
+    translate_timer.stop();
 
     log<<"Write final structure to "<<output_path<<"...\n";
+    mush::ScopedTimer write_timer("write_structure");
     mush::cu::xtal::write_poscar(translated_struc,output_path);
+    write_timer.stop();
 
     return;
 }
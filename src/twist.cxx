@@ -3,7 +3,15 @@
 #include "./misc.hpp"
 #include <casmutils/mush/twist.hpp>
 #include <casmutils/xtal/structure_tools.hpp>
+#include <chrono>
+#include <cmath>
 #include <filesystem>
+#include <multishift/parallel.hpp>
+#include <multishift/pareto.hpp>
+#include <multishift/profile.hpp>
+#include <multishift/sweep.hpp>
+#include <mutex>
+#include <numeric>
 #include <ostream>
 #include <utility>
 #include <vector>
@@ -15,10 +23,14 @@ void setup_subcommand_twist(CLI::App& app)
     auto input_path_ptr = std::make_shared<mush::fs::path>();
     auto output_path_ptr = std::make_shared<mush::fs::path>();
     auto angles_ptr = std::make_shared<std::vector<double>>();
+    auto sweep_ptr = std::make_shared<std::vector<double>>();
     auto max_lattice_sites_ptr = std::make_shared<int>();
     auto error_tol_ptr = std::make_shared<double>();
     auto zone_ptr = std::make_shared<std::string>();
     auto supercells_ptr = std::make_shared<std::string>();
+    auto pareto_size_ptr = std::make_shared<int>();
+    auto plan_path_ptr = std::make_shared<mush::fs::path>();
+    auto threads_ptr = std::make_shared<int>();
 
     CLI::App* twist_sub =
         app.add_subcommand("twist", "Create approximate supercells that can accommodate emerging moirons from a specified rotation angle.");
@@ -27,20 +39,28 @@ void setup_subcommand_twist(CLI::App& app)
     populate_subcommand_output_option(twist_sub, output_path_ptr.get());
 
     // clang-format off
-    twist_sub->add_option("-a,--angles", *angles_ptr, "Rotation angles to twist the structure with in degrees. Rotation is applied at the origin, perpendicular to the ab-plane.")->required();
+    auto angles_opt=twist_sub->add_option("-a,--angles", *angles_ptr, "Rotation angles to twist the structure with in degrees. Rotation is applied at the origin, perpendicular to the ab-plane.");
+    twist_sub->add_option("--sweep", *sweep_ptr, "Twist by every angle from start to stop (inclusive) in steps of the given size, in degrees. Each angle starts looking for the best supercell from the size chosen for the previous one, and only stops short of max-lattice-sites once it has found a supercell within --error-tol of being exact, so the structures are the same as with --angles.")->expected(3)->excludes(angles_opt);
     twist_sub->add_option("-m,--max-lattice-sites", *max_lattice_sites_ptr, "Sets the maximum search space for more commensurate Moire supercells. If zero, don't try looking for supercells.")->default_val(0);
     twist_sub->add_option("-e,--error-tol", *error_tol_ptr, "Minimum improvement necessary to consider a larger supercell better than a smaller one.")->default_val(1e-8);
     twist_sub->add_option("-z,--brillouin-zone", *zone_ptr, "Which Brillouin zone to use when mapping reciprocal Moire lattice vectors back into the first Brillouin zone.")->default_val("aligned")->check(CLI::IsMember({"aligned","rotated"},CLI::ignore_case));
-    twist_sub->add_option("-s,--supercells", *supercells_ptr, "Specify whether only the best supercell or every possible supercell that can hold max-lattice-sites should be saved.")->default_val("best")->check(CLI::IsMember({"best","all"},CLI::ignore_case));
+    twist_sub->add_option("-s,--supercells", *supercells_ptr, "Specify whether only the best supercell, every possible supercell that can hold max-lattice-sites, or only the best trade-offs between size and strain (pareto) should be saved.")->default_val("best")->check(CLI::IsMember({"best","all","pareto"},CLI::ignore_case));
+    twist_sub->add_option("--pareto-size", *pareto_size_ptr, "Maximum number of supercells to keep for each angle with --supercells pareto. The ones kept are spread along the front, always including the smallest and the least strained. Every supercell up to max-lattice-sites is still searched, so this limits the output, not the memory or time of the search.")->default_val(8)->check(CLI::PositiveNumber);
+    twist_sub->add_option("-j,--threads", *threads_ptr, "Number of threads used to twist several angles at once. Use 0 for all available cores. The record is the same regardless of the number of threads.")->default_val(1);
     // clang-format off
+    populate_subcommand_plan_option(twist_sub, plan_path_ptr.get());
 
     twist_sub->callback([=]() {run_subcommand_twist(*input_path_ptr,
             *output_path_ptr,
             *angles_ptr,
+            *sweep_ptr,
             *max_lattice_sites_ptr,
             *error_tol_ptr,
             *zone_ptr,
             *supercells_ptr,
+            *pareto_size_ptr,
+            *plan_path_ptr,
+            *threads_ptr,
             std::cout); });
 }
 
@@ -124,25 +144,169 @@ mush::json serialize(const mush::MoireStructureReport& moire)
     return report;
 }
 
-void commit_twisted_id(double twist, const mush::MoireStructureReport& best_report, mush::json* _record, const mush::fs::path& output_dir, const mush::fs::path& root, mush::MoireStructureReport::LATTICE lat)
+//Strain needed to make the supercell commensurate, as the norm of the strain metrics
+double strain_cost(const mush::MoireLatticeReport& report)
 {
-    mush::json& twist_record=*_record;
+    return mush::DeformationReport(report.approximation_deformation).strain_metrics.norm();
+}
 
-                auto id=make_twist_id(twist,best_report);
-                
-                twist_record[id][lat_to_name(lat)]=serialize(best_report);
-                auto tile_path=root/(lat_to_name(lat)+"_tile.vasp");
-                twist_record[id][lat_to_name(lat)]["tile"]=tile_path;
-                auto layer_path=root/(lat_to_name(lat)+"_layer.vasp");
-                twist_record[id][lat_to_name(lat)]["layer"]=layer_path;
+//A single twisted layer, as it goes into the record
+struct TwistedLayer
+{
+    std::string id;
+    std::string lattice;
+    mush::json chunk;
+    int moirons;
+    double strain;
+};
+
+//Writes the tile and layer of the report. Files are only written while holding io_mutex, so that
+//several angles can be handled at once.
+TwistedLayer commit_twisted_id(double twist, const mush::MoireStructureReport& best_report, const mush::fs::path& output_dir, const mush::fs::path& root, mush::MoireStructureReport::LATTICE lat, std::mutex* io_mutex)
+{
+    TwistedLayer layer;
+    layer.id=make_twist_id(twist,best_report);
+    layer.lattice=lat_to_name(lat);
+    layer.moirons=best_report.num_moirons();
+    layer.strain=strain_cost(best_report);
+
+    layer.chunk=serialize(best_report);
+    auto tile_path=root/(lat_to_name(lat)+"_tile.vasp");
+    layer.chunk["tile"]=tile_path;
+    auto layer_path=root/(lat_to_name(lat)+"_layer.vasp");
+    layer.chunk["layer"]=layer_path;
+
+    std::lock_guard<std::mutex> lock(*io_mutex);
+    mush::ScopedTimer timer("write_poscar");
+    mush::fs::create_directories(output_dir/root);
+    cu::xtal::write_poscar(best_report.approximate_tiling_unit_structure,output_dir/tile_path);
+    cu::xtal::write_poscar(best_report.approximate_moire_structure,output_dir/layer_path);
+
+    if(mush::Profiler::instance().enabled())
+    {
+        mush::profile_count("structures_written",2);
+        mush::profile_count("bytes_written",mush::fs::file_size(output_dir/tile_path)+mush::fs::file_size(output_dir/layer_path));
+    }
 
-                cu::xtal::write_poscar(best_report.approximate_tiling_unit_structure,output_dir/tile_path);
-                cu::xtal::write_poscar(best_report.approximate_moire_structure,output_dir/root/(lat_to_name(lat)+"_layer.vasp"));
+    return layer;
+}
 
-    return;
+//Indexes of the reports (ordered by increasing size, as best_of_each_size gives them) that are the
+//best trade-offs between the number of moirons and strain, keeping at most max_size of them spread
+//along the front. The reports come from a search over every size, so this only trims what gets written.
+template<typename ReportType>
+std::vector<int> select_pareto_front(const std::vector<ReportType>& reports, int max_size)
+{
+    mush::ParetoFront<int> front(max_size);
+    for(int i=0; i<reports.size(); ++i)
+    {
+        front.insert(reports[i].num_moirons(),strain_cost(reports[i]),i);
+    }
+
+    std::vector<int> selected;
+    for(const auto& entry : front.entries())
+    {
+        selected.push_back(entry.item);
+    }
+    return selected;
+}
+
+//Only runs the supercell search on the lattice of the slab, without constructing any of the
+//twisted structures, and reports how many structures and atoms would be written
+mush::json make_twist_plan(const cu::xtal::Structure& slab, const std::vector<double>& angles, int max_lattice_sites, double error_tol, mush::MoireLatticeReport::ZONE bz, const std::string& supercells, int pareto_size, int threads, std::ostream& log)
+{
+    using LATTICE=mush::MoireLatticeReport::LATTICE;
+
+    int slab_atoms=slab.basis_sites().size();
+    double slab_volume=std::abs(slab.lattice().column_vector_matrix().determinant());
+    auto cost=mush::measure_poscar_cost(slab);
+
+    std::vector<mush::json> angle_plans(angles.size());
+    std::vector<long> atoms_per_angle(angles.size(),0);
+    std::vector<int> structures_per_angle(angles.size(),0);
+    std::vector<double> seconds_per_angle(angles.size(),0.0);
+    std::mutex log_mutex;
+    mush::parallel_for(angles.size(), threads, [&](int t) {
+        const double twist=angles[t];
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            log << "Search supercells for " << std::fixed << std::setprecision(6) << twist << " degrees...\n";
+        }
+        auto start=std::chrono::steady_clock::now();
+        mush::MoireApproximator moirenator(slab.lattice(),twist);
+        moirenator.expand(max_lattice_sites);
+
+        mush::json& angle_plan=angle_plans[t];
+        angle_plan["angle"]=twist;
+        angle_plan["minimum_lattice_sites"]=moirenator.minimum_lattice_sites(bz);
+        for(auto lat : {LATTICE::ALIGNED,LATTICE::ROTATED})
+        {
+            std::vector<mush::MoireLatticeReport> reports;
+            if(supercells=="best")
+            {
+                reports.push_back(moirenator.best_smallest(bz,lat,error_tol));
+            }
+            else if(supercells=="pareto")
+            {
+                auto candidates=moirenator.best_of_each_size(bz,lat);
+                for(int i : select_pareto_front(candidates,pareto_size))
+                {
+                    reports.push_back(candidates[i]);
+                }
+            }
+            else
+            {
+                reports=moirenator.best_of_each_size(bz,lat);
+            }
+
+            for(const auto& report : reports)
+            {
+                //Every layer is a supercell of the tile, which has as many atoms as the slab
+                double moire_volume=std::abs(report.approximate_moire_lattice.column_vector_matrix().determinant());
+                int layer_atoms=slab_atoms*std::lround(moire_volume/slab_volume);
+
+                mush::json supercell_plan;
+                supercell_plan["id"]=make_twist_id(twist,report);
+                supercell_plan["moirons"]=report.num_moirons();
+                supercell_plan["tile_atoms"]=slab_atoms;
+                supercell_plan["layer_atoms"]=layer_atoms;
+                angle_plan[lat_to_name(report.lattice)].push_back(supercell_plan);
+
+                atoms_per_angle[t]+=slab_atoms+layer_atoms;
+                structures_per_angle[t]+=2;
+            }
+        }
+        std::chrono::duration<double> search_time=std::chrono::steady_clock::now()-start;
+        seconds_per_angle[t]=search_time.count();
+    });
+
+    long total_atoms=std::accumulate(atoms_per_angle.begin(),atoms_per_angle.end(),0l);
+    int num_structures=std::accumulate(structures_per_angle.begin(),structures_per_angle.end(),0);
+    double search_seconds=std::accumulate(seconds_per_angle.begin(),seconds_per_angle.end(),0.0);
+
+    //Structures get constructed by tiling, so it takes about as long as writing them.
+    //Angles are spread over the threads, writing files is not.
+    double structure_bytes=total_atoms*cost.bytes_per_atom;
+    double write_seconds=2*total_atoms*cost.seconds_per_atom;
+    int thread_count=mush::resolve_thread_count(threads);
+
+    mush::json plan;
+    plan["subcommand"]="twist";
+    plan["angles"]=angle_plans;
+    plan["max_lattice_sites"]=max_lattice_sites;
+    plan["error_tolerance"]=error_tol;
+    plan["brillouin_zone"]=zone_to_name(bz);
+    plan["supercells"]=supercells;
+    plan["structures"]=num_structures;
+    plan["total_atoms"]=total_atoms;
+    plan["estimated_bytes"]=structure_bytes;
+    plan["threads"]=thread_count;
+    plan["search_seconds"]=search_seconds;
+    plan["estimated_seconds"]=(search_seconds+write_seconds/2)/thread_count+write_seconds/2;
+    return plan;
 }
 
-void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path& output_dir, const std::vector<double>& angles, int max_lattice_sites, double error_tol, std::string zone, std::string supercells, std::ostream& log)
+void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path& output_dir, const std::vector<double>& input_angles, const std::vector<double>& sweep, int max_lattice_sites, double error_tol, std::string zone, std::string supercells, int pareto_size, const mush::fs::path& plan_path, int threads, std::ostream& log)
 {
     //GiVe ArGuMenTs LieK aN eDgY tEEn
     std::transform(zone.begin(),zone.end(),zone.begin(),::tolower);
@@ -157,36 +321,80 @@ void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path
     {
         assert(zone=="rotated");
     }
-                
-    /* mush::cautious_create_directory(output_dir); */
-    mush::fs::create_directory(output_dir);
 
+    const std::vector<double> angles= sweep.empty() ? input_angles : mush::make_sweep_angles(sweep);
+    if(angles.empty())
+    {
+        throw std::runtime_error("Specify the angles to twist by with either --angles or --sweep.");
+    }
+                
     log << "Reading slab from " << input_path << "...\n";
+    mush::ScopedTimer read_timer("read_slab");
     auto slab = cu::xtal::Structure::from_poscar(input_path);
+    read_timer.stop();
     //For consistent printing. Should not be necessary for Appriximator classes, which
     //do it internally as well
     mush::make_aligned(&slab);
 
+    if(!plan_path.empty())
+    {
+        auto plan=make_twist_plan(slab,angles,max_lattice_sites,error_tol,bz,supercells,pareto_size,threads,log);
+        plan["output"]=output_dir;
+        log << "Save plan to "<<plan_path<<"...\n";
+        mush::write_json(plan,plan_path);
+        return;
+    }
+
+    /* mush::cautious_create_directory(output_dir); */
+    mush::fs::create_directory(output_dir);
+
     mush::json record;
     record["angles"]=angles;
     record["max_lattice_sites"]=max_lattice_sites;
     record["error_tolerance"]=error_tol;
+    if(!sweep.empty())
+    {
+        record["sweep"]=sweep;
+    }
 
 
-    mush::json twist_record;
-    for(const double twist : angles)
-    {
-        log << "Twising by " << std::fixed << std::setprecision(6) << twist << " degrees ("<<zone<<" Brillouin zone)...\n";
+    //Angles are handled in any order, but every layer is kept with its angle, and the
+    //record is put together in the order of the angles afterwards
+    std::vector<std::vector<TwistedLayer>> layers_per_angle(angles.size());
+    std::mutex io_mutex;
+
+    //If a sweep budget is given, the search space starts from the size of the supercells that were chosen
+    //for the previous angle, and widens up to max_lattice_sites unless an exact supercell turns up first
+    auto twist_angle=[&](int t, mush::SweepBudget<mush::MoireStructureApproximator>* sweep_budget) {
+        const double twist=angles[t];
+        std::vector<TwistedLayer>& twisted_layers=layers_per_angle[t];
+
+        mush::ScopedTimer search_timer("moire_search");
         mush::MoireStructureApproximator moirenator(slab,twist);
-        if(max_lattice_sites<moirenator.minimum_lattice_sites(bz))
         {
-            log << "Allow minimum possible number of lattice sites in bilayer ("<<moirenator.minimum_lattice_sites(bz)<<")...\n";
+            std::lock_guard<std::mutex> lock(io_mutex);
+            log << "Twising by " << std::fixed << std::setprecision(6) << twist << " degrees ("<<zone<<" Brillouin zone)...\n";
+            if(max_lattice_sites<moirenator.minimum_lattice_sites(bz))
+            {
+                log << "Allow minimum possible number of lattice sites in bilayer ("<<moirenator.minimum_lattice_sites(bz)<<")...\n";
+            }
+            else
+            {
+                log << "Allow up to "<< max_lattice_sites<<" lattice sites in bilayer...\n";
+            }
+        }
+
+        if(sweep_budget==nullptr || supercells!="best")
+        {
+            moirenator.expand(max_lattice_sites);
         }
         else
         {
-            log << "Allow up to "<< max_lattice_sites<<" lattice sites in bilayer...\n";
+            int budget=sweep_budget->expand(&moirenator);
+            std::lock_guard<std::mutex> lock(io_mutex);
+            log << "Searched up to "<<budget<<" lattice sites in bilayer for "<<twist<<" degrees...\n";
         }
-        moirenator.expand(max_lattice_sites);
+        search_timer.stop();
 
         for(auto lat : {LATTICE::ALIGNED,LATTICE::ROTATED})
         {
@@ -195,11 +403,10 @@ void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path
 
                 mush::fs::path root=mush::fs::path(make_twist_dirname(twist));
 
-                mush::fs::create_directories(output_dir/root);
+                mush::ScopedTimer select_timer("moire_select");
                 const auto best_report=moirenator.best_smallest(bz,lat,error_tol);
+                select_timer.stop();
 
-                auto id=make_twist_id(twist,best_report);
-                
                 /* twist_record[id][lat_to_name(lat)]=serialize(best_report); */
                 /* auto tile_path=root/(lat_to_name(lat)+"_tile.vasp"); */
                 /* twist_record[id][lat_to_name(lat)]["tile"]=tile_path; */
@@ -209,18 +416,19 @@ void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path
                 /* cu::xtal::write_poscar(best_report.approximate_tiling_unit_structure,output_dir/tile_path); */
                 /* cu::xtal::write_poscar(best_report.approximate_moire_structure,output_dir/root/(lat_to_name(lat)+"_layer.vasp")); */
 
-                commit_twisted_id(twist,best_report,&twist_record,output_dir,root,lat);
+                twisted_layers.push_back(commit_twisted_id(twist,best_report,output_dir,root,lat,&io_mutex));
 
             }
 
             if(supercells=="all")
             {
+                mush::ScopedTimer select_timer("moire_select");
                 auto best_reports=moirenator.best_of_each_size(bz,lat);
+                select_timer.stop();
                 for(int i=1; i<=best_reports.size(); ++i)
                 {
                     auto root=make_target_structure_dir(twist, lat, i);
 
-                    mush::fs::create_directories(output_dir/root);
                     const auto& best_report=best_reports[i-1];
 
                     /* auto id=make_twist_id(twist,best_report); */
@@ -233,10 +441,58 @@ void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path
 
                     /* cu::xtal::write_poscar(best_report.approximate_tiling_unit_structure,output_dir/tile_path); */
                     /* cu::xtal::write_poscar(best_report.approximate_moire_structure,output_dir/root/(lat_to_name(lat)+"_layer.vasp")); */
-                    commit_twisted_id(twist,best_report,&twist_record,output_dir,root,lat);
+                    twisted_layers.push_back(commit_twisted_id(twist,best_report,output_dir,root,lat,&io_mutex));
                 }
             }
+
+            //Same layout as "all", but only the supercells on the front get written
+            if(supercells=="pareto")
+            {
+                mush::ScopedTimer select_timer("moire_select");
+                auto best_reports=moirenator.best_of_each_size(bz,lat);
+                auto front=select_pareto_front(best_reports,pareto_size);
+                select_timer.stop();
+                for(int i : front)
+                {
+                    auto root=make_target_structure_dir(twist, lat, i+1);
+                    twisted_layers.push_back(commit_twisted_id(twist,best_reports[i],output_dir,root,lat,&io_mutex));
+                }
+            }
+        }
+    };
+
+    //Sweeps are split into one contiguous stretch of angles per thread, each of which carries its budget along.
+    //The budget only changes how long the search takes, not what it finds, so the split doesn't matter.
+    int segment_count=sweep.empty() ? angles.size() : std::min<int>(mush::resolve_thread_count(threads),angles.size());
+    mush::parallel_for(segment_count, threads, [&](int segment) {
+        mush::SweepBudget<mush::MoireStructureApproximator> sweep_budget(slab.lattice(),max_lattice_sites,error_tol,bz);
+        for(int t=segment*angles.size()/segment_count; t<(segment+1)*angles.size()/segment_count; ++t)
+        {
+            twist_angle(t, sweep.empty() ? nullptr : &sweep_budget);
+        }
+    });
+
+    mush::ScopedTimer record_timer("record");
+    mush::json twist_record;
+    mush::json pareto_fronts;
+    for(int t=0; t<angles.size(); ++t)
+    {
+        mush::json front;
+        front["angle"]=angles[t];
+        for(const auto& layer : layers_per_angle[t])
+        {
+            twist_record[layer.id][layer.lattice]=layer.chunk;
+            front[layer.lattice].push_back({{"id",layer.id},{"moirons",layer.moirons},{"strain",layer.strain}});
         }
+        pareto_fronts.push_back(front);
+    }
+    if(supercells=="pareto")
+    {
+        record["pareto_size"]=pareto_size;
+        record["pareto_fronts"]=pareto_fronts;
+    }
+    if(!angles.empty())
+    {
         record["ids"]=twist_record;
     }
 
@@ -246,6 +502,13 @@ void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path
 
     log << "Save record to "<<output_dir/"record.json"<<"...\n";
     mush::write_json(record,output_dir/"record.json");
+    record_timer.stop();
+
+    if(mush::Profiler::instance().enabled())
+    {
+        log << "Save profile to "<<output_dir/"profile.json"<<"...\n";
+        mush::Profiler::instance().write_report(output_dir/"profile.json");
+    }
 
     return;
 }
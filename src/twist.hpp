@@ -5,6 +5,6 @@
 #include <multishift/definitions.hpp>
 
 void setup_subcommand_twist(CLI::App& app);
-void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path& output_dir, const std::vector<double>& angles, int max_lattice_sites, double error_tol, std::string zone, std::string supercells, std::ostream& log);
+void run_subcommand_twist(const mush::fs::path& input_path, const mush::fs::path& output_dir, const std::vector<double>& angles, const std::vector<double>& sweep, int max_lattice_sites, double error_tol, std::string zone, std::string supercells, int pareto_size, const mush::fs::path& plan_path, int threads, std::ostream& log);
 
 #endif
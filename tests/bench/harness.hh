@@ -0,0 +1,131 @@
+#ifndef BENCH_HARNESS_HH
+#define BENCH_HARNESS_HH
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mush
+{
+namespace bench
+{
+using nlohmann::json;
+
+/// Timings of a single benchmark, for one set of parameters
+struct Result
+{
+    std::string name;
+    json parameters;
+    int repetitions = 0;
+    double min_seconds = 0.0;
+    double median_seconds = 0.0;
+    double mean_seconds = 0.0;
+
+    /// Name and parameters together, used to find the same benchmark in a baseline
+    std::string key() const { return name + parameters.dump(); }
+};
+
+/// How long and how often to repeat each benchmark
+struct Settings
+{
+    int min_repetitions = 3;
+    int max_repetitions = 50;
+    double min_total_seconds = 0.2;
+};
+
+/**
+ * Call work() over and over, at least min_repetitions times, and until either
+ * min_total_seconds have passed or max_repetitions is reached. Anything that should
+ * not be timed (setup, cleanup) has to happen outside of work, or in prepare(), which
+ * runs before every repetition without being timed.
+ */
+
+template <typename PrepareType, typename WorkType>
+Result measure(const std::string& name, const json& parameters, const Settings& settings, PrepareType&& prepare, WorkType&& work)
+{
+    std::vector<double> timings;
+    double total = 0.0;
+    while (timings.size() < settings.min_repetitions ||
+           (total < settings.min_total_seconds && timings.size() < settings.max_repetitions))
+    {
+        prepare();
+        auto start = std::chrono::steady_clock::now();
+        work();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        timings.push_back(elapsed.count());
+        total += elapsed.count();
+    }
+
+    std::sort(timings.begin(), timings.end());
+    Result result;
+    result.name = name;
+    result.parameters = parameters;
+    result.repetitions = timings.size();
+    result.min_seconds = timings.front();
+    result.median_seconds = timings[timings.size() / 2];
+    result.mean_seconds = total / timings.size();
+    return result;
+}
+
+template <typename WorkType>
+Result measure(const std::string& name, const json& parameters, const Settings& settings, WorkType&& work)
+{
+    return measure(name, parameters, settings, []() {}, work);
+}
+
+inline json to_json(const std::vector<Result>& results)
+{
+    json j;
+    j["benchmarks"] = json::array();
+    for (const auto& result : results)
+    {
+        j["benchmarks"].push_back({{"name", result.name},
+                                   {"parameters", result.parameters},
+                                   {"repetitions", result.repetitions},
+                                   {"min_seconds", result.min_seconds},
+                                   {"median_seconds", result.median_seconds},
+                                   {"mean_seconds", result.mean_seconds}});
+    }
+    return j;
+}
+
+/// Print how every result compares to the same benchmark in the baseline, which has the layout
+/// of to_json. Returns the number of benchmarks whose median got slower by more than the tolerance
+/// (e.g. 0.2 for 20%).
+inline int compare_to_baseline(const std::vector<Result>& results, const json& baseline, double tolerance, std::ostream& log)
+{
+    int regressions = 0;
+    for (const auto& result : results)
+    {
+        const json* previous = nullptr;
+        for (const auto& entry : baseline["benchmarks"])
+        {
+            if (entry["name"].get<std::string>() + entry["parameters"].dump() == result.key())
+            {
+                previous = &entry;
+            }
+        }
+
+        log << std::left << std::setw(60) << result.key();
+        if (previous == nullptr)
+        {
+            log << "  (not in baseline)\n";
+            continue;
+        }
+
+        double ratio = result.median_seconds / (*previous)["median_seconds"].get<double>();
+        bool regressed = ratio > 1.0 + tolerance;
+        regressions += regressed;
+        log << "  " << std::fixed << std::setprecision(2) << ratio << "x" << (regressed ? "  REGRESSION" : "") << "\n";
+    }
+    return regressions;
+}
+} // namespace bench
+} // namespace mush
+
+#endif
@@ -0,0 +1,261 @@
+#include "../../autotools.hh"
+#include "../harness.hh"
+#include "../../../src/chain.hpp"
+#include <multishift/chain.hpp>
+#include <multishift/fourier.hpp>
+#include <multishift/shifter.hpp>
+
+#include <casmutils/mush/twist.hpp>
+#include <casmutils/xtal/structure_tools.hpp>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Timings for the parts of multishift that take the longest on large inputs.
+ * Every benchmark is run for a few sizes, and the results are written as json,
+ * which can be compared against a baseline from a previous build. It isn't part of
+ * the regular build, make it with "make MUSH_bench" (or "make check"):
+ *
+ *     MUSH_bench --output new.json --baseline old.json
+ *
+ * Exits with a non zero status if anything got slower than the baseline by more
+ * than the tolerance. Options:
+ *     --filter NAME      only run benchmarks whose name contains NAME
+ *     --output FILE      where to write the results (printed if not given)
+ *     --baseline FILE    results of an earlier run to compare against
+ *     --tolerance X      allowed slowdown before something counts as a regression (default 0.2, i.e. 20%)
+ *     --scratch DIR      where the chain benchmark writes its structures (default /dev/shm, if it exists)
+ */
+
+using namespace mush;
+using bench::json;
+
+namespace
+{
+struct Options
+{
+    std::string filter;
+    fs::path output;
+    fs::path baseline;
+    double tolerance = 0.2;
+    fs::path scratch = fs::exists("/dev/shm") ? fs::path("/dev/shm") : fs::temp_directory_path();
+};
+
+Options parse_options(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string flag = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw std::runtime_error("Missing value for " + flag);
+        }
+        std::string value = argv[++i];
+
+        if (flag == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (flag == "--output")
+        {
+            options.output = value;
+        }
+        else if (flag == "--baseline")
+        {
+            options.baseline = value;
+        }
+        else if (flag == "--tolerance")
+        {
+            options.tolerance = std::stod(value);
+        }
+        else if (flag == "--scratch")
+        {
+            options.scratch = value;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option " + flag);
+        }
+    }
+    return options;
+}
+
+cu::xtal::Structure load_slab(const std::string& name) { return cu::xtal::Structure::from_poscar(autotools::input_filesdir / name); }
+
+/// The slab repeated along c, so it has more atoms but the same in-plane symmetry
+cu::xtal::Structure make_thick_slab(int layers)
+{
+    Eigen::Matrix3i stacking = Eigen::Matrix3i::Identity();
+    stacking(2, 2) = layers;
+    return cu::xtal::make_superstructure(load_slab("mg_stack.vasp"), stacking);
+}
+
+/// Smooth, made up values on a grid, so that fitting has something to chew on
+std::vector<InterPoint> make_surface_data(int dim)
+{
+    std::vector<InterPoint> data;
+    for (int a = 0; a < dim; ++a)
+    {
+        for (int b = 0; b < dim; ++b)
+        {
+            double a_frac = static_cast<double>(a) / dim;
+            double b_frac = static_cast<double>(b) / dim;
+            data.emplace_back(a_frac, b_frac, std::cos(2 * M_PI * a_frac) + 0.5 * std::sin(2 * M_PI * (a_frac + 2 * b_frac)));
+        }
+    }
+    return data;
+}
+
+void bench_shifter(const bench::Settings& settings, std::vector<bench::Result>* results)
+{
+    for (int layers : {1, 2, 4})
+    {
+        auto slab = make_thick_slab(layers);
+        for (int dim : {6, 12, 24})
+        {
+            json parameters{{"grid", dim}, {"atoms", slab.basis_sites().size()}};
+            results->push_back(bench::measure("shifter", parameters, settings, [&]() { Shifter shifter(slab, dim, dim); }));
+        }
+    }
+}
+
+void bench_categorize(const bench::Settings& settings, std::vector<bench::Result>* results)
+{
+    auto slab = load_slab("mg_stack.vasp");
+    for (int dim : {3, 6, 9})
+    {
+        Shifter shifter(slab, dim, dim);
+        std::vector<cu::xtal::Structure> structures;
+        for (int i = 0; i < shifter.size(); ++i)
+        {
+            structures.push_back(shifter.wigner_seitz_shifted_structure(i));
+        }
+
+        json parameters{{"grid", dim}};
+        results->push_back(bench::measure(
+            "categorize_equivalently_shifted_structures", parameters, settings, [&]() { categorize_equivalently_shifted_structures(structures); }));
+    }
+}
+
+void bench_interpolator(const bench::Settings& settings, std::vector<bench::Result>* results)
+{
+    auto lattice = load_slab("mg_stack.vasp").lattice();
+    for (int dim : {12, 24, 48})
+    {
+        auto data = make_surface_data(dim);
+        json parameters{{"grid", dim}};
+        results->push_back(bench::measure("interpolator_fit", parameters, settings, [&]() { Interpolator fit(lattice, data); }));
+
+        Interpolator fit(lattice, data);
+        json interpolate_parameters{{"grid", dim}, {"resolution", 4 * dim}};
+        results->push_back(bench::measure(
+            "interpolator_interpolate", interpolate_parameters, settings, [&]() { fit.interpolate(4 * dim, 4 * dim); }));
+
+        Analytiker analytiker(fit);
+        results->push_back(bench::measure(
+            "analytiker_python_cart", parameters, settings, [&]() { analytiker.python_cart("xx", "yy", "np", 1e-8); }));
+    }
+}
+
+void bench_chain(const bench::Settings& settings, const fs::path& scratch, std::vector<bench::Result>* results)
+{
+    auto input = autotools::input_filesdir / "mg_stack.vasp";
+    auto output_dir = scratch / "mush_bench_chain";
+    std::ostream quiet(nullptr);
+
+    for (int dim : {6, 12})
+    {
+        ChainOptions options;
+        json parameters{{"grid", dim}, {"cleavages", 3}, {"scratch", scratch}};
+        results->push_back(bench::measure("chain", parameters, settings, [&]() { fs::remove_all(output_dir); }, [&]() {
+            run_subcommand_chain<SUBCOMMAND::CHAIN>(input, output_dir, {0.0, 1.0, 2.0}, {dim, dim}, options, quiet);
+        }));
+    }
+    fs::remove_all(output_dir);
+
+    //Same structures, handed straight to a sink that keeps them in memory
+    struct CountingSink : ChainSink
+    {
+        std::atomic<long> sites{0};
+        bool wants_structure(const std::string& /*id*/, json* /*chunk*/) override { return true; }
+        void accept(const std::string& /*id*/, json* /*chunk*/, const Structure& structure) override { sites += structure.basis_sites().size(); }
+    };
+
+    auto slab = load_slab("mg_stack.vasp");
+    for (int dim : {6, 12})
+    {
+        Shifter shifter(slab, dim, dim);
+        json parameters{{"grid", dim}, {"cleavages", 3}};
+        results->push_back(bench::measure("chain_in_memory", parameters, settings, [&]() {
+            CountingSink sink;
+            enumerate_chain(shifter, {0.0, 1.0, 2.0}, SUBCOMMAND::CHAIN, ChainSettings(), {&sink});
+        }));
+    }
+}
+
+void bench_moire(const bench::Settings& settings, std::vector<bench::Result>* results)
+{
+    auto slab = load_slab("graphene.vasp");
+    for (int max_lattice_sites : {50, 100, 200})
+    {
+        json parameters{{"max_lattice_sites", max_lattice_sites}, {"angle", 5.0858478081234}};
+        results->push_back(bench::measure("moire_expand", parameters, settings, [&]() {
+            MoireStructureApproximator moirenator(slab, 5.0858478081234);
+            moirenator.expand(max_lattice_sites);
+        }));
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    auto options = parse_options(argc, argv);
+    bench::Settings settings;
+
+    std::map<std::string, std::function<void(std::vector<bench::Result>*)>> benchmarks;
+    benchmarks["shifter"] = [&](auto* results) { bench_shifter(settings, results); };
+    benchmarks["categorize"] = [&](auto* results) { bench_categorize(settings, results); };
+    benchmarks["interpolator"] = [&](auto* results) { bench_interpolator(settings, results); };
+    benchmarks["chain"] = [&](auto* results) { bench_chain(settings, options.scratch, results); };
+    benchmarks["moire"] = [&](auto* results) { bench_moire(settings, results); };
+
+    std::vector<bench::Result> results;
+    for (const auto& [name, run] : benchmarks)
+    {
+        if (name.find(options.filter) == std::string::npos)
+        {
+            continue;
+        }
+        std::cerr << "Running " << name << " benchmarks...\n";
+        run(&results);
+    }
+
+    auto dumped = bench::to_json(results).dump(4);
+    if (options.output.empty())
+    {
+        std::cout << dumped << "\n";
+    }
+    else
+    {
+        std::ofstream output_stream(options.output);
+        output_stream << dumped << "\n";
+    }
+
+    if (options.baseline.empty())
+    {
+        return 0;
+    }
+
+    std::ifstream baseline_stream(options.baseline);
+    json baseline;
+    baseline_stream >> baseline;
+    int regressions = bench::compare_to_baseline(results, baseline, options.tolerance, std::cerr);
+    return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include "../../autotools.hh"
+#include <multishift/adapt.hpp>
+#include <multishift/chain.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using namespace mush;
+
+class AdaptTest : public testing::Test
+{
+protected:
+    std::unique_ptr<Shifter> coarse_ptr;
+    std::unique_ptr<Shifter> fine_ptr;
+    int dim = 4;
+    int factor = 3;
+
+    virtual void SetUp() override
+    {
+        cu::xtal::Structure slab = cu::xtal::Structure::from_poscar(autotools::input_filesdir / "mg_stack.vasp");
+        coarse_ptr.reset(new Shifter(slab, dim, dim));
+        fine_ptr.reset(new Shifter(slab, factor * dim, factor * dim));
+    }
+
+    /// Fit of the function on the coarse grid, on the same aligned plane the shift vectors are on
+    template <typename FunctionType>
+    SurfaceEvaluator fit_coarse(FunctionType f) const
+    {
+        auto units = make_shift_units(*coarse_ptr);
+        Eigen::Vector3d a(units[0][0] * dim, units[0][1] * dim, 0.0);
+        Eigen::Vector3d b(units[1][0] * dim, units[1][1] * dim, 0.0);
+        Lattice lattice(a, b, Eigen::Vector3d(0, 0, 1));
+
+        std::vector<InterPoint> data;
+        for (int i = 0; i < coarse_ptr->size(); ++i)
+        {
+            double a_frac = static_cast<double>(coarse_ptr->shift_records[i].a) / dim;
+            double b_frac = static_cast<double>(coarse_ptr->shift_records[i].b) / dim;
+            data.emplace_back(a_frac, b_frac, f(a_frac, b_frac));
+        }
+        return SurfaceEvaluator(Interpolator(lattice, data));
+    }
+
+    bool is_coarse(int ix) const { return fine_ptr->shift_records[ix].a % factor == 0 && fine_ptr->shift_records[ix].b % factor == 0; }
+};
+
+TEST_F(AdaptTest, CoarsePointsHaveNoError)
+{
+    auto surface = fit_coarse([](double a, double b) { return std::cos(2 * M_PI * a) + std::cos(2 * M_PI * b); });
+    auto scores = score_refinement(surface, *fine_ptr, factor);
+    ASSERT_EQ(scores.size(), fine_ptr->size());
+
+    for (const auto& score : scores)
+    {
+        EXPECT_EQ(score.index, &score - scores.data());
+        EXPECT_GE(score.curvature, 0.0);
+        if (is_coarse(score.index))
+        {
+            EXPECT_NEAR(score.distance, 0.0, 1e-12);
+            EXPECT_NEAR(score.estimated_error, 0.0, 1e-12);
+        }
+        else
+        {
+            EXPECT_GT(score.distance, 0.0);
+        }
+    }
+}
+
+TEST_F(AdaptTest, FlatSurfaceHasNoError)
+{
+    auto surface = fit_coarse([](double a, double b) { return 2.5; });
+    for (const auto& score : score_refinement(surface, *fine_ptr, factor))
+    {
+        EXPECT_NEAR(score.predicted, 2.5, 1e-8);
+        EXPECT_NEAR(score.estimated_error, 0.0, 1e-8);
+    }
+}
+
+TEST_F(AdaptTest, SelectsUnknownOrbitsByError)
+{
+    auto surface = fit_coarse([](double a, double b) { return std::cos(2 * M_PI * a) + 0.5 * std::sin(2 * M_PI * (a + 2 * b)); });
+    auto scores = score_refinement(surface, *fine_ptr, factor);
+
+    auto orbit_error = [&](int ix) {
+        double worst = 0.0;
+        for (int e : fine_ptr->equivalence_map[ix])
+        {
+            worst = std::max(worst, scores[e].estimated_error);
+        }
+        return worst;
+    };
+
+    int budget = 5;
+    auto selected = select_refinement(scores, *fine_ptr, factor, budget);
+    ASSERT_EQ(selected.size(), budget);
+
+    for (int s = 0; s < selected.size(); ++s)
+    {
+        const auto& orbit = fine_ptr->equivalence_map[selected[s]];
+        EXPECT_EQ(orbit.front(), selected[s]);
+        EXPECT_TRUE(std::none_of(orbit.begin(), orbit.end(), [&](int e) { return is_coarse(e); }));
+        if (s > 0)
+        {
+            EXPECT_GE(orbit_error(selected[s - 1]), orbit_error(selected[s]));
+        }
+    }
+
+    // Anything that wasn't picked is no worse than the last orbit that was
+    for (int i = 0; i < fine_ptr->size(); ++i)
+    {
+        const auto& orbit = fine_ptr->equivalence_map[i];
+        bool known = std::any_of(orbit.begin(), orbit.end(), [&](int e) { return is_coarse(e); });
+        if (orbit.front() == i && !known && std::find(selected.begin(), selected.end(), i) == selected.end())
+        {
+            EXPECT_LE(orbit_error(i), orbit_error(selected.back()));
+        }
+    }
+
+    // A budget larger than what's left gives every unknown orbit
+    auto everything = select_refinement(scores, *fine_ptr, factor, fine_ptr->size());
+    EXPECT_LT(everything.size(), fine_ptr->size());
+    EXPECT_GE(everything.size(), selected.size());
+}
+
+TEST_F(AdaptTest, FactorMustDivideGrid)
+{
+    auto surface = fit_coarse([](double a, double b) { return a; });
+    EXPECT_THROW(score_refinement(surface, *fine_ptr, 5), std::runtime_error);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
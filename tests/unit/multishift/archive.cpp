@@ -0,0 +1,87 @@
+#include "../../autotools.hh"
+#include <multishift/archive.hpp>
+
+#include <fstream>
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+
+using namespace mush;
+
+class ArchiveTest : public testing::Test
+{
+protected:
+    std::map<std::string, std::string> contents;
+
+    virtual void SetUp() override
+    {
+        fs::create_directories(autotools::output_filesdir);
+
+        contents["record.json"] = "{\"ids\": {}}";
+        contents["shift__0.0/cleave__0.000000/POSCAR"] = "Mg\n1.0\n3.2 0 0\n-1.6 2.77 0\n0 0 10\nMg\n1\nDirect\n0 0 0\n";
+        contents["shift__1.0/cleave__0.000000/POSCAR"] = std::string(5000, 'x');
+        contents["empty"] = "";
+    }
+
+    void check_round_trip(bool compress)
+    {
+        auto target = autotools::output_filesdir / (compress ? "compressed.mushar" : "plain.mushar");
+        {
+            ArchiveWriter writer(target, compress);
+            for (const auto& [name, content] : contents)
+            {
+                writer.add_entry(name, content);
+            }
+            EXPECT_THROW(writer.add_entry("empty", "again"), std::runtime_error);
+        }
+
+        ArchiveReader reader(target);
+        EXPECT_EQ(reader.entries().size(), contents.size());
+        EXPECT_FALSE(reader.contains("missing"));
+        EXPECT_THROW(reader.read("missing"), std::runtime_error);
+
+        // Read back in reverse to make sure nothing relies on the order
+        for (auto it = contents.rbegin(); it != contents.rend(); ++it)
+        {
+            EXPECT_TRUE(reader.contains(it->first));
+            EXPECT_EQ(reader.read(it->first), it->second);
+        }
+    }
+};
+
+TEST_F(ArchiveTest, PlainRoundTrip) { check_round_trip(false); }
+
+TEST_F(ArchiveTest, CompressedRoundTrip)
+{
+    if (!ArchiveWriter::compression_available())
+    {
+        EXPECT_THROW(ArchiveWriter(autotools::output_filesdir / "compressed.mushar", true), std::runtime_error);
+        return;
+    }
+    check_round_trip(true);
+}
+
+TEST_F(ArchiveTest, RejectIncompleteArchive)
+{
+    auto target = autotools::output_filesdir / "plain.mushar";
+    check_round_trip(false);
+
+    std::string archive;
+    {
+        std::ifstream archive_stream(target, std::ios::binary);
+        archive.assign(std::istreambuf_iterator<char>(archive_stream), std::istreambuf_iterator<char>());
+    }
+
+    auto truncated_target = autotools::output_filesdir / "truncated.mushar";
+    {
+        std::ofstream truncated_stream(truncated_target, std::ios::binary);
+        truncated_stream << archive.substr(0, archive.size() - 10);
+    }
+    EXPECT_THROW(ArchiveReader reader(truncated_target), std::runtime_error);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
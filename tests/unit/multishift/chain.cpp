@@ -0,0 +1,204 @@
+#include "../../autotools.hh"
+#include <multishift/chain.hpp>
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace mush;
+
+namespace
+{
+/// Keeps everything it's given, and marks the entry of every structure it receives
+struct CollectingSink : ChainSink
+{
+    bool wanted = true;
+    json header;
+    json footer;
+    std::vector<double> cleavages;
+    std::vector<std::string> recorded_ids;
+    json recorded_chunks = json::object();
+
+    std::mutex mutex;
+    std::set<std::string> accepted_ids;
+    std::atomic<int> accepted_sites{0};
+
+    void begin(const Structure& /*slab*/, const json& _header) override { header = _header; }
+    void begin_cleavage(double cleavage) override { cleavages.push_back(cleavage); }
+    bool wants_structure(const std::string& /*id*/, json* /*chunk*/) override { return wanted; }
+
+    void accept(const std::string& id, json* chunk, const Structure& structure) override
+    {
+        (*chunk)["accepted"] = true;
+        accepted_sites += structure.basis_sites().size();
+        std::lock_guard<std::mutex> lock(mutex);
+        accepted_ids.insert(id);
+    }
+
+    void record_id(const std::string& id, const json& chunk) override
+    {
+        recorded_ids.push_back(id);
+        recorded_chunks[id] = chunk;
+    }
+
+    void end(const json& _footer) override { footer = _footer; }
+};
+} // namespace
+
+class ChainTest : public testing::Test
+{
+protected:
+    std::unique_ptr<Shifter> shifter_ptr;
+    std::vector<double> cleavages{0.0, 1.5};
+
+    virtual void SetUp() override
+    {
+        fs::create_directories(autotools::output_filesdir);
+        cu::xtal::Structure slab = cu::xtal::Structure::from_poscar(autotools::input_filesdir / "mg_stack.vasp");
+        shifter_ptr.reset(new Shifter(slab, 3, 3));
+    }
+
+    int orbit_count() const
+    {
+        int count = 0;
+        for (int i = 0; i < shifter_ptr->size(); ++i)
+        {
+            count += shifter_ptr->equivalence_map[i].front() == i;
+        }
+        return count;
+    }
+};
+
+TEST_F(ChainTest, EveryIdReachesTheSink)
+{
+    CollectingSink sink;
+    ChainSettings settings;
+    settings.threads = 4;
+    enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, settings, {&sink});
+
+    int num_ids = shifter_ptr->size() * cleavages.size();
+    EXPECT_EQ(sink.header["grid"], json(shifter_ptr->grid_dims));
+    EXPECT_EQ(sink.cleavages, cleavages);
+    EXPECT_EQ(sink.recorded_ids.size(), num_ids);
+    EXPECT_EQ(sink.accepted_ids.size(), num_ids);
+    EXPECT_EQ(sink.accepted_sites, num_ids * shifter_ptr->slab.basis_sites().size());
+    EXPECT_EQ(sink.footer["equivalents"].size(), orbit_count() * cleavages.size());
+    EXPECT_FALSE(sink.footer.contains("irreducible"));
+
+    // Ids are recorded in the same order no matter how many threads made the structures
+    for (int c = 0; c < cleavages.size(); ++c)
+    {
+        for (int i = 0; i < shifter_ptr->size(); ++i)
+        {
+            const auto& id = sink.recorded_ids[c * shifter_ptr->size() + i];
+            EXPECT_EQ(id, make_multirecord(cleavages[c], *shifter_ptr, i).id());
+            EXPECT_TRUE(sink.recorded_chunks[id]["accepted"].get<bool>());
+        }
+    }
+}
+
+TEST_F(ChainTest, IrreducibleSharesRepresentative)
+{
+    CollectingSink sink;
+    ChainSettings settings;
+    settings.irreducible = true;
+    enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, settings, {&sink});
+
+    EXPECT_EQ(sink.accepted_ids.size(), orbit_count() * cleavages.size());
+    EXPECT_EQ(sink.recorded_ids.size(), shifter_ptr->size() * cleavages.size());
+    EXPECT_TRUE(sink.footer["irreducible"].get<bool>());
+
+    for (const auto& [id, chunk] : sink.recorded_chunks.items())
+    {
+        const auto& representative = chunk["representative"].get<std::string>();
+        EXPECT_EQ(sink.accepted_ids.count(representative), 1);
+        EXPECT_EQ(chunk["directory"], sink.recorded_chunks[representative]["directory"]);
+        EXPECT_TRUE(chunk["accepted"].get<bool>());
+    }
+}
+
+TEST_F(ChainTest, DirectoryAndRecordSinks)
+{
+    auto output_dir = autotools::output_filesdir / "chain_sinks";
+    auto record_path = output_dir / "record.json";
+    fs::remove_all(output_dir);
+    fs::create_directories(output_dir);
+
+    {
+        RecordSink record_sink(record_path, RecordWriter::FORMAT::JSON);
+        DirectorySink directory_sink(output_dir);
+        enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, ChainSettings(), {&record_sink, &directory_sink});
+        EXPECT_EQ(directory_sink.reused(), 0);
+    }
+
+    auto record = load_record(record_path);
+    EXPECT_EQ(record["ids"].size(), shifter_ptr->size() * cleavages.size());
+    EXPECT_TRUE(fs::exists(output_dir / "slab.vasp"));
+    for (const auto& [id, chunk] : record["ids"].items())
+    {
+        EXPECT_TRUE(matches_hash(output_dir / chunk["directory"].get<std::string>() / "POSCAR", chunk["hash"].get<std::string>()));
+    }
+
+    // Every structure is still on disk, so none of them have to be made again
+    CollectingSink collecting_sink;
+    collecting_sink.wanted = false;
+    DirectorySink directory_sink(output_dir, record["ids"]);
+    enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, ChainSettings(), {&directory_sink, &collecting_sink});
+    EXPECT_EQ(directory_sink.reused(), record["ids"].size());
+    EXPECT_TRUE(collecting_sink.accepted_ids.empty());
+    for (const auto& [id, chunk] : collecting_sink.recorded_chunks.items())
+    {
+        EXPECT_EQ(chunk["hash"], record["ids"][id]["hash"]);
+    }
+}
+
+TEST_F(ChainTest, ExistingStructuresAreNotMade)
+{
+    // Pretend every structure at the first cleavage with an even a index was made in an earlier run
+    ChainSettings settings;
+    for (int i = 0; i < shifter_ptr->size(); ++i)
+    {
+        if (shifter_ptr->shift_records[i].a % 2 == 0)
+        {
+            auto id = make_multirecord(cleavages[0], *shifter_ptr, i).id();
+            settings.existing[id] = {{"directory", "../earlier/" + id}, {"energy", 1.0 * i}};
+        }
+    }
+
+    CollectingSink sink;
+    enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, settings, {&sink});
+    EXPECT_EQ(sink.accepted_ids.size(), shifter_ptr->size() * cleavages.size() - settings.existing.size());
+    for (const auto& [id, entry] : settings.existing.items())
+    {
+        EXPECT_EQ(sink.accepted_ids.count(id), 0);
+        EXPECT_EQ(sink.recorded_chunks[id]["directory"], entry["directory"]);
+        EXPECT_EQ(sink.recorded_chunks[id]["energy"], entry["energy"]);
+        EXPECT_TRUE(sink.recorded_chunks[id].contains("grid_point"));
+    }
+
+    // Without the structure of the representative, an equivalent one that exists is used for the whole orbit
+    CollectingSink irreducible_sink;
+    settings.irreducible = true;
+    enumerate_chain(*shifter_ptr, cleavages, SUBCOMMAND::CHAIN, settings, {&irreducible_sink});
+    for (const auto& [id, chunk] : irreducible_sink.recorded_chunks.items())
+    {
+        const auto& representative = chunk["representative"].get<std::string>();
+        bool orbit_exists = false;
+        for (const auto& equivalent : chunk["equivalent_structures"])
+        {
+            orbit_exists = orbit_exists || settings.existing.contains(equivalent.get<std::string>());
+        }
+        EXPECT_EQ(irreducible_sink.accepted_ids.count(representative), orbit_exists ? 0 : 1);
+        EXPECT_EQ(chunk.contains("energy"), orbit_exists);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,222 @@
+#include "../../autotools.hh"
+#include <multishift/evaluator.hpp>
+#include <multishift/fourier.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+
+using namespace mush;
+
+namespace
+{
+/// Smooth periodic function of the fractional coordinates, with only a few frequencies,
+/// so that it can be reproduced exactly by the interpolation
+double fake_gamma_surface(double a_frac, double b_frac)
+{
+    double two_pi = 2 * M_PI;
+    return 0.3 + std::cos(two_pi * a_frac) + 0.5 * std::sin(two_pi * (a_frac + 2 * b_frac)) + 0.2 * std::cos(two_pi * 3 * b_frac);
+}
+} // namespace
+
+class SurfaceEvaluatorTest : public testing::Test
+{
+protected:
+    std::unique_ptr<cu::xtal::Lattice> lat_ptr;
+    std::unique_ptr<SurfaceEvaluator> evaluator_ptr;
+
+    virtual void SetUp() override
+    {
+        // Already aligned, so the Cartesian coordinates of the formula are the same as the ones here
+        lat_ptr.reset(new cu::xtal::Lattice(Eigen::Vector3d(3.2, 0, 0), Eigen::Vector3d(-1.6, 2.77128129, 0), Eigen::Vector3d(0, 0, 10)));
+
+        int adim = 8;
+        int bdim = 9;
+        std::vector<InterPoint> unrolled_data;
+        for (int a = 0; a < adim; ++a)
+        {
+            for (int b = 0; b < bdim; ++b)
+            {
+                double a_frac = static_cast<double>(a) / adim;
+                double b_frac = static_cast<double>(b) / bdim;
+                unrolled_data.emplace_back(a_frac, b_frac, ::fake_gamma_surface(a_frac, b_frac));
+            }
+        }
+
+        Interpolator ipolator(*lat_ptr, unrolled_data);
+        evaluator_ptr.reset(new SurfaceEvaluator(ipolator, 1e-12));
+    }
+
+    Eigen::Vector2d cart(double a_frac, double b_frac) const
+    {
+        Eigen::Vector3d r = a_frac * lat_ptr->a() + b_frac * lat_ptr->b();
+        return Eigen::Vector2d(r(0), r(1));
+    }
+};
+
+TEST_F(SurfaceEvaluatorTest, CrushedTerms)
+{
+    // Constant, cos(a), sin(a+2b), cos(3b)
+    EXPECT_EQ(evaluator_ptr->size(), 4);
+}
+
+TEST_F(SurfaceEvaluatorTest, Values)
+{
+    for (double a_frac : {0.0, 0.13, 0.5, 0.77})
+    {
+        for (double b_frac : {0.0, 0.21, 0.62, 0.95})
+        {
+            EXPECT_NEAR(evaluator_ptr->value(cart(a_frac, b_frac)), ::fake_gamma_surface(a_frac, b_frac), 1e-10);
+        }
+    }
+}
+
+TEST_F(SurfaceEvaluatorTest, BatchDerivatives)
+{
+    Eigen::Matrix2Xd points(2, 3);
+    points.col(0) = cart(0.1, 0.2);
+    points.col(1) = cart(0.45, 0.8);
+    points.col(2) = cart(0.9, 0.33);
+
+    auto batch = evaluator_ptr->evaluate(points);
+    auto values_only = evaluator_ptr->evaluate(points, SurfaceEvaluator::Order::VALUE);
+    EXPECT_EQ(values_only.gradients.size(), 0);
+
+    double h = 1e-5;
+    for (int i = 0; i < points.cols(); ++i)
+    {
+        EXPECT_NEAR(batch.values(i), values_only.values(i), 1e-12);
+
+        Eigen::Vector2d dx(h, 0), dy(0, h);
+        auto shifted = evaluator_ptr->evaluate(
+            (Eigen::Matrix2Xd(2, 4) << points.col(i) + dx, points.col(i) - dx, points.col(i) + dy, points.col(i) - dy).finished());
+
+        EXPECT_NEAR(batch.gradients(0, i), (shifted.values(0) - shifted.values(1)) / (2 * h), 1e-6);
+        EXPECT_NEAR(batch.gradients(1, i), (shifted.values(2) - shifted.values(3)) / (2 * h), 1e-6);
+        EXPECT_NEAR(batch.hessians(0, i), (shifted.gradients(0, 0) - shifted.gradients(0, 1)) / (2 * h), 1e-5);
+        EXPECT_NEAR(batch.hessians(1, i), (shifted.gradients(1, 0) - shifted.gradients(1, 1)) / (2 * h), 1e-5);
+        EXPECT_NEAR(batch.hessians(2, i), (shifted.gradients(1, 2) - shifted.gradients(1, 3)) / (2 * h), 1e-5);
+    }
+}
+
+class StarBasisTest : public SurfaceEvaluatorTest
+{
+protected:
+    /// Rotation by 120 degrees and inversion of the fractional coordinates of the hexagonal lattice
+    std::vector<Eigen::Matrix2i> shift_group;
+
+    virtual void SetUp() override
+    {
+        SurfaceEvaluatorTest::SetUp();
+
+        Eigen::Matrix2i rotation;
+        rotation << 0, -1, 1, -1;
+        Eigen::Matrix2i op = Eigen::Matrix2i::Identity();
+        for (int r = 0; r < 3; ++r)
+        {
+            shift_group.push_back(op);
+            shift_group.push_back(-op);
+            op = rotation * op;
+        }
+    }
+
+    /// Fit of a surface on a 12x12 grid. If symmetric, it's the average of the fake surface over every operation.
+    Interpolator fit(bool symmetric) const
+    {
+        int dim = 12;
+        std::vector<InterPoint> unrolled_data;
+        for (int a = 0; a < dim; ++a)
+        {
+            for (int b = 0; b < dim; ++b)
+            {
+                Eigen::Vector2i grid_point(a, b);
+                double value = ::fake_gamma_surface(static_cast<double>(a) / dim, static_cast<double>(b) / dim);
+                if (symmetric)
+                {
+                    value = 0.0;
+                    for (const auto& op : shift_group)
+                    {
+                        Eigen::Vector2i mapped = op * grid_point;
+                        value += ::fake_gamma_surface(static_cast<double>(mapped(0)) / dim, static_cast<double>(mapped(1)) / dim);
+                    }
+                    value /= shift_group.size();
+                }
+                unrolled_data.emplace_back(static_cast<double>(a) / dim, static_cast<double>(b) / dim, value);
+            }
+        }
+        return Interpolator(*lat_ptr, unrolled_data);
+    }
+
+    static int count_terms(const Analytiker& analyzer)
+    {
+        return std::count_if(analyzer.formula_bits().begin(), analyzer.formula_bits().end(), [](const Analytiker::FormulaBit& bit) {
+            return std::abs(std::get<0>(bit)) > 1e-10;
+        });
+    }
+};
+
+TEST_F(StarBasisTest, SymmetricSurfaceIsUnchanged)
+{
+    auto ipolator = fit(true);
+    Analytiker full(ipolator);
+    Analytiker stars(ipolator, shift_group);
+    EXPECT_LT(2 * count_terms(stars), count_terms(full));
+
+    SurfaceEvaluator full_evaluator(full, 1e-12);
+    SurfaceEvaluator star_evaluator(stars, 1e-12);
+    for (double a_frac : {0.0, 0.13, 0.5, 0.77})
+    {
+        for (double b_frac : {0.0, 0.21, 0.62, 0.95})
+        {
+            EXPECT_NEAR(star_evaluator.value(cart(a_frac, b_frac)), full_evaluator.value(cart(a_frac, b_frac)), 1e-10);
+        }
+    }
+
+    auto [real_formula, imag_formula] = stars.python_cart("x", "y", "np", 1e-10);
+    EXPECT_NE(real_formula.find("*(np.cos("), std::string::npos);
+}
+
+TEST_F(StarBasisTest, StarsAreSymmetric)
+{
+    Analytiker stars(fit(false), shift_group);
+
+    // Every k-point is summed over by at most one bit
+    std::vector<int> seen(stars.k_points().size(), 0);
+    for (const auto& bit : stars.formula_bits())
+    {
+        if (std::get<1>(bit) == Analytiker::FormulaBitBasis::RECOS)
+        {
+            for (int k_ix : stars.star(std::get<2>(bit)))
+            {
+                ++seen[k_ix];
+            }
+        }
+    }
+    EXPECT_LE(*std::max_element(seen.begin(), seen.end()), 1);
+
+    // Even if the data isn't, the surface made from the stars has the symmetry of the operations
+    SurfaceEvaluator evaluator(stars);
+    for (const auto& op : shift_group)
+    {
+        Eigen::Vector2d frac(0.31, 0.72);
+        Eigen::Vector2d mapped = op.cast<double>() * frac;
+        EXPECT_NEAR(evaluator.value(cart(mapped(0), mapped(1))), evaluator.value(cart(frac(0), frac(1))), 1e-10);
+    }
+}
+
+TEST(SpectralRadius, LargestEigenvalueMagnitude)
+{
+    // Eigenvalues -3 and 1
+    EXPECT_NEAR(spectral_radius(Eigen::Vector3d(-3.0, 0.0, 1.0)), 3.0, 1e-12);
+    // Eigenvalues 3 and -1
+    EXPECT_NEAR(spectral_radius(Eigen::Vector3d(1.0, 2.0, 1.0)), 3.0, 1e-12);
+    // Eigenvalues -0.5 and -4.5
+    EXPECT_NEAR(spectral_radius(Eigen::Vector3d(-2.5, 2.0, -2.5)), 4.5, 1e-12);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
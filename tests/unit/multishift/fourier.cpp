@@ -1,13 +1,385 @@
 #include "../../autotools.hh"
+#include <multishift/evaluator.hpp>
+#include <multishift/fft.hpp>
 #include <multishift/fourier.hpp>
+#include <multishift/shifter.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <gtest/gtest.h>
+#include <map>
 #include <memory>
 
 using namespace mush;
 
-int main(int argc, char** argv)
+namespace
+{
+/// Some smooth periodic function with no particular symmetry, to make up data
+double fake_gamma_surface(double a_frac, double b_frac)
+{
+    double two_pi = 2 * M_PI;
+    return 0.3 + std::cos(two_pi * a_frac) + 0.5 * std::sin(two_pi * (a_frac + 2 * b_frac)) + 0.2 * std::cos(two_pi * 3 * b_frac) +
+           0.1 * std::sin(two_pi * (2 * a_frac - b_frac));
+}
+
+std::vector<InterPoint> make_unrolled_data(int adim, int bdim)
+{
+    std::vector<InterPoint> unrolled_data;
+    for (int a = 0; a < adim; ++a)
+    {
+        for (int b = 0; b < bdim; ++b)
+        {
+            double a_frac = static_cast<double>(a) / adim;
+            double b_frac = static_cast<double>(b) / bdim;
+            unrolled_data.emplace_back(a_frac, b_frac, ::fake_gamma_surface(a_frac, b_frac));
+        }
+    }
+    return unrolled_data;
+}
+} // namespace
+
+TEST(FFTPlanTest, MatchesDirectDFT)
+{
+    for (int length : {1, 2, 3, 8, 12, 13, 30, 49})
+    {
+        std::vector<std::complex<double>> values;
+        for (int n = 0; n < length; ++n)
+        {
+            values.emplace_back(std::sin(0.7 * n) + 0.1 * n, std::cos(1.3 * n));
+        }
+
+        auto transformed = values;
+        FFTPlan plan(length);
+        plan.forward(transformed.data());
+
+        for (int k = 0; k < length; ++k)
+        {
+            std::complex<double> expected = 0.0;
+            for (int n = 0; n < length; ++n)
+            {
+                expected += values[n] * std::exp(std::complex<double>(0, -2.0 * M_PI * k * n / length));
+            }
+            EXPECT_NEAR(std::abs(expected - transformed[k]), 0.0, 1e-9) << "length " << length << ", k " << k;
+        }
+
+        plan.inverse(transformed.data());
+        for (int n = 0; n < length; ++n)
+        {
+            EXPECT_NEAR(std::abs(transformed[n] / static_cast<double>(length) - values[n]), 0.0, 1e-9);
+        }
+    }
+}
+
+class InterpolatorTransformTest : public testing::Test
+{
+protected:
+    std::unique_ptr<cu::xtal::Lattice> hex_lat_ptr;
+
+    virtual void SetUp() override
+    {
+        hex_lat_ptr.reset(new cu::xtal::Lattice(
+            Eigen::Vector3d(3.2, 0, 0), Eigen::Vector3d(-1.6, 2.77128129, 0), Eigen::Vector3d(0, 0, 10)));
+    }
+
+    void check_transforms_agree(int adim, int bdim)
+    {
+        auto unrolled_data = ::make_unrolled_data(adim, bdim);
+        Interpolator direct(*hex_lat_ptr, unrolled_data, Interpolator::TransformMethod::DIRECT);
+        Interpolator fft(*hex_lat_ptr, unrolled_data, Interpolator::TransformMethod::FFT);
+
+        ASSERT_EQ(direct.dims(), fft.dims());
+        const auto& direct_k = direct.k_values();
+        const auto& fft_k = fft.k_values();
+        for (int ix = 0; ix < direct_k.size(); ++ix)
+        {
+            EXPECT_EQ(direct_k.a_fracs[ix], fft_k.a_fracs[ix]);
+            EXPECT_EQ(direct_k.b_fracs[ix], fft_k.b_fracs[ix]);
+            EXPECT_NEAR(std::abs(direct_k.values[ix] - fft_k.values[ix]), 0.0, 1e-10) << adim << "x" << bdim << " grid at k-point " << ix;
+        }
+    }
+};
+
+TEST_F(InterpolatorTransformTest, OddGrid) { check_transforms_agree(5, 7); }
+
+TEST_F(InterpolatorTransformTest, EvenGrid) { check_transforms_agree(6, 8); }
+
+TEST_F(InterpolatorTransformTest, MixedGrid)
+{
+    check_transforms_agree(6, 9);
+    check_transforms_agree(9, 4);
+}
+
+TEST_F(InterpolatorTransformTest, ReproduceSampledValues)
+{
+    int adim = 12;
+    int bdim = 10;
+    Interpolator ipolator(*hex_lat_ptr, ::make_unrolled_data(adim, bdim));
+
+    auto [lat, values] = ipolator.interpolate(adim, bdim);
+    for (int a = 0; a < adim; ++a)
+    {
+        for (int b = 0; b < bdim; ++b)
+        {
+            double expected = ::fake_gamma_surface(static_cast<double>(a) / adim, static_cast<double>(b) / bdim);
+            EXPECT_NEAR(values.values[values.index(a, b)].real(), expected, 1e-10);
+            EXPECT_NEAR(values.values[values.index(a, b)].imag(), 0.0, 1e-10);
+        }
+    }
+}
+
+TEST_F(InterpolatorTransformTest, InterpolationsAgree)
+{
+    Interpolator ipolator(*hex_lat_ptr, ::make_unrolled_data(6, 7));
+
+    for (auto [adim, bdim] : std::vector<std::pair<int, int>>{{17, 23}, {4, 3}, {6, 7}})
+    {
+        auto [direct_lat, direct_values] = ipolator.interpolate(adim, bdim, Interpolator::TransformMethod::DIRECT);
+        auto [fft_lat, fft_values] = ipolator.interpolate(adim, bdim, Interpolator::TransformMethod::FFT);
+
+        ASSERT_EQ(direct_values.dims(), std::make_pair(adim, bdim));
+        ASSERT_EQ(fft_values.dims(), std::make_pair(adim, bdim));
+        for (int ix = 0; ix < fft_values.size(); ++ix)
+        {
+            EXPECT_EQ(direct_values.a_fracs[ix], fft_values.a_fracs[ix]);
+            EXPECT_EQ(direct_values.b_fracs[ix], fft_values.b_fracs[ix]);
+            EXPECT_NEAR(std::abs(direct_values.values[ix] - fft_values.values[ix]), 0.0, 1e-10);
+        }
+    }
+}
+
+TEST_F(InterpolatorTransformTest, BatchMatchesIndividualFits)
 {
-    return 0;
+    int adim = 6;
+    int bdim = 5;
+    auto first_set = ::make_unrolled_data(adim, bdim);
+
+    // Same points with different values, listed in a different order
+    auto second_set = first_set;
+    std::reverse(second_set.begin(), second_set.end());
+    for (auto& point : second_set)
+    {
+        point.value = 2.0 * point.value + std::cos(2 * M_PI * point.b_frac);
+    }
+
+    auto batch = Interpolator::fit_batch(*hex_lat_ptr, {first_set, second_set});
+    ASSERT_EQ(batch.size(), 2);
+
+    for (int set = 0; set < 2; ++set)
+    {
+        Interpolator individual(*hex_lat_ptr, set == 0 ? first_set : second_set);
+        ASSERT_EQ(batch[set].dims(), individual.dims());
+        const auto& batch_k = batch[set].k_values();
+        const auto& individual_k = individual.k_values();
+        for (int ix = 0; ix < batch_k.size(); ++ix)
+        {
+            EXPECT_EQ(batch_k.a_fracs[ix], individual_k.a_fracs[ix]);
+            EXPECT_EQ(batch_k.b_fracs[ix], individual_k.b_fracs[ix]);
+            EXPECT_NEAR(std::abs(batch_k.values[ix] - individual_k.values[ix]), 0.0, 1e-10);
+        }
+    }
+
+    auto mismatched_set = ::make_unrolled_data(adim, bdim + 1);
+    EXPECT_THROW(Interpolator::fit_batch(*hex_lat_ptr, {first_set, mismatched_set}), std::runtime_error);
 }
 
+TEST_F(InterpolatorTransformTest, LeastSquaresMatchesTransform)
+{
+    auto unrolled_data = ::make_unrolled_data(7, 9);
+    Interpolator transformed(*hex_lat_ptr, unrolled_data);
+    auto fitted = Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data);
+
+    ASSERT_EQ(fitted.dims(), transformed.dims());
+    for (int ix = 0; ix < fitted.size(); ++ix)
+    {
+        EXPECT_NEAR(std::abs(fitted.k_values().values[ix] - transformed.k_values().values[ix]), 0.0, 1e-9);
+    }
+}
+
+TEST_F(InterpolatorTransformTest, LeastSquaresMatchesTransformOnEvenGrid)
+{
+    // Alternating values along a and b are the plane waves at the edges of the k-point grid
+    int adim = 6;
+    int bdim = 8;
+    auto unrolled_data = ::make_unrolled_data(adim, bdim);
+    for (auto& point : unrolled_data)
+    {
+        long a = std::lround(point.a_frac * adim);
+        long b = std::lround(point.b_frac * bdim);
+        point.value += 0.4 * std::cos(M_PI * a) + 0.2 * std::cos(M_PI * (a + b));
+    }
+
+    Interpolator transformed(*hex_lat_ptr, unrolled_data);
+    auto fitted = Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data);
+    ASSERT_EQ(fitted.dims(), transformed.dims());
+    for (int ix = 0; ix < fitted.size(); ++ix)
+    {
+        EXPECT_NEAR(std::abs(fitted.k_values().values[ix] - transformed.k_values().values[ix]), 0.0, 1e-9);
+        EXPECT_EQ(fitted.k_values().weights[ix], transformed.k_values().weights[ix]);
+    }
+
+    for (const auto& ipolator : {transformed, fitted})
+    {
+        auto [lat, values] = ipolator.interpolate(adim, bdim);
+        for (const auto& point : unrolled_data)
+        {
+            long a = std::lround(point.a_frac * adim);
+            long b = std::lround(point.b_frac * bdim);
+            EXPECT_NEAR(values.values[values.index(a, b)].real(), point.value.real(), 1e-9);
+        }
+    }
+}
+
+TEST_F(InterpolatorTransformTest, LeastSquaresSkipsMissingPoints)
+{
+    int adim = 12;
+    int bdim = 10;
+    auto unrolled_data = ::make_unrolled_data(adim, bdim);
+    auto is_missing = [](int ix) { return ix % 7 == 3; };
+    for (int ix = 0; ix < unrolled_data.size(); ++ix)
+    {
+        if (is_missing(ix))
+        {
+            unrolled_data[ix].value = 100.0;
+            unrolled_data[ix].weight = 0.0;
+        }
+    }
+
+    auto fitted = Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data);
+    auto [lat, values] = fitted.interpolate(adim, bdim);
+    for (int ix = 0; ix < unrolled_data.size(); ++ix)
+    {
+        int a = std::lround(unrolled_data[ix].a_frac * adim);
+        int b = std::lround(unrolled_data[ix].b_frac * bdim);
+        const auto& value = values.values[values.index(a, b)];
+        EXPECT_NEAR(value.imag(), 0.0, 1e-9);
+        if (!is_missing(ix))
+        {
+            EXPECT_NEAR(value.real(), ::fake_gamma_surface(unrolled_data[ix].a_frac, unrolled_data[ix].b_frac), 1e-9);
+        }
+    }
+
+    double norm = 0.0;
+    for (const auto& coefficient : fitted.k_values().values)
+    {
+        norm += std::norm(coefficient);
+    }
+
+    // Regularizing trades some of the accuracy at the known points for smaller coefficients
+    auto regularized = Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data, 0.1);
+    double regularized_norm = 0.0;
+    for (const auto& coefficient : regularized.k_values().values)
+    {
+        regularized_norm += std::norm(coefficient);
+    }
+    EXPECT_LT(regularized_norm, norm);
+
+    EXPECT_THROW(Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data, -1.0), std::runtime_error);
+    for (auto& point : unrolled_data)
+    {
+        point.weight = 0.0;
+    }
+    EXPECT_THROW(Interpolator::fit_least_squares(*hex_lat_ptr, unrolled_data), std::runtime_error);
+}
+
+// Rotations of a hexagonal slab don't map a 6x8 grid onto itself, but the k-points away from
+// the edges of the grid still share their coefficients with the ones they map onto
+TEST(StarBasisTest, HexagonalSlabOnNonSquareGrid)
+{
+    auto slab = cu::xtal::Structure::from_poscar(autotools::input_filesdir / "licoo2_stack5.vasp");
+    auto shift_group = make_shift_group(slab);
+    ASSERT_EQ(shift_group.size(), 6);
+
+    // Sum of plane waves over every image of a few k-points, so the data has the symmetry of the slab
+    int adim = 6;
+    int bdim = 8;
+    std::vector<InterPoint> unrolled_data;
+    for (int a = 0; a < adim; ++a)
+    {
+        for (int b = 0; b < bdim; ++b)
+        {
+            double a_frac = static_cast<double>(a) / adim;
+            double b_frac = static_cast<double>(b) / bdim;
+            double value = 0.0;
+            for (const auto& op : shift_group)
+            {
+                for (Eigen::Vector2i k : {Eigen::Vector2i(1, 0), Eigen::Vector2i(1, 1)})
+                {
+                    Eigen::Vector2i mapped = op.transpose() * k;
+                    value += std::cos(2 * M_PI * (mapped(0) * a_frac + mapped(1) * b_frac));
+                }
+            }
+            unrolled_data.emplace_back(a_frac, b_frac, value);
+        }
+    }
+
+    Interpolator ipolator(slab.lattice(), unrolled_data);
+    Analytiker full(ipolator);
+    Analytiker stars(ipolator, shift_group);
+
+    std::map<std::pair<long, long>, int> k_ixs;
+    const auto& k_points = stars.k_points();
+    for (int ix = 0; ix < k_points.size(); ++ix)
+    {
+        k_ixs[std::make_pair(std::lround(k_points.a_fracs[ix]), std::lround(k_points.b_fracs[ix]))] = ix;
+    }
+    auto is_edge = [&](long p, long q) { return 2 * std::abs(p) == adim || 2 * std::abs(q) == bdim; };
+
+    // 28 stars, which pair up with their inverses into 17 sets of terms
+    int star_count = 0;
+    for (const auto& bit : stars.formula_bits())
+    {
+        if (std::get<1>(bit) != Analytiker::FormulaBitBasis::RECOS)
+        {
+            continue;
+        }
+        ++star_count;
+
+        // Stars that hold their own inverse only list half of it
+        auto star = stars.star(std::get<2>(bit));
+        auto in_star = [&](long p, long q) {
+            for (auto k : {std::make_pair(p, q), std::make_pair(-p, -q)})
+            {
+                auto k_ix = k_ixs.find(k);
+                if (k_ix != k_ixs.end() && std::find(star.begin(), star.end(), k_ix->second) != star.end())
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        for (int k_ix : star)
+        {
+            long p = std::lround(k_points.a_fracs[k_ix]);
+            long q = std::lround(k_points.b_fracs[k_ix]);
+            for (const auto& op : shift_group)
+            {
+                long mapped_p = op(0, 0) * p + op(1, 0) * q;
+                long mapped_q = op(0, 1) * p + op(1, 1) * q;
+                if (!is_edge(p, q) && k_ixs.count(std::make_pair(mapped_p, mapped_q)) && !is_edge(mapped_p, mapped_q))
+                {
+                    EXPECT_TRUE(in_star(mapped_p, mapped_q)) << "(" << p << "," << q << ") maps to (" << mapped_p << "," << mapped_q << ")";
+                }
+            }
+        }
+    }
+    EXPECT_EQ(star_count, 17);
+
+    // The data is symmetric and doesn't reach the edges of the grid, so the stars change nothing
+    SurfaceEvaluator full_surface(full);
+    SurfaceEvaluator star_surface(stars);
+    for (double a_frac : {0.0, 0.13, 0.5, 0.71})
+    {
+        for (double b_frac : {0.0, 0.29, 0.62})
+        {
+            Eigen::Vector2d point = (a_frac * slab.lattice().a() + b_frac * slab.lattice().b()).head<2>();
+            EXPECT_NEAR(star_surface.value(point), full_surface.value(point), 1e-10);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,101 @@
+#include <multishift/pareto.hpp>
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace mush;
+
+class ParetoFrontTest : public testing::Test
+{
+protected:
+    /// Size and cost of a handful of candidates, in no particular order
+    std::vector<std::pair<double, double>> candidates{{4, 0.5}, {1, 3.0}, {2, 1.0}, {3, 1.5}, {5, 0.5}, {6, 0.1}, {2, 2.0}};
+
+    static std::vector<double> sizes(const ParetoFront<int>& front)
+    {
+        std::vector<double> front_sizes;
+        for (const auto& entry : front.entries())
+        {
+            front_sizes.push_back(entry.size);
+        }
+        return front_sizes;
+    }
+};
+
+TEST_F(ParetoFrontTest, KeepsNonDominated)
+{
+    ParetoFront<int> front(10);
+    for (int i = 0; i < candidates.size(); ++i)
+    {
+        front.insert(candidates[i].first, candidates[i].second, i);
+    }
+
+    EXPECT_EQ(sizes(front), (std::vector<double>{1, 2, 4, 6}));
+    EXPECT_EQ(front.entries()[1].item, 2);
+    EXPECT_FALSE(front.full());
+
+    // Costs go down as the sizes go up
+    for (int i = 1; i < front.entries().size(); ++i)
+    {
+        EXPECT_LT(front.entries()[i].cost, front.entries()[i - 1].cost);
+    }
+}
+
+TEST_F(ParetoFrontTest, OrderDoesNotMatter)
+{
+    ParetoFront<int> forward(10);
+    ParetoFront<int> backward(10);
+    for (int i = 0; i < candidates.size(); ++i)
+    {
+        forward.insert(candidates[i].first, candidates[i].second, i);
+        int j = candidates.size() - 1 - i;
+        backward.insert(candidates[j].first, candidates[j].second, j);
+    }
+    EXPECT_EQ(sizes(forward), sizes(backward));
+}
+
+TEST_F(ParetoFrontTest, BoundedSize)
+{
+    ParetoFront<int> front(2);
+    for (int i = 0; i < candidates.size(); ++i)
+    {
+        front.insert(candidates[i].first, candidates[i].second, i);
+    }
+
+    // The smallest and the cheapest trade-offs stay, no matter what comes in between
+    EXPECT_TRUE(front.full());
+    EXPECT_EQ(sizes(front), (std::vector<double>{1, 6}));
+
+    // A full front still takes anything that isn't dominated
+    EXPECT_TRUE(front.is_competitive(3, 0.05));
+    EXPECT_TRUE(front.is_competitive(1.5, 0.5));
+    EXPECT_FALSE(front.is_competitive(6.5, 0.2));
+}
+
+TEST_F(ParetoFrontTest, FullFrontKeepsItsSpread)
+{
+    // Sizes 1 to 10 on a straight front, fed in order of increasing size
+    ParetoFront<int> front(4);
+    for (int size = 1; size <= 10; ++size)
+    {
+        front.insert(size, 10 - size, size);
+    }
+
+    ASSERT_TRUE(front.full());
+    auto kept = sizes(front);
+    EXPECT_EQ(kept.front(), 1);
+    EXPECT_EQ(kept.back(), 10);
+
+    // The sizes that are kept don't bunch up at either end
+    for (int i = 1; i < kept.size(); ++i)
+    {
+        EXPECT_LE(kept[i] - kept[i - 1], 4);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
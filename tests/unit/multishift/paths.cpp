@@ -0,0 +1,121 @@
+#include "../../autotools.hh"
+#include <multishift/evaluator.hpp>
+#include <multishift/fourier.hpp>
+#include <multishift/paths.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+
+using namespace mush;
+
+namespace
+{
+/// Egg carton with a maximum at the origin, minima in the middle of the cell, and saddle
+/// points halfway along a and b. The last term tilts the straight glide path out of the valley.
+double fake_gamma_surface(double a_frac, double b_frac)
+{
+    double two_pi = 2 * M_PI;
+    return std::cos(two_pi * a_frac) + std::cos(two_pi * b_frac) + 0.3 * std::sin(two_pi * (a_frac + b_frac));
+}
+} // namespace
+
+class PathsTest : public testing::Test
+{
+protected:
+    std::unique_ptr<cu::xtal::Lattice> lat_ptr;
+    std::unique_ptr<SurfaceEvaluator> evaluator_ptr;
+    Eigen::Matrix2d cell;
+
+    virtual void SetUp() override
+    {
+        lat_ptr.reset(new cu::xtal::Lattice(Eigen::Vector3d(3.0, 0, 0), Eigen::Vector3d(0, 3.0, 0), Eigen::Vector3d(0, 0, 10)));
+        cell << 3.0, 0.0, 0.0, 3.0;
+
+        int dim = 12;
+        std::vector<InterPoint> unrolled_data;
+        for (int a = 0; a < dim; ++a)
+        {
+            for (int b = 0; b < dim; ++b)
+            {
+                double a_frac = static_cast<double>(a) / dim;
+                double b_frac = static_cast<double>(b) / dim;
+                unrolled_data.emplace_back(a_frac, b_frac, ::fake_gamma_surface(a_frac, b_frac));
+            }
+        }
+        evaluator_ptr.reset(new SurfaceEvaluator(Interpolator(*lat_ptr, unrolled_data), 1e-12));
+    }
+
+    /// Gradient of the surface at the point, through the evaluator
+    Eigen::Vector2d gradient(const Eigen::Vector2d& cart) const
+    {
+        Eigen::Matrix2Xd points = cart;
+        return evaluator_ptr->evaluate(points, SurfaceEvaluator::Order::GRADIENT).gradients.col(0);
+    }
+};
+
+TEST_F(PathsTest, StationaryPoints)
+{
+    auto stationary_points = find_stationary_points(*evaluator_ptr, cell, 8);
+    ASSERT_EQ(std::count_if(stationary_points.begin(), stationary_points.end(), [](const StationaryPoint& p) { return p.order == 0; }), 1);
+    ASSERT_EQ(std::count_if(stationary_points.begin(), stationary_points.end(), [](const StationaryPoint& p) { return p.order == 1; }), 2);
+    ASSERT_EQ(std::count_if(stationary_points.begin(), stationary_points.end(), [](const StationaryPoint& p) { return p.order == 2; }), 1);
+
+    for (int i = 0; i < stationary_points.size(); ++i)
+    {
+        const auto& point = stationary_points[i];
+        EXPECT_LT(gradient(point.cart).norm(), 1e-8);
+        EXPECT_NEAR(point.value, ::fake_gamma_surface(point.frac(0), point.frac(1)), 1e-10);
+        EXPECT_TRUE((point.frac.array() >= 0.0).all() && (point.frac.array() < 1.0).all());
+        EXPECT_LE(point.curvatures(0), point.curvatures(1));
+        if (i > 0)
+        {
+            EXPECT_LE(stationary_points[i - 1].order, point.order);
+        }
+    }
+}
+
+TEST_F(PathsTest, GlidePath)
+{
+    auto minimum = find_stationary_points(*evaluator_ptr, cell, 8).front();
+    ASSERT_EQ(minimum.order, 0);
+
+    // Glide from the minimum to its periodic image one lattice vector along a
+    StringSettings settings;
+    settings.tolerance = 1e-6;
+    auto path = find_minimum_energy_path(*evaluator_ptr, cell, minimum.cart, minimum.cart + cell.col(0), settings);
+    ASSERT_TRUE(path.converged);
+    ASSERT_EQ(path.points.size(), settings.images);
+    EXPECT_NEAR((path.points.front() - minimum.cart).norm(), 0.0, 1e-12);
+    EXPECT_NEAR((path.points.back() - minimum.cart - cell.col(0)).norm(), 0.0, 1e-12);
+
+    // The images stay equally spaced, up to how much the path bends between them
+    double spacing = path.arc_lengths.back() / (settings.images - 1);
+    for (int i = 1; i < path.points.size(); ++i)
+    {
+        EXPECT_NEAR(path.arc_lengths[i] - path.arc_lengths[i - 1], spacing, 1e-2 * spacing);
+    }
+
+    ASSERT_TRUE(path.has_saddle);
+    EXPECT_EQ(path.saddle.order, 1);
+    EXPECT_NEAR(path.barrier, path.saddle.value - minimum.value, 1e-12);
+    EXPECT_GE(path.barrier, path.values[path.highest_image] - minimum.value - 1e-12);
+
+    // Relaxing the path can only bring the barrier down from the one of the straight line
+    double straight_barrier = 0.0;
+    for (int i = 0; i <= 100; ++i)
+    {
+        Eigen::Vector2d frac = cell.inverse() * (minimum.cart + i / 100.0 * cell.col(0));
+        straight_barrier = std::max(straight_barrier, ::fake_gamma_surface(frac(0), frac(1)) - minimum.value);
+    }
+    EXPECT_LT(path.barrier, straight_barrier);
+
+    EXPECT_THROW(find_minimum_energy_path(*evaluator_ptr, cell, minimum.cart, minimum.cart), std::runtime_error);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
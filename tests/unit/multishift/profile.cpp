@@ -0,0 +1,113 @@
+#include "../../autotools.hh"
+#include <multishift/parallel.hpp>
+#include <multishift/profile.hpp>
+
+#include <condition_variable>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+
+using namespace mush;
+
+class ProfilerTest : public testing::Test
+{
+protected:
+    virtual void SetUp() override
+    {
+        fs::create_directories(autotools::output_filesdir);
+        Profiler::instance().reset();
+    }
+
+    virtual void TearDown() override { Profiler::instance().enable(false); }
+};
+
+TEST_F(ProfilerTest, DisabledCollectsNothing)
+{
+    Profiler::instance().enable(false);
+    {
+        ScopedTimer timer("phase");
+        profile_count("things");
+    }
+
+    auto report = Profiler::instance().report();
+    EXPECT_TRUE(report["phases"].empty());
+    EXPECT_TRUE(report["counters"].empty());
+}
+
+TEST_F(ProfilerTest, PhasesAndCountersAddUp)
+{
+    Profiler::instance().enable();
+    parallel_for(20, 4, [](int i) {
+        ScopedTimer timer("work");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        profile_count("items");
+        profile_count("weight", i);
+    });
+
+    auto report = Profiler::instance().report();
+    EXPECT_EQ(report["phases"]["work"]["calls"].get<long>(), 20);
+    EXPECT_GE(report["phases"]["work"]["seconds"].get<double>(), 0.02);
+    EXPECT_EQ(report["counters"]["items"].get<long>(), 20);
+    EXPECT_EQ(report["counters"]["weight"].get<long>(), 190);
+    EXPECT_GT(report["peak_resident_bytes"].get<long>(), 0);
+}
+
+TEST_F(ProfilerTest, ReportWhileThreadsRun)
+{
+    Profiler::instance().enable();
+    profile_count("items", 2);
+
+    // Counted by a thread that is still around when the report is made, and by one that isn't
+    std::mutex mutex;
+    std::condition_variable done;
+    bool counted = false;
+    bool reported = false;
+    std::thread running([&]() {
+        profile_count("items", 3);
+        std::unique_lock<std::mutex> lock(mutex);
+        counted = true;
+        done.notify_all();
+        done.wait(lock, [&]() { return reported; });
+    });
+    std::thread([]() { profile_count("items", 5); }).join();
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return counted; });
+    }
+    EXPECT_EQ(Profiler::instance().report()["counters"]["items"].get<long>(), 10);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reported = true;
+    }
+    done.notify_all();
+    running.join();
+    EXPECT_EQ(Profiler::instance().report()["counters"]["items"].get<long>(), 10);
+
+    Profiler::instance().reset();
+    EXPECT_TRUE(Profiler::instance().report()["counters"].empty());
+}
+
+TEST_F(ProfilerTest, WriteReport)
+{
+    Profiler::instance().enable();
+    profile_count("items", 3);
+    EXPECT_FALSE(Profiler::instance().reported());
+
+    auto target = autotools::output_filesdir / "profile.json";
+    Profiler::instance().write_report(target);
+    EXPECT_TRUE(Profiler::instance().reported());
+
+    std::ifstream report_stream(target);
+    json report;
+    report_stream >> report;
+    EXPECT_EQ(report["counters"]["items"].get<long>(), 3);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
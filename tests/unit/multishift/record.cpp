@@ -0,0 +1,339 @@
+#include "../../autotools.hh"
+#include <multishift/record.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+using namespace mush;
+
+class RecordWriterTest : public testing::Test
+{
+protected:
+    json expected_record;
+
+    virtual void SetUp() override
+    {
+        fs::create_directories(autotools::output_filesdir);
+
+        expected_record["grid"] = std::vector<int>{2, 3};
+        expected_record["cleavages"] = std::vector<double>{0.0, 1.5};
+        expected_record["shift_units"] = std::vector<std::vector<double>>{{1.0, 0.0}, {-0.5, 0.8}};
+        for (int a = 0; a < 2; ++a)
+        {
+            for (int b = 0; b < 3; ++b)
+            {
+                json chunk;
+                chunk["grid_point"] = std::vector<int>{a, b};
+                chunk["cleavage"] = 1.5;
+                chunk["equivalent_structures"] = std::vector<std::string>{"0:0:1.500000", "1:2:1.500000"};
+                chunk["directory"] = "shift__" + std::to_string(a) + "." + std::to_string(b);
+                expected_record["ids"][std::to_string(a) + ":" + std::to_string(b) + ":1.500000"] = chunk;
+            }
+        }
+        expected_record["equivalents"] = std::vector<std::vector<std::string>>{{"0:0:1.500000"}};
+    }
+
+    /// Write the expected record one piece at a time, with the ids in between the other entries
+    void stream_record(const fs::path& target)
+    {
+        RecordWriter writer(target, RecordWriter::format_from_extension(target));
+        writer.write_entry("grid", expected_record["grid"]);
+        writer.write_entry("cleavages", expected_record["cleavages"]);
+        writer.write_entry("shift_units", expected_record["shift_units"]);
+
+        writer.begin_ids();
+        for (const auto& [id, chunk] : expected_record["ids"].items())
+        {
+            writer.write_id(id, chunk);
+        }
+        writer.end_ids();
+
+        writer.write_entry("equivalents", expected_record["equivalents"]);
+        writer.close();
+    }
+};
+
+TEST_F(RecordWriterTest, JSONRoundTrip)
+{
+    auto target = autotools::output_filesdir / "streamed_record.json";
+    stream_record(target);
+    EXPECT_EQ(load_record(target), expected_record);
+}
+
+TEST_F(RecordWriterTest, CBORRoundTrip)
+{
+    auto target = autotools::output_filesdir / "streamed_record.cbor";
+    stream_record(target);
+    EXPECT_EQ(load_record(target), expected_record);
+}
+
+TEST_F(RecordWriterTest, MessagePackRoundTrip)
+{
+    auto target = autotools::output_filesdir / "streamed_record.msgpack";
+    stream_record(target);
+    EXPECT_EQ(load_record(target), expected_record);
+}
+
+TEST_F(RecordWriterTest, EmptyIds)
+{
+    for (std::string extension : {".json", ".cbor", ".msgpack"})
+    {
+        auto target = autotools::output_filesdir / ("empty_record" + extension);
+        {
+            RecordWriter writer(target, RecordWriter::format_from_extension(target));
+            writer.begin_ids();
+            // Destructor closes everything
+        }
+        json expected;
+        expected["ids"] = json::object();
+        EXPECT_EQ(load_record(target), expected) << extension;
+    }
+}
+
+TEST_F(RecordWriterTest, UnknownExtension)
+{
+    EXPECT_THROW(RecordWriter::format_from_extension("record.yaml"), std::runtime_error);
+}
+
+class RecordReaderTest : public testing::Test
+{
+protected:
+    int a_max = 3;
+    int b_max = 2;
+    std::vector<double> cleavages{0.0, 1.5};
+
+    virtual void SetUp() override { fs::create_directories(autotools::output_filesdir); }
+
+    static std::string make_id(int a, int b, double cleavage)
+    {
+        std::stringstream id;
+        id << a << ":" << b << ":" << std::fixed << std::setprecision(6) << cleavage;
+        return id.str();
+    }
+
+    static double fake_energy(int a, int b, double cleavage) { return a + 10 * b + 100 * cleavage; }
+
+    /// Record where only (0,0) has a value at the first cleavage, and everything else points to it.
+    /// At the second cleavage every id has its own value.
+    void write_record(const fs::path& target)
+    {
+        RecordWriter writer(target, RecordWriter::format_from_extension(target));
+        writer.write_entry("grid", std::vector<int>{a_max, b_max});
+        writer.write_entry("cleavages", cleavages);
+        writer.write_entry("shift_units", std::vector<std::vector<double>>{{1.0, 0.0}, {0.0, 1.0}});
+        writer.begin_ids();
+        for (double cleavage : cleavages)
+        {
+            for (int a = 0; a < a_max; ++a)
+            {
+                for (int b = 0; b < b_max; ++b)
+                {
+                    json chunk;
+                    chunk["grid_point"] = std::vector<int>{a, b};
+                    chunk["cleavage"] = cleavage;
+                    chunk["orbit"] = 0;
+                    chunk["shift"] = std::vector<double>{0.5 * a, 0.5 * b};
+                    chunk["equivalent_structures"] = std::vector<std::string>{make_id(0, 0, cleavage)};
+                    if (cleavage == 0.0 && (a != 0 || b != 0))
+                    {
+                        chunk["representative"] = make_id(0, 0, cleavage);
+                    }
+                    else
+                    {
+                        chunk["energy"] = fake_energy(a, b, cleavage);
+                        chunk["volume"] = 1.0;
+                    }
+                    writer.write_id(make_id(a, b, cleavage), chunk);
+                }
+            }
+        }
+        writer.end_ids();
+        writer.write_entry("equivalents", std::vector<std::vector<std::string>>{{make_id(0, 0, 0.0)}});
+        writer.close();
+    }
+
+    void check_reader(const RecordReader& reader)
+    {
+        EXPECT_TRUE(reader.complete());
+        EXPECT_EQ(reader.size(), a_max * b_max * cleavages.size());
+        EXPECT_EQ(reader.grid_dims(), (std::array<int, 2>{a_max, b_max}));
+        EXPECT_EQ(reader.header()["shift_units"][1][1].get<double>(), 1.0);
+        EXPECT_EQ(reader.cleavages(), cleavages);
+
+        auto unfolded = reader.unrolled_data(0.0, "energy");
+        ASSERT_EQ(unfolded.size(), a_max * b_max);
+        for (const auto& point : unfolded)
+        {
+            EXPECT_EQ(point.value.real(), fake_energy(0, 0, 0.0));
+        }
+
+        auto sliced = reader.unrolled_data(1.5, "energy");
+        ASSERT_EQ(sliced.size(), a_max * b_max);
+        for (const auto& point : sliced)
+        {
+            int a = std::lround(point.a_frac * a_max);
+            int b = std::lround(point.b_frac * b_max);
+            EXPECT_EQ(point.value.real(), fake_energy(a, b, 1.5));
+        }
+    }
+};
+
+TEST_F(RecordReaderTest, EveryFormat)
+{
+    for (std::string extension : {".json", ".cbor", ".msgpack"})
+    {
+        auto target = autotools::output_filesdir / ("valued_record" + extension);
+        write_record(target);
+        check_reader(RecordReader(target));
+    }
+}
+
+TEST_F(RecordReaderTest, RequestedKeys)
+{
+    auto target = autotools::output_filesdir / "valued_record.json";
+    write_record(target);
+
+    RecordReader all_keys(target);
+    EXPECT_EQ(all_keys.value_keys(1.5), (std::vector<std::string>{"energy", "volume"}));
+
+    RecordReader energy_only(target, {"energy"});
+    EXPECT_EQ(energy_only.value_keys(1.5), std::vector<std::string>{"energy"});
+    EXPECT_THROW(energy_only.unrolled_data(1.5, "volume"), std::runtime_error);
+    EXPECT_THROW(energy_only.unrolled_data(2.0, "energy"), std::runtime_error);
+}
+
+TEST_F(RecordReaderTest, TruncatedRecord)
+{
+    auto target = autotools::output_filesdir / "valued_record.json";
+    write_record(target);
+
+    std::string contents;
+    {
+        std::ifstream record_stream(target);
+        contents.assign(std::istreambuf_iterator<char>(record_stream), std::istreambuf_iterator<char>());
+    }
+
+    // Cut the record off in the middle of the last id
+    auto truncated_target = autotools::output_filesdir / "truncated_record.json";
+    {
+        std::ofstream truncated_stream(truncated_target);
+        truncated_stream << contents.substr(0, contents.find(make_id(a_max - 1, b_max - 1, 1.5)) + 20);
+    }
+
+    EXPECT_THROW(RecordReader reader(truncated_target), std::runtime_error);
+
+    RecordReader tolerant_reader(truncated_target, {}, true);
+    EXPECT_FALSE(tolerant_reader.complete());
+    EXPECT_EQ(tolerant_reader.size(), a_max * b_max * cleavages.size() - 1);
+    EXPECT_EQ(tolerant_reader.unrolled_data(0.0, "energy").size(), a_max * b_max);
+}
+
+TEST_F(RecordReaderTest, TolerantLoad)
+{
+    auto target = autotools::output_filesdir / "valued_record.json";
+    write_record(target);
+
+    std::string contents;
+    {
+        std::ifstream record_stream(target);
+        contents.assign(std::istreambuf_iterator<char>(record_stream), std::istreambuf_iterator<char>());
+    }
+
+    auto truncated_target = autotools::output_filesdir / "truncated_record.json";
+    {
+        std::ofstream truncated_stream(truncated_target);
+        truncated_stream << contents.substr(0, contents.find(make_id(a_max - 1, b_max - 1, 1.5)) + 20);
+    }
+
+    bool complete = true;
+    auto partial = load_record(truncated_target, &complete);
+    EXPECT_FALSE(complete);
+    EXPECT_EQ(partial["ids"].size(), a_max * b_max * cleavages.size() - 1);
+    EXPECT_FALSE(partial["ids"].contains(make_id(a_max - 1, b_max - 1, 1.5)));
+    EXPECT_EQ(partial["grid"], json(std::vector<int>{a_max, b_max}));
+
+    auto full = load_record(target, &complete);
+    EXPECT_TRUE(complete);
+    EXPECT_EQ(full, load_record(target));
+
+    // Whatever was recovered can be written back out in any format
+    auto rewritten_target = autotools::output_filesdir / "rewritten_record.cbor";
+    mush::write_record(partial, rewritten_target);
+    EXPECT_EQ(load_record(rewritten_target), partial);
+}
+
+TEST_F(RecordReaderTest, UnfoldThroughOrbits)
+{
+    // Orbit 0 is (0,0) and (1,1), orbit 1 is (1,0) and (2,1), orbit 2 is (2,0) and (0,1).
+    // Only one id of the first two orbits has a value, nothing in the last one does, and (2,1) isn't listed at all.
+    auto orbit_of = [](int a, int b) { return (a + 3 - b) % 3; };
+    auto target = autotools::output_filesdir / "incomplete_record.json";
+    {
+        RecordWriter writer(target, RecordWriter::FORMAT::JSON);
+        writer.write_entry("grid", std::vector<int>{a_max, b_max});
+        writer.write_entry("cleavages", std::vector<double>{0.0});
+        writer.begin_ids();
+        for (int a = 0; a < a_max; ++a)
+        {
+            for (int b = 0; b < b_max; ++b)
+            {
+                if (a == 2 && b == 1)
+                {
+                    continue;
+                }
+
+                json chunk;
+                chunk["grid_point"] = std::vector<int>{a, b};
+                chunk["cleavage"] = 0.0;
+                chunk["orbit"] = orbit_of(a, b);
+                if (b == 0 && orbit_of(a, b) != 2)
+                {
+                    chunk["energy"] = fake_energy(a, b, 0.0);
+                }
+                writer.write_id(make_id(a, b, 0.0), chunk);
+            }
+        }
+        writer.end_ids();
+        writer.close();
+    }
+
+    RecordReader reader(target);
+    EXPECT_THROW(reader.unrolled_data(0.0, "energy"), std::runtime_error);
+
+    auto unfolded = reader.unrolled_data(0.0, "energy", true);
+    ASSERT_EQ(unfolded.size(), a_max * b_max);
+    for (const auto& point : unfolded)
+    {
+        int a = std::lround(point.a_frac * a_max);
+        int b = std::lround(point.b_frac * b_max);
+        int orbit = orbit_of(a, b);
+        if (orbit == 2 || (a == 2 && b == 1))
+        {
+            EXPECT_EQ(point.weight, 0.0);
+            EXPECT_EQ(point.value.real(), 0.0);
+        }
+        else
+        {
+            EXPECT_EQ(point.weight, 1.0);
+            EXPECT_EQ(point.value.real(), fake_energy(orbit, 0, 0.0));
+        }
+    }
+}
+
+TEST(ContentHashTest, FNV1a)
+{
+    EXPECT_EQ(content_hash(""), "cbf29ce484222325");
+    EXPECT_EQ(content_hash("a"), "af63dc4c8601ec8c");
+    EXPECT_NE(content_hash("POSCAR"), content_hash("POSCAR\n"));
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
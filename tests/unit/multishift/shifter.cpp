@@ -1,6 +1,7 @@
 #include "../../autotools.hh"
 #include <multishift/shifter.hpp>
 
+#include <algorithm>
 #include <gtest/gtest.h>
 #include <memory>
 
@@ -21,15 +22,88 @@ protected:
 
 TEST_F(ShifterSimpleCounting, CountCategories)
 {
-    EXPECT_EQ(shifter_ptr->shifted_structures.size(), a_max * b_max);
+    EXPECT_EQ(shifter_ptr->size(), a_max * b_max);
+    EXPECT_EQ(shifter_ptr->shift_vectors.size(), a_max * b_max);
     EXPECT_EQ(shifter_ptr->shift_records.size(), a_max * b_max);
     EXPECT_EQ(shifter_ptr->equivalence_map.size(), a_max * b_max);
-    EXPECT_EQ(shifter_ptr->wigner_seitz_shifted_structures.size(), a_max * b_max);
+    EXPECT_EQ(shifter_ptr->wigner_seitz_shift_vectors.size(), a_max * b_max);
 }
 
 TEST_F(ShifterSimpleCounting, WignerSeitzSanity)
 {
-    assert(shifter_ptr->equivalence_map == categorize_equivalently_shifted_structures(shifter_ptr->wigner_seitz_shifted_structures));
+    std::vector<cu::xtal::Structure> wigner_seitz_shifted_structures;
+    for (int i = 0; i < shifter_ptr->size(); ++i)
+    {
+        wigner_seitz_shifted_structures.push_back(shifter_ptr->wigner_seitz_shifted_structure(i));
+    }
+    auto compared_map = categorize_equivalently_shifted_structures(wigner_seitz_shifted_structures);
+    for (auto& equivalents : compared_map)
+    {
+        std::sort(equivalents.begin(), equivalents.end());
+    }
+    EXPECT_EQ(shifter_ptr->equivalence_map, compared_map);
+}
+
+TEST_F(ShifterSimpleCounting, OnDemandStructuresMatchBatch)
+{
+    auto batch = make_shifted_structures(shifter_ptr->slab, shifter_ptr->shift_vectors);
+    ASSERT_EQ(batch.size(), shifter_ptr->size());
+    for (int i = 0; i < shifter_ptr->size(); ++i)
+    {
+        auto structure = shifter_ptr->shifted_structure(i);
+        EXPECT_TRUE(structure.lattice().column_vector_matrix().isApprox(batch[i].lattice().column_vector_matrix()));
+        EXPECT_EQ(structure.basis_sites().size(), batch[i].basis_sites().size());
+    }
+}
+
+TEST_F(ShifterSimpleCounting, SymmetryOrbitsMatchComparison)
+{
+    std::vector<cu::xtal::Structure> shifted_structures;
+    for (int i = 0; i < shifter_ptr->size(); ++i)
+    {
+        shifted_structures.push_back(shifter_ptr->shifted_structure(i));
+    }
+
+    auto compared_map = categorize_equivalently_shifted_structures(shifted_structures);
+    for (auto& equivalents : compared_map)
+    {
+        std::sort(equivalents.begin(), equivalents.end());
+    }
+    EXPECT_EQ(shifter_ptr->equivalence_map, compared_map);
+
+    EXPECT_NO_THROW(Shifter(shifter_ptr->slab, a_max, b_max, true));
+    EXPECT_NO_THROW(Shifter(shifter_ptr->slab, 4, 3, true));
+}
+
+// Rotations of a hexagonal slab don't map a non-square grid onto itself, but they still
+// map some of its points onto each other
+TEST(ShifterHexagonalCounting, SymmetryOrbitsMatchComparison)
+{
+    cu::xtal::Structure slab = cu::xtal::Structure::from_poscar(autotools::input_filesdir / "licoo2_stack5.vasp");
+    Shifter shifter(slab, 6, 8);
+
+    std::vector<cu::xtal::Structure> shifted_structures;
+    for (int i = 0; i < shifter.size(); ++i)
+    {
+        shifted_structures.push_back(shifter.shifted_structure(i));
+    }
+
+    auto compared_map = categorize_equivalently_shifted_structures(shifted_structures);
+    for (auto& equivalents : compared_map)
+    {
+        std::sort(equivalents.begin(), equivalents.end());
+    }
+    EXPECT_EQ(shifter.equivalence_map, compared_map);
+
+    // Same number of orbits as the chain regression test, which has (0,4), (3,0) and (3,4) in one of them
+    int orbits = 0;
+    for (int i = 0; i < shifter.size(); ++i)
+    {
+        orbits += shifter.equivalence_map[i].front() == i;
+    }
+    EXPECT_EQ(orbits, 37);
+
+    EXPECT_NO_THROW(Shifter(slab, 4, 3, true));
 }
 
 int main(int argc, char** argv)
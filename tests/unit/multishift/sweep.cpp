@@ -0,0 +1,139 @@
+#include "../../autotools.hh"
+#include <multishift/sweep.hpp>
+
+#include <casmutils/xtal/structure.hpp>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace mush;
+
+TEST(SweepAngles, CoverEndpoints)
+{
+    auto angles = make_sweep_angles({0.5, 1.5, 0.25});
+    ASSERT_EQ(angles.size(), 5);
+    EXPECT_DOUBLE_EQ(angles.front(), 0.5);
+    EXPECT_DOUBLE_EQ(angles.back(), 1.5);
+
+    // 0.3/0.1 is a hair below 3, the stop still makes it in
+    angles = make_sweep_angles({0.0, 0.3, 0.1});
+    ASSERT_EQ(angles.size(), 4);
+    EXPECT_NEAR(angles.back(), 0.3, 1e-12);
+
+    // A stop that isn't a whole number of steps away is left out
+    angles = make_sweep_angles({1.0, 2.0, 0.3});
+    ASSERT_EQ(angles.size(), 4);
+    EXPECT_LT(angles.back(), 2.0);
+
+    EXPECT_EQ(make_sweep_angles({2.0, 2.0, 0.1}), std::vector<double>{2.0});
+}
+
+TEST(SweepAngles, RejectBadRanges)
+{
+    EXPECT_THROW(make_sweep_angles({1.0, 0.5, 0.1}), std::runtime_error);
+    EXPECT_THROW(make_sweep_angles({0.5, 1.0, 0.0}), std::runtime_error);
+    EXPECT_THROW(make_sweep_angles({0.5, 1.0}), std::runtime_error);
+}
+
+class SweepBudgetTest : public testing::Test
+{
+protected:
+    using ZONE = MoireLatticeReport::ZONE;
+    using LATTICE = MoireLatticeReport::LATTICE;
+
+    std::unique_ptr<Lattice> lat_ptr;
+    int max_lattice_sites = 1000;
+    double error_tol = 1e-8;
+
+    // Twist in degrees that makes the sqrt(7) supercell of graphene commensurate
+    const double commensurate_angle = std::acos(13.0 / 14.0) * 180.0 / M_PI;
+
+    virtual void SetUp() override
+    {
+        auto graphene = cu::xtal::Structure::from_poscar(autotools::input_filesdir / "graphene.vasp");
+        lat_ptr.reset(new Lattice(graphene.lattice()));
+    }
+
+    void expect_same_choice(const MoireApproximator& expected_approximator, const MoireApproximator& approximator, LATTICE lat, double tol) const
+    {
+        auto expected = expected_approximator.best_smallest(ZONE::ALIGNED, lat, tol);
+        auto report = approximator.best_smallest(ZONE::ALIGNED, lat, tol);
+        EXPECT_TRUE(report.approximate_moire_lattice.column_vector_matrix().isApprox(expected.approximate_moire_lattice.column_vector_matrix()));
+        EXPECT_NEAR(deformation_error(report), deformation_error(expected), 1e-12);
+    }
+};
+
+TEST_F(SweepBudgetTest, MatchesIndependentRuns)
+{
+    // The commensurate angle of the sqrt(7) cell is in the middle of the sweep, so the angles
+    // after it start from a small search space
+    std::vector<double> angles = make_sweep_angles({1.0, 3.0, 0.25});
+    angles.insert(angles.begin() + angles.size() / 2, commensurate_angle);
+
+    for (double tol : {error_tol, 1e-4})
+    {
+        SweepBudget<MoireApproximator> sweep_budget(*lat_ptr, max_lattice_sites, tol, ZONE::ALIGNED);
+        for (double angle : angles)
+        {
+            MoireApproximator independent(*lat_ptr, angle);
+            independent.expand(max_lattice_sites);
+
+            MoireApproximator swept(*lat_ptr, angle);
+            int budget = sweep_budget.expand(&swept);
+            EXPECT_LE(budget, std::max(max_lattice_sites, swept.minimum_lattice_sites(ZONE::ALIGNED)));
+
+            for (auto lat : {LATTICE::ALIGNED, LATTICE::ROTATED})
+            {
+                expect_same_choice(independent, swept, lat, tol);
+            }
+        }
+    }
+}
+
+TEST_F(SweepBudgetTest, SplitDoesNotMatter)
+{
+    // Same as handing the angles to threads in one stretch, or in stretches that begin at every angle
+    std::vector<double> angles{commensurate_angle, 5.0, commensurate_angle, 1.0};
+    SweepBudget<MoireApproximator> sweep_budget(*lat_ptr, max_lattice_sites, error_tol, ZONE::ALIGNED);
+    for (double angle : angles)
+    {
+        MoireApproximator fresh(*lat_ptr, angle);
+        SweepBudget<MoireApproximator>(*lat_ptr, max_lattice_sites, error_tol, ZONE::ALIGNED).expand(&fresh);
+
+        MoireApproximator swept(*lat_ptr, angle);
+        sweep_budget.expand(&swept);
+
+        for (auto lat : {LATTICE::ALIGNED, LATTICE::ROTATED})
+        {
+            expect_same_choice(fresh, swept, lat, error_tol);
+        }
+    }
+}
+
+TEST_F(SweepBudgetTest, BudgetFollowsChosenSupercells)
+{
+    // A small twist needs a large supercell. The commensurate angle of the sqrt(7) cell doesn't,
+    // so once it's been through the budget, the next angle starts from a small search space again.
+    SweepBudget<MoireApproximator> sweep_budget(*lat_ptr, max_lattice_sites, error_tol, ZONE::ALIGNED);
+
+    MoireApproximator small_twist(*lat_ptr, 1.0);
+    int small_twist_budget = sweep_budget.expand(&small_twist);
+
+    MoireApproximator commensurate_twist(*lat_ptr, commensurate_angle);
+    sweep_budget.expand(&commensurate_twist);
+    auto report = commensurate_twist.best_smallest(ZONE::ALIGNED, LATTICE::ALIGNED, error_tol);
+    EXPECT_LT(deformation_error(report), error_tol);
+
+    MoireApproximator next_twist(*lat_ptr, commensurate_angle);
+    int next_twist_budget = sweep_budget.expand(&next_twist);
+    EXPECT_LT(next_twist_budget, small_twist_budget);
+    EXPECT_GE(next_twist_budget, count_lattice_sites(report, *lat_ptr));
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}